@@ -43,3 +43,20 @@ if(MSVC)
   # 添加utf8支持
   add_definitions("/utf-8")
 endif(MSVC)
+
+# the text kernels have AVX2 code paths that are always compiled in and picked
+# at run time on cpus that have AVX2, see src/simd.h. Turning them off builds
+# and tests the scalar code on any machine
+option(ENABLE_SIMD "Compile the AVX2 text kernels with run time dispatch" ON)
+if(NOT ENABLE_SIMD)
+  add_compile_definitions(LIBNLP_NO_SIMD)
+endif()
+
+option(ENABLE_NATIVE_ARCH "Optimize for the instruction set of the build machine" OFF)
+if(ENABLE_NATIVE_ARCH)
+  if(MSVC)
+    add_compile_options(/arch:AVX2)
+  else()
+    add_compile_options(-march=native)
+  endif()
+endif()
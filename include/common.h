@@ -43,7 +43,11 @@ typedef SSIZE_T ssize_t;
 typedef int8_t nlp_int8_t;
 typedef int16_t nlp_int16_t;
 typedef int32_t nlp_int32_t;
+typedef int64_t nlp_int64_t;
 typedef uint8_t nlp_uint8_t;
+typedef uint16_t nlp_uint16_t;
+typedef uint32_t nlp_uint32_t;
+typedef uint64_t nlp_uint64_t;
 typedef ptrdiff_t nlp_ssize_t;
 typedef size_t nlp_size_t;
 
@@ -0,0 +1,84 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Streaming corpus -> token shard pipeline for pretokenizing large corpora.
+
+    The calling thread reads the corpus in batches of whole documents, worker
+    threads of an internal thrdpool encode the batches, and a writer thread
+    puts the ids in corpus order into binary shard files. The stages are
+    connected by msgqueues and at most `max_in_flight` batches exist at any
+    time, so memory stays flat whatever the corpus size.
+*/
+
+/*
+    Same signature as the nlp_*_tokenizer_encode functions: write at most
+    `max_ids` ids and return the total number of ids, -1 if failed.
+    Called concurrently from the worker threads.
+*/
+typedef nlp_ssize_t (*nlp_encode_func_t)(const void *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids);
+
+typedef enum nlp_document_mode {
+    // every non-empty line is a document
+    NLP_DOCUMENT_LINE,
+    // documents are separated by empty lines
+    NLP_DOCUMENT_PARAGRAPH
+} nlp_document_mode_t;
+
+typedef struct nlp_pipeline_options
+{
+    nlp_document_mode_t document_mode;
+    // encoding threads
+    nlp_size_t num_workers;
+    // text bytes per batch, a longer document makes a batch of its own
+    nlp_size_t batch_bytes;
+    // batches read but not written yet, at least num_workers
+    nlp_size_t max_in_flight;
+    // a shard is closed between batches once it has this many ids
+    nlp_size_t shard_ids;
+    // appended after every document if >= 0, e.g. <|endoftext|>
+    nlp_int32_t eos_id;
+} nlp_pipeline_options_t;
+
+typedef struct nlp_pipeline_stats
+{
+    nlp_uint64_t bytes;
+    nlp_uint64_t documents;
+    nlp_uint64_t ids;
+    nlp_size_t shards;
+} nlp_pipeline_stats_t;
+
+/*
+    Line documents, 4 workers, 1 MiB batches, 16 batches in flight,
+    256 Mi ids per shard, no eos id
+*/
+LIBNLP_DLLEXPORT void nlp_pipeline_options_init(nlp_pipeline_options_t *options);
+
+/*
+    Encode every document of the file at `input_path` and write the ids as
+    native int32 to `<output_prefix>-00000.bin`, `<output_prefix>-00001.bin`, ...
+    A document never spans two shards. `options` and `stats` may be NULL.
+    Return 0, or -1 if reading, encoding or writing failed.
+*/
+LIBNLP_DLLEXPORT int nlp_pipeline_run(const char *input_path,
+  const char *output_prefix,
+  nlp_encode_func_t encode,
+  const void *tokenizer,
+  const nlp_pipeline_options_t *options,
+  nlp_pipeline_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,6 +8,11 @@ extern "C" {
 #endif
 
 LIBNLP_DLLEXPORT size_t readline(char **__restrict line, size_t *__restrict len, FILE *__restrict fp);
+/*
+    Read a whole file into a NUL terminated buffer, its length without the NUL is set to len.
+    Return NULL if failed, the buffer needs to be freed.
+*/
+LIBNLP_DLLEXPORT char *readfile(const char *__restrict path, size_t *__restrict len);
 #ifdef __cplusplus
 }
 #endif
@@ -63,6 +63,31 @@ extern "C" {
 // inline 函数会导致link错误，谨慎使用
 LIBNLP_DLLEXPORT char *utf8str_upper(char *s);
 LIBNLP_DLLEXPORT char *utf8str_lower(char *s);
+/*
+    Map `len` bytes of utf-8 text to its simple lowercase (uppercase) into a
+    caller buffer, character by character like utf8proc_tolower and without
+    normalizing; an ill-formed sequence is copied as is. At most `out_cap`
+    bytes are written and the output is NUL terminated if there is room
+    left. Return the output length without the NUL (like snprintf), never
+    more than len + len / 2.
+    This is lowercasing, not case folding: U+00B5 and U+03C2 are kept where
+    folding gives U+03BC and U+03C3, the same as str.lower() in the
+    reference uncased BERT tokenizer, whose vocab was built that way.
+*/
+LIBNLP_DLLEXPORT nlp_size_t utf8str_lower_into(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap);
+LIBNLP_DLLEXPORT nlp_size_t utf8str_upper_into(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap);
+/*
+    utf8str_lower_into in place, return the new length, which is at most
+    `len`, or -1 with the text unchanged if it holds U+023A or U+023E, the
+    two characters whose lowercase takes more bytes. No NUL is written.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t utf8str_lower_inplace(nlp_uint8_t *str, nlp_size_t len);
 
 // 字符判断
 LIBNLP_DLLEXPORT bool utf8str_is_whitespace_char(nlp_int32_t cp);
@@ -70,12 +95,86 @@ LIBNLP_DLLEXPORT bool utf8str_is_control_char(nlp_int32_t cp);
 LIBNLP_DLLEXPORT bool utf8str_is_punctuation_char(nlp_int32_t cp);
 LIBNLP_DLLEXPORT bool utf8str_is_chinese_char(nlp_int32_t cp);
 
+// 字符类别，一个字符可以属于多个类别
+// ' ', '\t', '\n', '\r' and Zs
+#define UTF8_CLASS_WHITESPACE 0x01
+// Cc, Cf, Cs, Co and unassigned, except '\t', '\n', '\r'
+#define UTF8_CLASS_CONTROL 0x02
+// ascii symbols and Pc, Pd, Ps, Pe, Pi, Pf, Po
+#define UTF8_CLASS_PUNCTUATION 0x04
+// the CJK unified ideograph blocks
+#define UTF8_CLASS_CHINESE 0x08
+// Mn, what stripping accents removes
+#define UTF8_CLASS_NONSPACING_MARK 0x10
+#define UTF8_CLASS_LETTER 0x20
+#define UTF8_CLASS_NUMBER 0x40
+// a byte that does not start a valid utf-8 sequence, only set by utf8str_classify
+#define UTF8_CLASS_INVALID 0x80
+
+/* UTF8_CLASS_* flags of a codepoint, two table loads */
+LIBNLP_DLLEXPORT nlp_uint8_t utf8str_char_class(nlp_int32_t cp);
+/*
+    Classify every character of `len` bytes of utf-8 text: flags[i] is set to
+    the classes of the i-th character, an invalid byte counts as one
+    character with UTF8_CLASS_INVALID. At most `cap` flags are written,
+    return the number of characters.
+*/
+LIBNLP_DLLEXPORT nlp_size_t utf8str_classify(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *flags,
+  nlp_size_t cap);
+
+// utf-8 校验
+typedef enum utf8_repair_mode {
+    UTF8_REPAIR_REPLACE,// replace with U+FFFD
+    UTF8_REPAIR_DROP
+} utf8_repair_mode_t;
+
+/* Byte length of the longest valid utf-8 prefix of `len` bytes, `len` if they are all valid */
+LIBNLP_DLLEXPORT nlp_size_t utf8str_valid_prefix(const nlp_uint8_t *str, nlp_size_t len);
+LIBNLP_DLLEXPORT bool utf8str_is_valid(const nlp_uint8_t *str, nlp_size_t len);
+/*
+    Copy `len` bytes of text to `out` with every ill-formed sequence replaced
+    by U+FFFD or dropped. A sequence is the maximal subpart of the unicode
+    standard, e.g. a 3-byte character cut short after 2 bytes is one
+    replacement. At most `out_cap` bytes are written and the output is NUL
+    terminated if there is room left. Return the output length without the
+    NUL (like snprintf), at most 3 * len. With UTF8_REPAIR_DROP the output is
+    never longer than the input and `out` may be `str`.
+*/
+LIBNLP_DLLEXPORT nlp_size_t utf8str_repair(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap,
+  utf8_repair_mode_t mode);
+
 // 字符串遍历
 LIBNLP_DLLEXPORT nlp_ssize_t utf8str_iterate(const nlp_uint8_t *str, nlp_ssize_t strlen, nlp_int32_t *dst);
 LIBNLP_DLLEXPORT nlp_ssize_t utf8proc_iterate_reversed(const nlp_uint8_t *str, nlp_ssize_t start, nlp_int32_t *dst);
+/*
+    Decode `len` bytes of utf-8 text to codepoints, an ill-formed sequence
+    (see utf8str_repair) becomes U+FFFD. At most `cap` codepoints are
+    written to `dst`, return the number of codepoints (like snprintf), never
+    more than `len`.
+*/
+LIBNLP_DLLEXPORT nlp_size_t utf8str_decode(const nlp_uint8_t *str, nlp_size_t len, nlp_int32_t *dst, nlp_size_t cap);
+/*
+    Encode `n` codepoints to utf-8, a surrogate or a value that is not a
+    codepoint becomes U+FFFD. At most `out_cap` bytes are written and the
+    output is NUL terminated if there is room left. Return the output length
+    without the NUL (like snprintf), never more than 4 * n.
+*/
+LIBNLP_DLLEXPORT nlp_size_t utf8str_encode(const nlp_int32_t *src, nlp_size_t n, nlp_uint8_t *out, nlp_size_t out_cap);
 
 // utf8 字符串长度
+/*
+    Number of characters in `len` bytes of utf-8 text, counted without
+    decoding as the bytes that are not continuation bytes. Invalid input
+    gets the same count, a stray lead byte is one character and a stray
+    continuation byte none.
+*/
 LIBNLP_DLLEXPORT nlp_size_t utf8str_nlen(const nlp_uint8_t *str, nlp_size_t len);
+/* Same as utf8str_nlen up to the NUL */
 LIBNLP_DLLEXPORT nlp_size_t utf8str_len(const nlp_uint8_t *str);
 
 // utf8 字符串搜索
@@ -10,22 +10,488 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 #include "common.h"
+#include "thrdpool.h"
 
 #include <stdbool.h>
+#include <stdio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 extern int tokenizer_version;
 typedef struct basic_tokenizer basic_tokenizer_t;
-basic_tokenizer_t *nlp_basic_tokenizer_create(bool do_lower_case);
+/* Same as nlp_basic_tokenizer_create_ex(do_lower_case, true, do_lower_case) */
+LIBNLP_DLLEXPORT basic_tokenizer_t *nlp_basic_tokenizer_create(bool do_lower_case);
+/* Return NULL if failed */
+LIBNLP_DLLEXPORT basic_tokenizer_t *nlp_basic_tokenizer_create_ex(bool do_lower_case,
+  bool tokenize_chinese_chars,
+  bool strip_accents);
 
-void nlp_basic_tokenizer_edestory(basic_tokenizer_t *tokenizer);
+LIBNLP_DLLEXPORT void nlp_basic_tokenizer_destory(basic_tokenizer_t *tokenizer);
+
+/*
+    BERT basic tokenization of `len` bytes of utf-8 text in a single pass:
+    control characters and invalid bytes are dropped, punctuation and CJK
+    characters become words of their own, letters are lowercased and
+    stripped of accents (NFD without nonspacing marks) as configured.
+    The words are written to `out` separated by single spaces. At most
+    `out_cap` bytes are written and the output is NUL terminated if there
+    is room left. Return the output length without the NUL (like snprintf),
+    -1 on invalid arguments.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_basic_tokenizer_normalize(const basic_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  char *out,
+  nlp_size_t out_cap);
 
 typedef struct bert_tokenizer bert_tokenizer_t;
-bert_tokenizer_t *nlp_bert_tokenizer_create(const char *vocab_path, bool do_lower_case);
+/*
+    Load a BERT vocab.txt, one token per line, the line number is the token id.
+    Return NULL if failed.
+*/
+LIBNLP_DLLEXPORT bert_tokenizer_t *nlp_bert_tokenizer_create(const char *vocab_path, bool do_lower_case);
+/*
+    Load a vocab compiled by nlp_bert_vocab_compile. The file is mapped
+    read-only and shared, so startup does no parsing and processes loading
+    the same file share one physical copy. Return NULL if failed.
+*/
+LIBNLP_DLLEXPORT bert_tokenizer_t *nlp_bert_tokenizer_create_from_binary(const char *binary_path, bool do_lower_case);
+/*
+    Compile vocab.txt into a binary file holding the string pool, the id table
+    and the wordpiece trie. The file is only valid on machines with the same
+    byte order. Return 0 on success, -1 if failed.
+*/
+LIBNLP_DLLEXPORT int nlp_bert_vocab_compile(const char *vocab_path, const char *binary_path);
+
+LIBNLP_DLLEXPORT void nlp_bert_tokenizer_destory(bert_tokenizer_t *tokenzier);
+
+/*
+    Replace the vocab of a tokenizer that may be in use, for hot reloading.
+    Encodes started before the swap finish on the old vocab, which is freed
+    when the last of them returns, later ones use the new vocab. Encodes
+    never wait for a swap or for each other, a swap only waits for encodes
+    that are between loading the vocab and pinning it. Special tokens added
+    with nlp_bert_tokenizer_add_special_tokens are added to the new vocab
+    and the word cache starts empty with the same settings. Return 0 on
+    success, -1 if failed, which leaves the tokenizer unchanged.
+*/
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_swap_vocab(bert_tokenizer_t *tokenizer, const char *vocab_path);
+/* Same as nlp_bert_tokenizer_swap_vocab with a vocab compiled by nlp_bert_vocab_compile */
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_swap_binary_vocab(bert_tokenizer_t *tokenizer, const char *binary_path);
+
+LIBNLP_DLLEXPORT nlp_size_t nlp_bert_tokenizer_vocab_size(const bert_tokenizer_t *tokenizer);
+/* Return -1 if the token is not in vocab */
+LIBNLP_DLLEXPORT nlp_int32_t nlp_bert_tokenizer_token_to_id(const bert_tokenizer_t *tokenizer,
+  const char *token,
+  nlp_size_t len);
+/* Return NULL if the id is out of range. The token stays valid until the vocab is swapped */
+LIBNLP_DLLEXPORT const char *nlp_bert_tokenizer_id_to_token(const bert_tokenizer_t *tokenizer, nlp_int32_t id);
+
+/*
+    Special tokens are cut out of the raw text before normalization and
+    encode to their id, so they are never lowercased or split. The [PAD],
+    [UNK], [CLS], [SEP] and [MASK] tokens of the vocab are special from the
+    start. A token that is not in the vocab gets the next id after the
+    vocab and the tokens added before it. The tokens are matched exactly,
+    the leftmost and then longest one wins. Like a swap, this may be called
+    while the tokenizer is in use and the word cache starts empty. Return 0
+    on success, -1 if failed.
+*/
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_add_special_tokens(bert_tokenizer_t *tokenizer,
+  const char *const *tokens,
+  nlp_size_t num_tokens);
+
+typedef enum nlp_cache_policy {
+    // evict a word not used since the clock hand of its set last passed, close to least recently used
+    NLP_CACHE_LRU,
+    // evict the earliest added word, hits do not reorder anything
+    NLP_CACHE_FIFO
+} nlp_cache_policy_t;
+
+typedef struct nlp_cache_stats
+{
+    nlp_uint64_t hits;
+    nlp_uint64_t misses;
+    nlp_uint64_t evictions;
+    nlp_size_t size;
+    nlp_size_t capacity;
+} nlp_cache_stats_t;
+
+/*
+    Cache the wordpiece ids of up to `capacity` words, so frequent words skip
+    subword matching. The cache is shared by all threads encoding with the
+    tokenizer. A capacity of 0 removes the cache. Like a swap, this may be
+    called while the tokenizer is in use, encodes already running finish
+    with the old cache. Return 0 on success, -1 if failed.
+*/
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_set_cache(bert_tokenizer_t *tokenizer,
+  nlp_size_t capacity,
+  nlp_cache_policy_t policy);
+/* Counters since the cache was set, all zero without a cache */
+LIBNLP_DLLEXPORT void nlp_bert_tokenizer_cache_stats(const bert_tokenizer_t *tokenizer, nlp_cache_stats_t *stats);
+
+/*
+    Tokenize `len` bytes of utf-8 text into wordpiece ids, no special tokens are added.
+    At most `max_ids` ids are written, the return value is the number of ids
+    the whole text encodes to (like snprintf), -1 on invalid arguments.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_encode(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids);
+
+/*
+    Number of tokens nlp_bert_tokenizer_encode returns for the text, without
+    producing ids. With a `max_tokens` above 0 the text is processed a
+    chunk at a time and counting stops at max_tokens, which is returned for
+    any longer text, so checking a long document against a limit only
+    tokenizes its beginning. Return -1 on invalid arguments.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_count(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_size_t max_tokens);
+
+/* A token as a byte range of the input text, [start, end) */
+typedef struct nlp_token_span
+{
+    nlp_size_t start;
+    nlp_size_t end;
+    nlp_int32_t id;
+} nlp_token_span_t;
+
+/*
+    Same as nlp_bert_tokenizer_encode but every token is reported as the byte
+    range of `text` it was produced from, nothing is copied or allocated.
+    Continuation pieces of a word get adjacent ranges, an unknown word maps
+    to a single [UNK] span over the whole word. Useful to align predictions
+    back to the input (NER, QA spans).
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_encode_spans(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_token_span_t *spans,
+  nlp_size_t max_spans);
+
+/*
+    Encode a document again after an edit, reusing the tokens the edit can
+    not change. `prev_spans` is the complete encoding of the old document by
+    nlp_bert_tokenizer_encode_spans, then the old bytes [edit_start, edit_end)
+    were replaced by `replacement_len` bytes, giving the `len` bytes of
+    `text`. Only the text from the word boundary before the edit to the one
+    after it is encoded, the other tokens are copied, so the cost depends on
+    the edit and not on the document. `spans` must not overlap `prev_spans`.
+    Return the same as nlp_bert_tokenizer_encode_spans on the new text.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_reencode_spans(const bert_tokenizer_t *tokenizer,
+  const nlp_token_span_t *prev_spans,
+  nlp_size_t num_prev_spans,
+  nlp_size_t edit_start,
+  nlp_size_t edit_end,
+  nlp_size_t replacement_len,
+  const char *text,
+  nlp_size_t len,
+  nlp_token_span_t *spans,
+  nlp_size_t max_spans);
+
+/*
+    Streaming encoding of text that arrives in chunks of any size, split
+    anywhere, even inside a utf-8 sequence. Tokens are passed to the callback
+    as soon as no later byte can change them, which is at the next word
+    boundary, so memory stays bounded by the longest word and not by the
+    line or the document. The tokens are the same as encoding all the text
+    at once, spans are byte ranges from the start of the stream. The stream
+    keeps the vocab of when it was created, see nlp_bert_tokenizer_swap_vocab.
+*/
+typedef struct bert_stream bert_stream_t;
+
+/* Called with the next tokens of the stream in order, return non-zero to stop the stream */
+typedef int (*nlp_token_callback_t)(void *context, const nlp_token_span_t *spans, nlp_size_t num_spans);
+
+/* Return NULL if failed */
+LIBNLP_DLLEXPORT bert_stream_t *nlp_bert_stream_create(const bert_tokenizer_t *tokenizer,
+  nlp_token_callback_t callback,
+  void *context);
+/* Return 0, or -1 if encoding failed or the callback stopped the stream, which fails every later call */
+LIBNLP_DLLEXPORT int nlp_bert_stream_write(bert_stream_t *stream, const char *data, nlp_size_t len);
+/* Encode the bytes still waiting for the end of their word. Return the same as nlp_bert_stream_write */
+LIBNLP_DLLEXPORT int nlp_bert_stream_finish(bert_stream_t *stream);
+LIBNLP_DLLEXPORT void nlp_bert_stream_destory(bert_stream_t *stream);
+
+/* Stream everything `fp` has left through the tokenizer, reading a block at a time. Return 0, or -1 if failed */
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_encode_file(const bert_tokenizer_t *tokenizer,
+  FILE *fp,
+  nlp_token_callback_t callback,
+  void *context);
+/* Same as nlp_bert_tokenizer_encode_file with read() on a file descriptor, such as a pipe or a socket */
+LIBNLP_DLLEXPORT int nlp_bert_tokenizer_encode_fd(const bert_tokenizer_t *tokenizer,
+  int fd,
+  nlp_token_callback_t callback,
+  void *context);
+
+typedef enum nlp_padding_strategy {
+    // pad every row to the longest row in the batch
+    NLP_PADDING_LONGEST,
+    // pad every row to max_length
+    NLP_PADDING_MAX_LENGTH
+} nlp_padding_strategy_t;
+
+typedef enum nlp_truncation_strategy {
+    // fail if a row does not fit max_length
+    NLP_TRUNCATION_NONE,
+    // drop tokens from the end of the longer sequence of a pair first
+    NLP_TRUNCATION_LONGEST_FIRST,
+    NLP_TRUNCATION_ONLY_FIRST,
+    NLP_TRUNCATION_ONLY_SECOND
+} nlp_truncation_strategy_t;
+
+typedef struct nlp_bert_encode_options
+{
+    nlp_size_t max_length;
+    nlp_padding_strategy_t padding;
+    nlp_truncation_strategy_t truncation;
+    // [CLS] A [SEP] or [CLS] A [SEP] B [SEP]
+    bool add_special_tokens;
+    // spread the rows over this pool if not NULL, the calling thread works on them too
+    thrdpool_t *pool;
+    // number of threads taking part including the caller, usually pool threads + 1
+    nlp_size_t num_workers;
+} nlp_bert_encode_options_t;
+
+/* max_length 512, pad to max_length, longest first truncation, add special tokens, no pool */
+LIBNLP_DLLEXPORT void nlp_bert_encode_options_init(nlp_bert_encode_options_t *options);
+
+/*
+    Encode a batch of texts, or text pairs if `text_pairs` is not NULL, straight
+    into row-major int32 tensors of shape [batch_size, seq_len]:
 
-void nlp_bert_tokenizer_destory(bert_tokenizer_t *tokenzier);
+        input_ids[i * seq_len + j], attention_mask[i * seq_len + j], token_type_ids[i * seq_len + j]
+
+    Each buffer must hold batch_size * max_length values, attention_mask and
+    token_type_ids may be NULL if not needed. `text_lens` / `text_pair_lens`
+    may be NULL for NUL terminated texts. `options` may be NULL for defaults.
+    Return seq_len, which is max_length or the longest row depending on the
+    padding strategy, or -1 if failed.
+    With a pool in `options` the call returns once all rows are filled, the
+    vocab is shared read-only and every thread keeps its own scratch memory
+    for the next call. Tasks still queued on the pool when the call returns
+    only release a small job once they run. A pool destroyed with such tasks
+    queued should run them from the `pending` callback of thrdpool_destroy,
+    otherwise the job is leaked.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_encode_batch(const bert_tokenizer_t *tokenizer,
+  const char *const *texts,
+  const nlp_size_t *text_lens,
+  const char *const *text_pairs,
+  const nlp_size_t *text_pair_lens,
+  nlp_size_t batch_size,
+  const nlp_bert_encode_options_t *options,
+  nlp_int32_t *input_ids,
+  nlp_int32_t *attention_mask,
+  nlp_int32_t *token_type_ids);
+
+/*
+    One encoded row that keeps its memory between calls, so encoding request
+    after request into the same encoding allocates nothing once its arrays
+    have grown to the longest row seen. An encoding is used by one thread at
+    a time, the values are valid until the next call that encodes into it.
+*/
+typedef struct nlp_encoding
+{
+    // number of values in each array, padding included
+    nlp_size_t len;
+    nlp_int32_t *input_ids;
+    nlp_int32_t *attention_mask;
+    nlp_int32_t *token_type_ids;
+    // the byte range of each token in the text or pair it came from, empty for added and padding tokens
+    nlp_token_span_t *spans;
+    // internal, capacity of the arrays and scratch memory of the tokenizer
+    nlp_size_t cap;
+    void *scratch;
+} nlp_encoding_t;
+
+/* Return NULL if failed */
+LIBNLP_DLLEXPORT nlp_encoding_t *nlp_encoding_create(void);
+LIBNLP_DLLEXPORT void nlp_encoding_destory(nlp_encoding_t *encoding);
+
+/*
+    Encode `text`, and `pair` if not NULL, into `encoding` the way a row of
+    nlp_bert_tokenizer_encode_batch is encoded, padded to max_length with
+    NLP_PADDING_MAX_LENGTH and not padded otherwise. `options` may be NULL
+    for defaults, the pool is ignored. Return encoding->len, or -1 if failed
+    which leaves the encoding empty.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bert_tokenizer_encode_into(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  const char *pair,
+  nlp_size_t pair_len,
+  const nlp_bert_encode_options_t *options,
+  nlp_encoding_t *encoding);
+
+/*
+    Length-bucketed dynamic batching: requests are encoded as they come in,
+    grouped by token length into buckets `bucket_width` tokens wide, and a
+    bucket becomes a batch once one more row would not fit `max_tokens`.
+    Rows of a batch are padded to its longest row, so padding stays below
+    bucket_width tokens per row whatever the order of the requests.
+*/
+typedef struct bert_batcher bert_batcher_t;
+
+typedef struct nlp_bert_batcher_options
+{
+    // max_length, truncation and special tokens of every row, padding and num_workers are ignored.
+    // With a pool the requests are encoded on it, otherwise by nlp_bert_batcher_add.
+    nlp_bert_encode_options_t encode;
+    // batch_size * seq_len of a batch never exceeds this, at least encode.max_length
+    nlp_size_t max_tokens;
+    nlp_size_t max_batch_size;
+    nlp_size_t bucket_width;
+} nlp_bert_batcher_options_t;
+
+typedef struct nlp_bert_batcher_stats
+{
+    nlp_uint64_t requests;
+    // requests that failed to encode, see nlp_bert_batcher_add
+    nlp_uint64_t failed;
+    nlp_uint64_t batches;
+    // tokens and padding tokens of the returned batches
+    nlp_uint64_t tokens;
+    nlp_uint64_t padding;
+} nlp_bert_batcher_stats_t;
+
+/*
+    A batch of row-major [batch_size, seq_len] tensors, rows are in no
+    particular order. A batch may have no rows when it only reports requests
+    that failed on the pool.
+*/
+typedef struct nlp_batch
+{
+    nlp_size_t batch_size;
+    nlp_size_t seq_len;
+    // the request id nlp_bert_batcher_add returned for each row
+    nlp_uint64_t *request_ids;
+    // ids of requests that failed to encode on the pool since the last batch, they get no row
+    nlp_size_t num_failed;
+    nlp_uint64_t *failed_ids;
+    nlp_int32_t *input_ids;
+    nlp_int32_t *attention_mask;
+    nlp_int32_t *token_type_ids;
+} nlp_batch_t;
+
+/* Default encode options, 8192 tokens and 256 rows per batch, buckets 8 tokens wide */
+LIBNLP_DLLEXPORT void nlp_bert_batcher_options_init(nlp_bert_batcher_options_t *options);
+
+/* `options` may be NULL for defaults. Return NULL if failed */
+LIBNLP_DLLEXPORT bert_batcher_t *nlp_bert_batcher_create(const bert_tokenizer_t *tokenizer,
+  const nlp_bert_batcher_options_t *options);
+
+/* Wait for the requests still being encoded, the pool must outlive the batcher */
+LIBNLP_DLLEXPORT void nlp_bert_batcher_destory(bert_batcher_t *batcher);
+
+/*
+    Queue a text, or a text pair if `pair` is not NULL. The texts are copied
+    when they are encoded on the pool. Return the request id, which counts up
+    from 0, or -1 if failed. A request encoded on the pool may still fail
+    after its id was returned, its id is then in failed_ids of a later batch.
+*/
+LIBNLP_DLLEXPORT nlp_int64_t nlp_bert_batcher_add(bert_batcher_t *batcher,
+  const char *text,
+  nlp_size_t len,
+  const char *pair,
+  nlp_size_t pair_len);
+
+/*
+    Return the next full batch, or NULL if no bucket is full yet and no
+    failed request is left to report. With `flush` the requests still being
+    encoded are waited for and the remaining rows are packed shortest first
+    into batches, NULL then means every request has been returned as a row
+    or a failed id. Free the batch with nlp_batch_free.
+*/
+LIBNLP_DLLEXPORT nlp_batch_t *nlp_bert_batcher_next(bert_batcher_t *batcher, bool flush);
+
+LIBNLP_DLLEXPORT void nlp_bert_batcher_stats(bert_batcher_t *batcher, nlp_bert_batcher_stats_t *stats);
+
+LIBNLP_DLLEXPORT void nlp_batch_free(nlp_batch_t *batch);
+
+typedef struct bpe_tokenizer bpe_tokenizer_t;
+/*
+    Load a byte-level BPE model (GPT-2, RoBERTa) from its vocab.json and
+    merges.txt. Return NULL if failed.
+*/
+LIBNLP_DLLEXPORT bpe_tokenizer_t *nlp_bpe_tokenizer_create(const char *vocab_path, const char *merges_path);
+
+LIBNLP_DLLEXPORT void nlp_bpe_tokenizer_destory(bpe_tokenizer_t *tokenizer);
+
+/* Largest id + 1 */
+LIBNLP_DLLEXPORT nlp_size_t nlp_bpe_tokenizer_vocab_size(const bpe_tokenizer_t *tokenizer);
+/* `token` is spelled as in vocab.json, e.g. "Ġworld". Return -1 if not found. */
+LIBNLP_DLLEXPORT nlp_int32_t nlp_bpe_tokenizer_token_to_id(const bpe_tokenizer_t *tokenizer,
+  const char *token,
+  nlp_size_t len);
+/* Return the token as spelled in vocab.json, NULL if not found */
+LIBNLP_DLLEXPORT const char *nlp_bpe_tokenizer_id_to_token(const bpe_tokenizer_t *tokenizer, nlp_int32_t id);
+
+/*
+    Pre-tokenize `len` bytes of text with the GPT-2 pattern and merge every
+    word by rank. Bytes without a token in the vocab are dropped. At most
+    `max_ids` ids are written. Return the total number of ids (like snprintf),
+    -1 if failed.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bpe_tokenizer_encode(const bpe_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids);
+/*
+    Write the bytes of `num_ids` tokens to `out`, at most `out_cap` bytes, NUL
+    terminated if there is room left. Return the total length (like snprintf),
+    -1 on an unknown id.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_bpe_tokenizer_decode(const bpe_tokenizer_t *tokenizer,
+  const nlp_int32_t *ids,
+  nlp_size_t num_ids,
+  char *out,
+  nlp_size_t out_cap);
+
+typedef struct unigram_tokenizer unigram_tokenizer_t;
+/*
+    Load a SentencePiece Unigram model (T5, XLM-R, ...) from its .model file.
+    Return NULL if failed or the model is not a Unigram one.
+*/
+LIBNLP_DLLEXPORT unigram_tokenizer_t *nlp_unigram_tokenizer_create(const char *model_path);
+
+LIBNLP_DLLEXPORT void nlp_unigram_tokenizer_destory(unigram_tokenizer_t *tokenizer);
+
+LIBNLP_DLLEXPORT nlp_size_t nlp_unigram_tokenizer_vocab_size(const unigram_tokenizer_t *tokenizer);
+/* `token` is spelled as in the model, e.g. "▁world". Return -1 if not found. */
+LIBNLP_DLLEXPORT nlp_int32_t nlp_unigram_tokenizer_token_to_id(const unigram_tokenizer_t *tokenizer,
+  const char *token,
+  nlp_size_t len);
+/* Return NULL if not found */
+LIBNLP_DLLEXPORT const char *nlp_unigram_tokenizer_id_to_token(const unigram_tokenizer_t *tokenizer, nlp_int32_t id);
+
+/*
+    Normalize `len` bytes of text and pick the segmentation with the highest
+    total piece score. No BOS / EOS ids are added. At most `max_ids` ids are
+    written. Return the total number of ids (like snprintf), -1 if failed.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_unigram_tokenizer_encode(const unigram_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids);
+/*
+    Join the pieces of `num_ids` ids with U+2581 turned back into spaces.
+    Control pieces are skipped. Output as nlp_bpe_tokenizer_decode.
+*/
+LIBNLP_DLLEXPORT nlp_ssize_t nlp_unigram_tokenizer_decode(const unigram_tokenizer_t *tokenizer,
+  const nlp_int32_t *ids,
+  nlp_size_t num_ids,
+  char *out,
+  nlp_size_t out_cap);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,147 @@
+#include "aho_corasick.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int aho_corasick_build(aho_corasick_t *ac,
+  const nlp_uint8_t *const *patterns,
+  const nlp_size_t *lens,
+  const nlp_int32_t *values,
+  nlp_size_t num_patterns) {
+    memset(ac, 0, sizeof(aho_corasick_t));
+    ac->first_byte = -1;
+    nlp_size_t total_len = 0;
+    ac->num_classes = 1;
+    for (nlp_size_t i = 0; i < num_patterns; i++) {
+        if (lens[i] == 0) return -1;
+        total_len += lens[i];
+        if (i == 0)
+            ac->first_byte = patterns[0][0];
+        else if (patterns[i][0] != ac->first_byte)
+            ac->first_byte = -1;
+        for (nlp_size_t j = 0; j < lens[i]; j++) {
+            if (ac->classes[patterns[i][j]] == 0) ac->classes[patterns[i][j]] = (nlp_uint16_t)ac->num_classes++;
+        }
+    }
+    if (total_len + 1 > INT32_MAX) return -1;
+
+    // a trie of the patterns first, at most one state per pattern byte
+    nlp_size_t max_states = total_len + 1;
+    nlp_size_t num_classes = ac->num_classes;
+    ac->next = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * max_states * num_classes);
+    ac->depth = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * max_states);
+    ac->match_len = (nlp_int32_t *)calloc(max_states, sizeof(nlp_int32_t));
+    ac->match_value = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * max_states);
+    if (ac->next == NULL || ac->depth == NULL || ac->match_len == NULL || ac->match_value == NULL) {
+        aho_corasick_free(ac);
+        return -1;
+    }
+    memset(ac->next, -1, sizeof(nlp_int32_t) * max_states * num_classes);
+    ac->num_states = 1;
+    ac->depth[0] = 0;
+    for (nlp_size_t i = 0; i < num_patterns; i++) {
+        nlp_size_t state = 0;
+        for (nlp_size_t j = 0; j < lens[i]; j++) {
+            nlp_int32_t *next = &ac->next[state * num_classes + ac->classes[patterns[i][j]]];
+            if (*next < 0) {
+                *next = (nlp_int32_t)ac->num_states;
+                ac->depth[ac->num_states++] = (nlp_int32_t)(j + 1);
+            }
+            state = (nlp_size_t)*next;
+        }
+        if (ac->match_len[state] == 0) {
+            ac->match_len[state] = (nlp_int32_t)lens[i];
+            ac->match_value[state] = values[i];
+        }
+    }
+
+    // breadth first, so the failure state of every state is complete before the state itself.
+    // Missing transitions take the one of the failure state, which turns the trie into a DFA.
+    nlp_int32_t *failure = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * ac->num_states);
+    nlp_int32_t *queue = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * ac->num_states);
+    if (failure == NULL || queue == NULL) {
+        free(failure);
+        free(queue);
+        aho_corasick_free(ac);
+        return -1;
+    }
+    nlp_size_t head = 0, tail = 0;
+    failure[0] = 0;
+    for (nlp_size_t c = 0; c < num_classes; c++) {
+        nlp_int32_t child = ac->next[c];
+        if (child < 0) {
+            ac->next[c] = 0;
+        } else {
+            failure[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        nlp_size_t state = (nlp_size_t)queue[head++];
+        nlp_size_t f = (nlp_size_t)failure[state];
+        if (ac->match_len[state] == 0) {
+            ac->match_len[state] = ac->match_len[f];
+            ac->match_value[state] = ac->match_value[f];
+        }
+        for (nlp_size_t c = 0; c < num_classes; c++) {
+            nlp_int32_t *next = &ac->next[state * num_classes + c];
+            if (*next < 0) {
+                *next = ac->next[f * num_classes + c];
+            } else {
+                failure[*next] = ac->next[f * num_classes + c];
+                queue[tail++] = *next;
+            }
+        }
+    }
+    free(failure);
+    free(queue);
+
+    // shrink to the states used, a failed shrink keeps the larger block
+    nlp_int32_t *next = (nlp_int32_t *)realloc(ac->next, sizeof(nlp_int32_t) * ac->num_states * num_classes);
+    if (next != NULL) ac->next = next;
+    return 0;
+}
+
+void aho_corasick_free(aho_corasick_t *ac) {
+    free(ac->next);
+    free(ac->depth);
+    free(ac->match_len);
+    free(ac->match_value);
+    memset(ac, 0, sizeof(aho_corasick_t));
+    ac->first_byte = -1;
+}
+
+bool aho_corasick_find(const aho_corasick_t *ac,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t pos,
+  nlp_size_t *start,
+  nlp_size_t *end,
+  nlp_int32_t *value) {
+    if (ac->num_states <= 1) return false;
+    const nlp_int32_t *next = ac->next;
+    nlp_size_t num_classes = ac->num_classes;
+    nlp_size_t state = 0;
+    bool found = false;
+    for (nlp_size_t i = pos; i < len; i++) {
+        if (state == 0 && ac->first_byte >= 0) {
+            // nothing is in progress, jump to where a pattern can begin
+            const nlp_uint8_t *p = (const nlp_uint8_t *)memchr(text + i, ac->first_byte, len - i);
+            if (p == NULL) break;
+            i = (nlp_size_t)(p - text);
+        }
+        state = (nlp_size_t)next[state * num_classes + ac->classes[text[i]]];
+        // once nothing in progress started at or before the match, no leftmost or longer one can follow
+        if (found && i + 1 - (nlp_size_t)ac->depth[state] > *start) break;
+        if (ac->match_len[state] > 0) {
+            nlp_size_t match_start = i + 1 - (nlp_size_t)ac->match_len[state];
+            if (!found || match_start <= *start) {
+                *start = match_start;
+                *end = i + 1;
+                *value = ac->match_value[state];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,56 @@
+#ifndef __AHO_CORASICK_H
+#define __AHO_CORASICK_H
+
+#include "common.h"
+
+#include <stdbool.h>
+
+/*
+    Aho-Corasick automaton over byte strings, compiled to a DFA so a scan
+    takes one table load per input byte whatever the number of patterns.
+    Bytes are mapped to classes first (bytes no pattern uses share class 0),
+    which keeps the table at num_states * num_classes entries.
+*/
+
+typedef struct aho_corasick
+{
+    nlp_uint16_t classes[256];
+    nlp_size_t num_classes;
+    nlp_size_t num_states;
+    // next state of state s on class c is next[s * num_classes + c], state 0 is the root
+    nlp_int32_t *next;
+    // length of the state's string
+    nlp_int32_t *depth;
+    // length and value of the longest pattern that is a suffix of the state's string, length 0 if none
+    nlp_int32_t *match_len;
+    nlp_int32_t *match_value;
+    // the first byte of every pattern if they all share it, -1 otherwise
+    nlp_int32_t first_byte;
+} aho_corasick_t;
+
+/*
+    Build the automaton from `num_patterns` non-empty patterns, a pattern
+    given more than once keeps its first value. Return 0, or -1 if failed.
+*/
+int aho_corasick_build(aho_corasick_t *ac,
+  const nlp_uint8_t *const *patterns,
+  const nlp_size_t *lens,
+  const nlp_int32_t *values,
+  nlp_size_t num_patterns);
+void aho_corasick_free(aho_corasick_t *ac);
+
+/*
+    Find the leftmost match in text[pos, len), the longest one of those
+    starting there. Set *start, *end and *value and return true, or return
+    false if there is none. Calling again from *end gives the next
+    non-overlapping match.
+*/
+bool aho_corasick_find(const aho_corasick_t *ac,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t pos,
+  nlp_size_t *start,
+  nlp_size_t *end,
+  nlp_int32_t *value);
+
+#endif
@@ -0,0 +1,369 @@
+#include "basic_tokenizer.h"
+
+#include "char_class.h"
+#include "simd.h"
+#include "strutils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef NLP_SIMD_AVX2
+#define BASIC_SIMD_BLOCK 32
+#endif
+
+// what the kernel does with an ascii byte
+enum {
+    BASIC_ASCII_KEEP,
+    BASIC_ASCII_DROP,// control characters
+    BASIC_ASCII_SPACE,
+    BASIC_ASCII_PUNCT,
+    BASIC_ASCII_UPPER
+};
+
+#define K BASIC_ASCII_KEEP
+#define D BASIC_ASCII_DROP
+#define S BASIC_ASCII_SPACE
+#define P BASIC_ASCII_PUNCT
+#define U BASIC_ASCII_UPPER
+static const nlp_uint8_t basic_ascii_class[128] = {
+    D, D, D, D, D, D, D, D, D, S, S, D, D, S, D, D,// 0x00
+    D, D, D, D, D, D, D, D, D, D, D, D, D, D, D, D,// 0x10
+    S, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P,// 0x20
+    K, K, K, K, K, K, K, K, K, K, P, P, P, P, P, P,// 0x30
+    P, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U,// 0x40
+    U, U, U, U, U, U, U, U, U, U, U, P, P, P, P, P,// 0x50
+    P, K, K, K, K, K, K, K, K, K, K, K, K, K, K, K,// 0x60
+    K, K, K, K, K, K, K, K, K, K, K, P, P, P, P, D,// 0x70
+};
+#undef K
+#undef D
+#undef S
+#undef P
+#undef U
+
+#ifdef BASIC_SIMD_BLOCK
+/*
+    Nibble lookup classifying ascii bytes: the class bits of a byte are
+    lo[c & 0xF] & hi[c >> 4], non-ascii bytes have no bits since their high
+    nibble entries are 0. A byte can match more than one bit of the same
+    class, e.g. '1' has both bits of the alnum class.
+*/
+#define BASIC_BIT_DIGIT 0x01// 0x30-0x39
+#define BASIC_BIT_LETTER_LOW 0x02// 0x41-0x4F, 0x61-0x6F
+#define BASIC_BIT_LETTER_HIGH 0x04// 0x50-0x5A, 0x70-0x7A
+#define BASIC_BIT_CONTROL_SPACE 0x08// \t \n \r
+#define BASIC_BIT_SPACE 0x10// ' '
+#define BASIC_ALNUM_BITS (BASIC_BIT_DIGIT | BASIC_BIT_LETTER_LOW | BASIC_BIT_LETTER_HIGH)
+#define BASIC_SPACE_BITS (BASIC_BIT_CONTROL_SPACE | BASIC_BIT_SPACE)
+
+// clang-format off
+#define BASIC_LO_NIBBLE_TABLE                                                             \
+    0x15, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x0F, 0x0E, 0x02, 0x02, 0x0A, 0x02, 0x02
+#define BASIC_HI_NIBBLE_TABLE                                                             \
+    0x08, 0x00, 0x10, 0x01, 0x02, 0x04, 0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+// clang-format on
+
+/* bit k of *alnum / *space is set if byte k of the block is an ascii letter or digit / whitespace */
+static inline NLP_TARGET_AVX2 void basic_classify_block(const nlp_uint8_t *block,
+  nlp_uint32_t *alnum,
+  nlp_uint32_t *space) {
+    const __m256i lo_table = _mm256_setr_epi8(BASIC_LO_NIBBLE_TABLE, BASIC_LO_NIBBLE_TABLE);
+    const __m256i hi_table = _mm256_setr_epi8(BASIC_HI_NIBBLE_TABLE, BASIC_HI_NIBBLE_TABLE);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)block);
+    __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(bytes, nibble));
+    __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    __m256i bits = _mm256_and_si256(lo, hi);
+    __m256i zero = _mm256_setzero_si256();
+    *alnum = ~(nlp_uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_and_si256(bits, _mm256_set1_epi8(BASIC_ALNUM_BITS)), zero));
+    *space = ~(nlp_uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_and_si256(bits, _mm256_set1_epi8(BASIC_SPACE_BITS)), zero));
+}
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BASIC_FORCE_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define BASIC_FORCE_INLINE __forceinline
+#else
+#define BASIC_FORCE_INLINE inline
+#endif
+
+// a canonical decomposition is at most 4 code points long
+#define BASIC_MAX_DECOMPOSITION 8
+
+basic_tokenizer_t *nlp_basic_tokenizer_create(bool do_lower_case) {
+    // like bert, accents are stripped from lowercased text
+    return nlp_basic_tokenizer_create_ex(do_lower_case, true, do_lower_case);
+}
+
+basic_tokenizer_t *nlp_basic_tokenizer_create_ex(bool do_lower_case, bool tokenize_chinese_chars, bool strip_accents) {
+    basic_tokenizer_t *tokenizer = (basic_tokenizer_t *)malloc(sizeof(basic_tokenizer_t));
+    if (tokenizer == NULL) return NULL;
+    basic_tokenizer_init(tokenizer, do_lower_case, tokenize_chinese_chars, strip_accents);
+    return tokenizer;
+}
+
+void nlp_basic_tokenizer_destory(basic_tokenizer_t *tokenizer) { free(tokenizer); }
+
+/* output cursor, `boundary` is set when the next character starts a new word */
+typedef struct basic_writer
+{
+    nlp_uint8_t *out;
+    nlp_size_t *offsets;
+    nlp_size_t cap;
+    nlp_size_t n;
+    bool boundary;
+} basic_writer_t;
+
+static inline void basic_put(basic_writer_t *w, nlp_uint8_t byte, nlp_size_t start) {
+    if (w->n < w->cap) {
+        w->out[w->n] = byte;
+        if (w->offsets != NULL) w->offsets[w->n] = start;
+    }
+    w->n++;
+}
+
+/* called before the first byte of every output character */
+static inline void basic_begin_char(basic_writer_t *w, nlp_size_t start) {
+    if (w->boundary) {
+        if (w->n > 0) basic_put(w, ' ', start);
+        w->boundary = false;
+    }
+}
+
+static inline void basic_put_bytes(basic_writer_t *w, const nlp_uint8_t *bytes, nlp_size_t len, nlp_size_t start) {
+    basic_begin_char(w, start);
+    for (nlp_size_t i = 0; i < len; i++) basic_put(w, bytes[i], start);
+}
+
+static inline void basic_put_codepoint(basic_writer_t *w, nlp_int32_t cp, nlp_size_t start) {
+    nlp_uint8_t bytes[MAX_UTF8_CHAR_SIZE];
+    basic_put_bytes(w, bytes, utf8proc_encode_char(cp, bytes), start);
+}
+
+/* append a character that is a word on its own */
+static inline void basic_put_isolated(basic_writer_t *w, const nlp_uint8_t *bytes, nlp_size_t len, nlp_size_t start) {
+    w->boundary = true;
+    basic_put_bytes(w, bytes, len, start);
+    w->boundary = true;
+}
+
+/* lowercase and strip accents of a non-ascii letter, `bytes` is its original encoding */
+static BASIC_FORCE_INLINE void basic_put_letter(bool lower,
+  bool strip,
+  basic_writer_t *w,
+  nlp_int32_t cp,
+  const nlp_uint8_t *bytes,
+  nlp_size_t len,
+  nlp_size_t start) {
+    nlp_int32_t mapped = lower ? utf8_char_lower(cp) : cp;
+    if (strip) {
+        const utf8proc_property_t *property = utf8proc_get_property(mapped);
+        // hangul syllables decompose algorithmically and have no decomposition entry
+        if (property->decomp_seqindex != UINT16_MAX || (mapped >= 0xAC00 && mapped <= 0xD7A3)) {
+            nlp_int32_t decomposed[BASIC_MAX_DECOMPOSITION];
+            nlp_ssize_t n =
+              utf8proc_decompose_char(mapped, decomposed, BASIC_MAX_DECOMPOSITION, UTF8PROC_DECOMPOSE, NULL);
+            if (n > 0 && n <= BASIC_MAX_DECOMPOSITION) {
+                for (nlp_ssize_t i = 0; i < n; i++) {
+                    nlp_uint8_t char_flags = utf8_char_class(decomposed[i]);
+                    if (char_flags & UTF8_CLASS_NONSPACING_MARK) continue;
+                    if (char_flags & UTF8_CLASS_PUNCTUATION) {
+                        nlp_uint8_t encoded[MAX_UTF8_CHAR_SIZE];
+                        basic_put_isolated(w, encoded, utf8proc_encode_char(decomposed[i], encoded), start);
+                    } else {
+                        basic_put_codepoint(w, decomposed[i], start);
+                    }
+                }
+                return;
+            }
+        }
+    }
+    if (mapped != cp)
+        basic_put_codepoint(w, mapped, start);
+    else
+        basic_put_bytes(w, bytes, len, start);
+}
+
+/* normalize the character at text[i], return the number of input bytes it takes */
+static BASIC_FORCE_INLINE nlp_size_t basic_normalize_char(bool lower,
+  bool chinese,
+  bool strip,
+  basic_writer_t *w,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t i) {
+    nlp_uint8_t c = text[i];
+    if (c < 0x80) {
+        switch (basic_ascii_class[c]) {
+        case BASIC_ASCII_KEEP:
+            basic_begin_char(w, i);
+            basic_put(w, c, i);
+            break;
+        case BASIC_ASCII_UPPER:
+            basic_begin_char(w, i);
+            basic_put(w, lower ? c + ('a' - 'A') : c, i);
+            break;
+        case BASIC_ASCII_SPACE:
+            w->boundary = true;
+            break;
+        case BASIC_ASCII_PUNCT:
+            basic_put_isolated(w, &c, 1, i);
+            break;
+        default:
+            break;
+        }
+        return 1;
+    }
+
+    nlp_int32_t cp;
+    nlp_ssize_t char_len = utf8proc_iterate(text + i, len - i, &cp);
+    // drop bytes that are not valid utf-8
+    if (char_len < 0) return 1;
+    nlp_uint8_t char_flags = utf8_char_class(cp);
+    if (cp == 0xFFFD || (char_flags & UTF8_CLASS_CONTROL)) {
+        // control, format, unassigned and the replacement character are dropped
+    } else if (char_flags & UTF8_CLASS_WHITESPACE) {
+        w->boundary = true;
+    } else if ((char_flags & UTF8_CLASS_PUNCTUATION) || (chinese && (char_flags & UTF8_CLASS_CHINESE))) {
+        basic_put_isolated(w, text + i, (nlp_size_t)char_len, i);
+    } else if (!(strip && (char_flags & UTF8_CLASS_NONSPACING_MARK))) {
+        basic_put_letter(lower, strip, w, cp, text + i, (nlp_size_t)char_len, i);
+    }
+    return (nlp_size_t)char_len;
+}
+
+#ifdef BASIC_SIMD_BLOCK
+/* append a run of ascii letters and digits, lowercasing a letter or digit is setting bit 0x20 */
+static inline void basic_put_alnum_run(basic_writer_t *w,
+  const nlp_uint8_t *run,
+  nlp_size_t len,
+  nlp_size_t start,
+  bool lower) {
+    basic_begin_char(w, start);
+    nlp_uint8_t mask = lower ? 0x20 : 0;
+    if (w->n + len > w->cap) {
+        for (nlp_size_t k = 0; k < len; k++) basic_put(w, run[k] | mask, start + k);
+        return;
+    }
+    nlp_uint8_t *out = w->out + w->n;
+    for (nlp_size_t k = 0; k < len; k++) out[k] = run[k] | mask;
+    if (w->offsets != NULL) {
+        nlp_size_t *offsets = w->offsets + w->n;
+        for (nlp_size_t k = 0; k < len; k++) offsets[k] = start + k;
+    }
+    w->n += len;
+}
+#endif
+
+/*
+    The kernel body for one combination of flags. It is only called with
+    constant flags from the BASIC_KERNEL instantiations below, so the flag
+    tests in the per character path are folded away at compile time. The
+    block loop is only in the AVX2 instantiations.
+*/
+static BASIC_FORCE_INLINE nlp_size_t basic_normalize_kernel(bool simd,
+  bool lower,
+  bool chinese,
+  bool strip,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t *offsets,
+  nlp_size_t cap) {
+    basic_writer_t w = { out, offsets, cap, 0, false };
+    nlp_size_t i = 0;
+
+#ifdef BASIC_SIMD_BLOCK
+    // runs of ascii letters, digits and whitespace are handled a block at a time,
+    // everything else, including all non-ascii text, goes through the per character path
+    while (simd && len - i >= BASIC_SIMD_BLOCK) {
+        nlp_size_t block_start = i;
+        nlp_uint32_t alnum, space;
+        basic_classify_block(text + block_start, &alnum, &space);
+        while (i < block_start + BASIC_SIMD_BLOCK) {
+            nlp_size_t bit = i - block_start;
+            // widened so that a run stops at the end of the block
+            nlp_uint64_t alnum_left = (nlp_uint64_t)(alnum >> bit);
+            nlp_uint64_t space_left = (nlp_uint64_t)(space >> bit);
+            if (alnum_left & 1) {
+                nlp_size_t run = __builtin_ctzll(~alnum_left);
+                basic_put_alnum_run(&w, text + i, run, i, lower);
+                i += run;
+            } else if (space_left & 1) {
+                w.boundary = true;
+                i += __builtin_ctzll(~space_left);
+            } else {
+                i += basic_normalize_char(lower, chinese, strip, &w, text, len, i);
+            }
+        }
+    }
+#else
+    (void)simd;
+#endif
+    while (i < len) i += basic_normalize_char(lower, chinese, strip, &w, text, len, i);
+    return w.n;
+}
+
+#define BASIC_KERNEL(attributes, name, simd, lower, chinese, strip)                               \
+    static attributes nlp_size_t name##_##lower##chinese##strip(const nlp_uint8_t *text,          \
+      nlp_size_t len,                                                                             \
+      nlp_uint8_t *out,                                                                           \
+      nlp_size_t *offsets,                                                                        \
+      nlp_size_t cap) {                                                                           \
+        return basic_normalize_kernel(simd, lower, chinese, strip, text, len, out, offsets, cap); \
+    }
+#define BASIC_KERNELS(attributes, name, simd)                                         \
+    BASIC_KERNEL(attributes, name, simd, 0, 0, 0)                                     \
+    BASIC_KERNEL(attributes, name, simd, 0, 0, 1)                                     \
+    BASIC_KERNEL(attributes, name, simd, 0, 1, 0)                                     \
+    BASIC_KERNEL(attributes, name, simd, 0, 1, 1)                                     \
+    BASIC_KERNEL(attributes, name, simd, 1, 0, 0)                                     \
+    BASIC_KERNEL(attributes, name, simd, 1, 0, 1)                                     \
+    BASIC_KERNEL(attributes, name, simd, 1, 1, 0)                                     \
+    BASIC_KERNEL(attributes, name, simd, 1, 1, 1)                                     \
+    /* indexed by do_lower_case << 2 | tokenize_chinese_chars << 1 | strip_accents */ \
+    static const basic_normalize_func_t name##_kernels[8] = {                         \
+        name##_000,                                                                   \
+        name##_001,                                                                   \
+        name##_010,                                                                   \
+        name##_011,                                                                   \
+        name##_100,                                                                   \
+        name##_101,                                                                   \
+        name##_110,                                                                   \
+        name##_111,                                                                   \
+    };
+
+BASIC_KERNELS(, basic_normalize, false)
+#ifdef BASIC_SIMD_BLOCK
+BASIC_KERNELS(NLP_TARGET_AVX2, basic_normalize_avx2, true)
+#endif
+#undef BASIC_KERNELS
+#undef BASIC_KERNEL
+
+void basic_tokenizer_init(basic_tokenizer_t *tokenizer,
+  bool do_lower_case,
+  bool tokenize_chinese_chars,
+  bool strip_accents) {
+    tokenizer->do_lower_case = do_lower_case;
+    tokenizer->tokenize_chinese_chars = tokenize_chinese_chars;
+    tokenizer->strip_accents = strip_accents;
+    const basic_normalize_func_t *kernels = basic_normalize_kernels;
+#ifdef BASIC_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) kernels = basic_normalize_avx2_kernels;
+#endif
+    tokenizer->normalize = kernels[do_lower_case << 2 | tokenize_chinese_chars << 1 | strip_accents];
+}
+
+nlp_ssize_t nlp_basic_tokenizer_normalize(const basic_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  char *out,
+  nlp_size_t out_cap) {
+    if (tokenizer == NULL || (text == NULL && len > 0) || (out == NULL && out_cap > 0)) return -1;
+    nlp_size_t n = basic_normalize(tokenizer, (const nlp_uint8_t *)text, len, (nlp_uint8_t *)out, NULL, out_cap);
+    if (n < out_cap) out[n] = '\0';
+    return (nlp_ssize_t)n;
+}
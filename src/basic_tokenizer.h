@@ -0,0 +1,57 @@
+#ifndef __BASIC_TOKENIZER_H
+#define __BASIC_TOKENIZER_H
+
+#include "tokenizer.h"
+
+/* basic_normalize specialized for one combination of the tokenizer flags */
+typedef nlp_size_t (*basic_normalize_func_t)(const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t *offsets,
+  nlp_size_t cap);
+
+struct basic_tokenizer
+{
+    bool do_lower_case;
+    bool tokenize_chinese_chars;
+    bool strip_accents;
+    basic_normalize_func_t normalize;
+};
+
+/* Set the flags and pick the matching normalization kernel */
+void basic_tokenizer_init(basic_tokenizer_t *tokenizer,
+  bool do_lower_case,
+  bool tokenize_chinese_chars,
+  bool strip_accents);
+
+/*
+    Fused BERT basic tokenization, one pass over `len` bytes of utf-8 text:
+    drop control characters and invalid bytes, split on whitespace, isolate
+    CJK characters and punctuation, lowercase and strip accents.
+    The words are written to `out` separated by single spaces, with no
+    leading or trailing space. If `offsets` is not NULL, offsets[i] is set
+    to the input position of the character that produced out[i].
+    At most `cap` bytes are written, the return value is the full output
+    length, so a return value larger than `cap` means out was too small.
+*/
+static inline nlp_size_t basic_normalize(const basic_tokenizer_t *tokenizer,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t *offsets,
+  nlp_size_t cap) {
+    return tokenizer->normalize(text, len, out, offsets, cap);
+}
+
+/* Output size that is enough for almost all input, basic_normalize reports the exact one otherwise */
+#define BASIC_NORMALIZE_SIZE_HINT(len) ((len) + (len) / 2 + 16)
+
+/* Byte length of the utf-8 sequence starting with `lead` */
+static inline nlp_size_t utf8_sequence_len(nlp_uint8_t lead) {
+    if (lead < 0x80) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    return 4;
+}
+
+#endif
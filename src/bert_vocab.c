@@ -0,0 +1,393 @@
+#include "bert_vocab.h"
+
+#include "readutils.h"
+#include "strutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+    Binary vocab layout, all integers in host byte order:
+
+        header | offsets[size] | pool[pool_size] | nodes | edge targets | pops | piece lens | edge labels
+               | cjk pages | cjk ids
+
+    The CJK table is stored as built, both of its sections are empty for a
+    vocab without single CJK character tokens. Every section starts at an offset recorded in the header, aligned to
+    BERT_VOCAB_ALIGN bytes, so the arrays can be used in place once mapped.
+*/
+#define BERT_VOCAB_MAGIC "NLPBVOC"
+#define BERT_VOCAB_VERSION 3
+#define BERT_VOCAB_BYTE_ORDER 0x01020304u
+#define BERT_VOCAB_ALIGN 64
+
+enum {
+    SECTION_OFFSETS,
+    SECTION_POOL,
+    SECTION_NODES,
+    SECTION_TARGETS,
+    SECTION_POPS,
+    SECTION_PIECE_LENS,
+    SECTION_LABELS,
+    SECTION_CJK_PAGES,
+    SECTION_CJK_IDS,
+    SECTION_COUNT
+};
+
+typedef struct bert_vocab_header
+{
+    char magic[8];
+    nlp_uint32_t version;
+    nlp_uint32_t byte_order;
+    nlp_uint32_t size;
+    nlp_uint32_t pool_size;
+    nlp_uint32_t num_nodes;
+    nlp_uint32_t num_edges;
+    nlp_uint32_t num_pops;
+    nlp_uint32_t root;
+    nlp_uint32_t suffix_root;
+    nlp_int32_t unk_id;
+    nlp_uint32_t max_input_chars_per_word;
+    nlp_uint32_t reserved;
+    nlp_uint64_t section_offsets[SECTION_COUNT];
+    nlp_uint64_t section_sizes[SECTION_COUNT];
+} bert_vocab_header_t;
+
+static bool bert_vocab_read_lines(bert_vocab_t *vocab, FILE *vocab_file) {
+    char *rawline = NULL;
+    nlp_size_t len = 0;
+    nlp_size_t line_len;
+    nlp_size_t pool_len = 0;
+    nlp_size_t pool_cap = 1 << 16;
+    nlp_size_t offsets_cap = 1 << 12;
+    bool ok = false;
+
+    vocab->owned_pool = (char *)malloc(pool_cap);
+    vocab->owned_offsets = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * offsets_cap);
+    if (vocab->owned_pool == NULL || vocab->owned_offsets == NULL) return false;
+
+    while ((line_len = readline(&rawline, &len, vocab_file)) != (nlp_size_t)-1) {
+        while (line_len > 0 && (rawline[line_len - 1] == '\n' || rawline[line_len - 1] == '\r')) line_len--;
+        if (pool_len + line_len + 1 > pool_cap) {
+            while (pool_len + line_len + 1 > pool_cap) pool_cap *= 2;
+            char *pool = (char *)realloc(vocab->owned_pool, pool_cap);
+            if (pool == NULL) goto cleanup;
+            vocab->owned_pool = pool;
+        }
+        if (vocab->size == offsets_cap) {
+            offsets_cap *= 2;
+            nlp_uint32_t *offsets = (nlp_uint32_t *)realloc(vocab->owned_offsets, sizeof(nlp_uint32_t) * offsets_cap);
+            if (offsets == NULL) goto cleanup;
+            vocab->owned_offsets = offsets;
+        }
+        memcpy(vocab->owned_pool + pool_len, rawline, line_len);
+        vocab->owned_pool[pool_len + line_len] = '\0';
+        vocab->owned_offsets[vocab->size++] = (nlp_uint32_t)pool_len;
+        pool_len += line_len + 1;
+    }
+    vocab->pool = vocab->owned_pool;
+    vocab->offsets = vocab->owned_offsets;
+    vocab->pool_size = (nlp_uint32_t)pool_len;
+    ok = true;
+cleanup:
+    free(rawline);
+    return ok;
+}
+
+static bool bert_vocab_build_wordpiece(bert_vocab_t *vocab) {
+    nlp_size_t n = vocab->size;
+    const char **tokens = (const char **)malloc(sizeof(char *) * (n + 1));
+    nlp_size_t *token_lens = (nlp_size_t *)malloc(sizeof(nlp_size_t) * (n + 1));
+    nlp_int32_t unk_id = -1;
+    if (tokens == NULL || token_lens == NULL) goto cleanup;
+
+    for (nlp_size_t i = 0; i < n; i++) {
+        tokens[i] = vocab->pool + vocab->offsets[i];
+        token_lens[i] = strlen(tokens[i]);
+        if (unk_id < 0 && strcmp(tokens[i], BERT_UNK_TOKEN) == 0) unk_id = (nlp_int32_t)i;
+    }
+    vocab->wordpiece = wordpiece_build(tokens, token_lens, n, BERT_SUFFIX_INDICATOR, unk_id);
+cleanup:
+    free(tokens);
+    free(token_lens);
+    return vocab->wordpiece != NULL;
+}
+
+/* fill the CJK table from the vocab tokens, vocabs without single CJK character tokens get no table */
+static bool bert_vocab_build_cjk_ids(bert_vocab_t *vocab) {
+    nlp_uint16_t *pages = NULL;
+    nlp_int32_t *ids = NULL;
+    nlp_uint32_t num_pages = 0;
+    nlp_uint32_t cap = 0;
+    for (nlp_uint32_t i = 0; i < vocab->size; i++) {
+        const nlp_uint8_t *token = (const nlp_uint8_t *)vocab->pool + vocab->offsets[i];
+        nlp_size_t len = strlen((const char *)token);
+        nlp_int32_t cp;
+        if (len < 3 || len > 4 || utf8proc_iterate(token, len, &cp) != (nlp_ssize_t)len) continue;
+        nlp_int32_t index = bert_cjk_index(cp);
+        if (index < 0) continue;
+        if (pages == NULL) {
+            pages = (nlp_uint16_t *)calloc(BERT_CJK_INDEX_SIZE, sizeof(nlp_uint16_t));
+            vocab->owned_cjk_pages = pages;
+            cap = 8;
+            ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * BERT_CJK_PAGE_SIZE * cap);
+            vocab->owned_cjk_ids = ids;
+            if (pages == NULL || ids == NULL) return false;
+            for (nlp_size_t j = 0; j < BERT_CJK_PAGE_SIZE; j++) ids[j] = -1;
+            num_pages = 1;
+        }
+        nlp_uint32_t run = (nlp_uint32_t)index >> BERT_CJK_PAGE_BITS;
+        if (pages[run] == 0) {
+            if (num_pages == cap) {
+                cap *= 2;
+                ids = (nlp_int32_t *)realloc(ids, sizeof(nlp_int32_t) * BERT_CJK_PAGE_SIZE * cap);
+                if (ids == NULL) return false;
+                vocab->owned_cjk_ids = ids;
+            }
+            nlp_int32_t *page = ids + (nlp_size_t)num_pages * BERT_CJK_PAGE_SIZE;
+            for (nlp_size_t j = 0; j < BERT_CJK_PAGE_SIZE; j++) page[j] = -1;
+            pages[run] = (nlp_uint16_t)num_pages++;
+        }
+        // the id wordpiece would give, which is the last one for a duplicated token like the trie keeps
+        ids[(nlp_size_t)pages[run] << BERT_CJK_PAGE_BITS | (index & (BERT_CJK_PAGE_SIZE - 1))] =
+          wordpiece_lookup(vocab->wordpiece, token, len, false);
+    }
+    vocab->cjk_pages = pages;
+    vocab->cjk_ids = ids;
+    vocab->cjk_num_pages = num_pages;
+    return true;
+}
+
+bert_vocab_t *bert_vocab_load_text(const char *vocab_path) {
+    bert_vocab_t *vocab = (bert_vocab_t *)calloc(1, sizeof(bert_vocab_t));
+    if (vocab == NULL) return NULL;
+    atomic_init(&vocab->refs, 1);
+
+    FILE *vocab_file = fopen(vocab_path, "r");
+    if (vocab_file == NULL) goto error;
+    bool loaded = bert_vocab_read_lines(vocab, vocab_file);
+    fclose(vocab_file);
+    if (!loaded || !bert_vocab_build_wordpiece(vocab) || !bert_vocab_build_cjk_ids(vocab)) goto error;
+    return vocab;
+error:
+    bert_vocab_destroy(vocab);
+    return NULL;
+}
+
+static bool write_section(FILE *fp, const void *data, nlp_uint64_t size, nlp_uint64_t *pos) {
+    static const char zeros[BERT_VOCAB_ALIGN] = { 0 };
+    nlp_uint64_t pad = (BERT_VOCAB_ALIGN - *pos % BERT_VOCAB_ALIGN) % BERT_VOCAB_ALIGN;
+    if (pad && fwrite(zeros, 1, pad, fp) != pad) return false;
+    if (size && fwrite(data, 1, size, fp) != size) return false;
+    *pos += pad + size;
+    return true;
+}
+
+int bert_vocab_save_binary(const bert_vocab_t *vocab, const char *binary_path) {
+    const wordpiece_t *wp = vocab->wordpiece;
+    bert_vocab_header_t header;
+    const void *sections[SECTION_COUNT];
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BERT_VOCAB_MAGIC, sizeof(BERT_VOCAB_MAGIC));
+    header.version = BERT_VOCAB_VERSION;
+    header.byte_order = BERT_VOCAB_BYTE_ORDER;
+    header.size = vocab->size;
+    header.pool_size = vocab->pool_size;
+    header.num_nodes = wp->num_nodes;
+    header.num_edges = wp->num_edges;
+    header.num_pops = wp->num_pops;
+    header.root = wp->root;
+    header.suffix_root = wp->suffix_root;
+    header.unk_id = wp->unk_id;
+    header.max_input_chars_per_word = wp->max_input_chars_per_word;
+
+    sections[SECTION_OFFSETS] = vocab->offsets;
+    header.section_sizes[SECTION_OFFSETS] = sizeof(nlp_uint32_t) * (nlp_uint64_t)vocab->size;
+    sections[SECTION_POOL] = vocab->pool;
+    header.section_sizes[SECTION_POOL] = vocab->pool_size;
+    sections[SECTION_NODES] = wp->nodes;
+    header.section_sizes[SECTION_NODES] = sizeof(wordpiece_node_t) * (nlp_uint64_t)wp->num_nodes;
+    sections[SECTION_TARGETS] = wp->edge_targets;
+    header.section_sizes[SECTION_TARGETS] = sizeof(nlp_uint32_t) * (nlp_uint64_t)wp->num_edges;
+    sections[SECTION_POPS] = wp->pops;
+    header.section_sizes[SECTION_POPS] = sizeof(nlp_int32_t) * (nlp_uint64_t)wp->num_pops;
+    sections[SECTION_PIECE_LENS] = wp->piece_lens;
+    header.section_sizes[SECTION_PIECE_LENS] = sizeof(nlp_uint16_t) * (nlp_uint64_t)wp->num_tokens;
+    sections[SECTION_LABELS] = wp->edge_labels;
+    header.section_sizes[SECTION_LABELS] = wp->num_edges;
+    sections[SECTION_CJK_PAGES] = vocab->cjk_pages;
+    header.section_sizes[SECTION_CJK_PAGES] = vocab->cjk_pages != NULL ? sizeof(nlp_uint16_t) * BERT_CJK_INDEX_SIZE : 0;
+    sections[SECTION_CJK_IDS] = vocab->cjk_ids;
+    header.section_sizes[SECTION_CJK_IDS] =
+      sizeof(nlp_int32_t) * BERT_CJK_PAGE_SIZE * (nlp_uint64_t)vocab->cjk_num_pages;
+
+    nlp_uint64_t pos = sizeof(header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        pos += (BERT_VOCAB_ALIGN - pos % BERT_VOCAB_ALIGN) % BERT_VOCAB_ALIGN;
+        header.section_offsets[i] = pos;
+        pos += header.section_sizes[i];
+    }
+
+    FILE *fp = fopen(binary_path, "wb");
+    if (fp == NULL) return -1;
+    pos = 0;
+    bool ok = write_section(fp, &header, sizeof(header), &pos);
+    for (int i = 0; ok && i < SECTION_COUNT; i++) ok = write_section(fp, sections[i], header.section_sizes[i], &pos);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) {
+        remove(binary_path);
+        return -1;
+    }
+    return 0;
+}
+
+static void *map_file(const char *path, nlp_size_t *size) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER file_size;
+    void *addr = NULL;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (nlp_size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return addr;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *addr = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        // shared read-only pages, all processes mapping the file use one physical copy
+        addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) addr = NULL;
+        *size = (nlp_size_t)st.st_size;
+    }
+    close(fd);
+    return addr;
+#endif
+}
+
+static void unmap_file(void *addr, nlp_size_t size) {
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(addr);
+#else
+    munmap(addr, size);
+#endif
+}
+
+bert_vocab_t *bert_vocab_load_binary(const char *binary_path) {
+    bert_vocab_t *vocab = (bert_vocab_t *)calloc(1, sizeof(bert_vocab_t));
+    if (vocab == NULL) return NULL;
+    atomic_init(&vocab->refs, 1);
+    vocab->mapping = map_file(binary_path, &vocab->mapping_size);
+    if (vocab->mapping == NULL) goto error;
+
+    const nlp_uint8_t *base = (const nlp_uint8_t *)vocab->mapping;
+    bert_vocab_header_t header;
+    if (vocab->mapping_size < sizeof(header)) goto error;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, BERT_VOCAB_MAGIC, sizeof(BERT_VOCAB_MAGIC)) != 0 || header.version != BERT_VOCAB_VERSION
+        || header.byte_order != BERT_VOCAB_BYTE_ORDER)
+        goto error;
+    // the sections must fit the file, their content is trusted as written by bert_vocab_save_binary
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        if (header.section_offsets[i] % BERT_VOCAB_ALIGN != 0 || header.section_offsets[i] > vocab->mapping_size
+            || header.section_sizes[i] > vocab->mapping_size - header.section_offsets[i])
+            goto error;
+    }
+    if (header.section_sizes[SECTION_OFFSETS] != sizeof(nlp_uint32_t) * (nlp_uint64_t)header.size
+        || header.section_sizes[SECTION_POOL] != header.pool_size
+        || header.section_sizes[SECTION_NODES] != sizeof(wordpiece_node_t) * (nlp_uint64_t)header.num_nodes
+        || header.section_sizes[SECTION_TARGETS] != sizeof(nlp_uint32_t) * (nlp_uint64_t)header.num_edges
+        || header.section_sizes[SECTION_POPS] != sizeof(nlp_int32_t) * (nlp_uint64_t)header.num_pops
+        || header.section_sizes[SECTION_PIECE_LENS] != sizeof(nlp_uint16_t) * (nlp_uint64_t)header.size
+        || header.section_sizes[SECTION_LABELS] != header.num_edges || header.root >= header.num_nodes
+        || header.suffix_root >= header.num_nodes)
+        goto error;
+    nlp_uint64_t cjk_page_bytes = sizeof(nlp_int32_t) * BERT_CJK_PAGE_SIZE;
+    nlp_uint64_t cjk_num_pages = header.section_sizes[SECTION_CJK_IDS] / cjk_page_bytes;
+    nlp_uint64_t cjk_index_bytes = cjk_num_pages > 0 ? sizeof(nlp_uint16_t) * BERT_CJK_INDEX_SIZE : 0;
+    if (header.section_sizes[SECTION_CJK_IDS] % cjk_page_bytes != 0 || cjk_num_pages > UINT16_MAX
+        || header.section_sizes[SECTION_CJK_PAGES] != cjk_index_bytes)
+        goto error;
+
+    vocab->size = header.size;
+    vocab->pool_size = header.pool_size;
+    vocab->offsets = (const nlp_uint32_t *)(base + header.section_offsets[SECTION_OFFSETS]);
+    vocab->pool = (const char *)(base + header.section_offsets[SECTION_POOL]);
+    if (cjk_num_pages > 0) {
+        vocab->cjk_pages = (const nlp_uint16_t *)(base + header.section_offsets[SECTION_CJK_PAGES]);
+        vocab->cjk_ids = (const nlp_int32_t *)(base + header.section_offsets[SECTION_CJK_IDS]);
+        vocab->cjk_num_pages = (nlp_uint32_t)cjk_num_pages;
+        // a page out of range would read past the table, the index is small enough to check
+        for (nlp_size_t i = 0; i < BERT_CJK_INDEX_SIZE; i++) {
+            if (vocab->cjk_pages[i] >= cjk_num_pages) goto error;
+        }
+    }
+
+    wordpiece_t *wp = (wordpiece_t *)calloc(1, sizeof(wordpiece_t));
+    if (wp == NULL) goto error;
+    wp->nodes = (const wordpiece_node_t *)(base + header.section_offsets[SECTION_NODES]);
+    wp->edge_targets = (const nlp_uint32_t *)(base + header.section_offsets[SECTION_TARGETS]);
+    wp->pops = (const nlp_int32_t *)(base + header.section_offsets[SECTION_POPS]);
+    wp->piece_lens = (const nlp_uint16_t *)(base + header.section_offsets[SECTION_PIECE_LENS]);
+    wp->num_tokens = header.size;
+    wp->edge_labels = base + header.section_offsets[SECTION_LABELS];
+    wp->num_nodes = header.num_nodes;
+    wp->num_edges = header.num_edges;
+    wp->num_pops = header.num_pops;
+    wp->root = header.root;
+    wp->suffix_root = header.suffix_root;
+    wp->unk_id = header.unk_id;
+    wp->max_input_chars_per_word = header.max_input_chars_per_word;
+    wp->owned = NULL;
+    vocab->wordpiece = wp;
+    return vocab;
+error:
+    bert_vocab_destroy(vocab);
+    return NULL;
+}
+
+void bert_vocab_retain(bert_vocab_t *vocab) { atomic_fetch_add(&vocab->refs, 1); }
+
+void bert_vocab_destroy(bert_vocab_t *vocab) {
+    if (vocab == NULL || atomic_fetch_sub(&vocab->refs, 1) > 1) return;
+    wordpiece_destroy(vocab->wordpiece);
+    free(vocab->owned_pool);
+    free(vocab->owned_offsets);
+    free(vocab->owned_cjk_pages);
+    free(vocab->owned_cjk_ids);
+    if (vocab->mapping != NULL) unmap_file(vocab->mapping, vocab->mapping_size);
+    free(vocab);
+}
+
+nlp_int32_t bert_vocab_token_to_id(const bert_vocab_t *vocab, const char *token, nlp_size_t len) {
+    nlp_size_t suffix_len = sizeof(BERT_SUFFIX_INDICATOR) - 1;
+    const nlp_uint8_t *key = (const nlp_uint8_t *)token;
+    if (len > suffix_len && memcmp(token, BERT_SUFFIX_INDICATOR, suffix_len) == 0)
+        return wordpiece_lookup(vocab->wordpiece, key + suffix_len, len - suffix_len, true);
+    return wordpiece_lookup(vocab->wordpiece, key, len, false);
+}
+
+const char *bert_vocab_id_to_token(const bert_vocab_t *vocab, nlp_int32_t id) {
+    if (id < 0 || (nlp_uint32_t)id >= vocab->size) return NULL;
+    return vocab->pool + vocab->offsets[id];
+}
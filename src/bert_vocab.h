@@ -0,0 +1,104 @@
+#ifndef __BERT_VOCAB_H
+#define __BERT_VOCAB_H
+
+#include "common.h"
+#include "wordpiece.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define BERT_SUFFIX_INDICATOR "##"
+#define BERT_UNK_TOKEN "[UNK]"
+
+/*
+    Immutable vocab of a bert tokenizer: the token strings, the id table and
+    the wordpiece matcher. It is either built from vocab.txt or mapped
+    read-only from a compiled binary file, in which case every array points
+    into the mapping and nothing is parsed or copied at load time.
+*/
+typedef struct bert_vocab
+{
+    // token i is pool + offsets[i], NUL terminated
+    const char *pool;
+    const nlp_uint32_t *offsets;
+    nlp_uint32_t size;
+    nlp_uint32_t pool_size;
+    wordpiece_t *wordpiece;
+    /*
+        ids of single CJK character tokens by bert_cjk_index, -1 for none, in
+        pages of BERT_CJK_PAGE_SIZE ids. cjk_pages holds the page of every run
+        of BERT_CJK_PAGE_SIZE code points, page 0 is all -1 and stands in for
+        the runs without a token. Both are NULL if the vocab has no such token.
+    */
+    const nlp_uint16_t *cjk_pages;
+    const nlp_int32_t *cjk_ids;
+    nlp_uint32_t cjk_num_pages;
+    // heap memory behind pool, offsets and the CJK table when built from text
+    char *owned_pool;
+    nlp_uint32_t *owned_offsets;
+    nlp_uint16_t *owned_cjk_pages;
+    nlp_int32_t *owned_cjk_ids;
+    // file mapping when loaded from a binary file
+    void *mapping;
+    nlp_size_t mapping_size;
+    // the models built for this vocab share it, each holding a reference
+    atomic_int refs;
+} bert_vocab_t;
+
+/* the code point ranges of utf8str_is_chinese_char laid end to end */
+#define BERT_CJK_RANGE_0 (0x9FFF - 0x4E00 + 1)
+#define BERT_CJK_RANGE_1 (BERT_CJK_RANGE_0 + 0x4DBF - 0x3400 + 1)
+#define BERT_CJK_RANGE_2 (BERT_CJK_RANGE_1 + 0xFAFF - 0xF900 + 1)
+#define BERT_CJK_RANGE_3 (BERT_CJK_RANGE_2 + 0x2A6DF - 0x20000 + 1)
+#define BERT_CJK_RANGE_4 (BERT_CJK_RANGE_3 + 0x2CEAF - 0x2A700 + 1)
+#define BERT_CJK_TABLE_SIZE (BERT_CJK_RANGE_4 + 0x2FA1F - 0x2F800 + 1)
+// a vocab rarely has tokens for more than a few of the runs of code points a page covers
+#define BERT_CJK_PAGE_BITS 8
+#define BERT_CJK_PAGE_SIZE (1 << BERT_CJK_PAGE_BITS)
+#define BERT_CJK_INDEX_SIZE ((BERT_CJK_TABLE_SIZE + BERT_CJK_PAGE_SIZE - 1) / BERT_CJK_PAGE_SIZE)
+
+/* Position of a CJK code point in the CJK table, -1 if it is not one */
+static inline nlp_int32_t bert_cjk_index(nlp_int32_t cp) {
+    if (cp >= 0x4E00 && cp <= 0x9FFF) return cp - 0x4E00;
+    if (cp >= 0x3400 && cp <= 0x4DBF) return cp - 0x3400 + BERT_CJK_RANGE_0;
+    if (cp >= 0xF900 && cp <= 0xFAFF) return cp - 0xF900 + BERT_CJK_RANGE_1;
+    if (cp >= 0x20000 && cp <= 0x2A6DF) return cp - 0x20000 + BERT_CJK_RANGE_2;
+    // 0x2A700 - 0x2B73F, 0x2B740 - 0x2B81F and 0x2B820 - 0x2CEAF are adjacent
+    if (cp >= 0x2A700 && cp <= 0x2CEAF) return cp - 0x2A700 + BERT_CJK_RANGE_3;
+    if (cp >= 0x2F800 && cp <= 0x2FA1F) return cp - 0x2F800 + BERT_CJK_RANGE_4;
+    return -1;
+}
+
+/*
+    Id of a word that is a single CJK character token, -1 otherwise.
+    Chinese text is mostly such words, this skips the trie walk for them.
+*/
+static inline nlp_int32_t bert_vocab_cjk_id(const bert_vocab_t *vocab, const nlp_uint8_t *word, nlp_size_t len) {
+    nlp_int32_t cp;
+    if (len == 3 && (word[0] & 0xF0) == 0xE0 && (word[1] & 0xC0) == 0x80 && (word[2] & 0xC0) == 0x80)
+        cp = ((word[0] & 0x0F) << 12) | ((word[1] & 0x3F) << 6) | (word[2] & 0x3F);
+    else if (len == 4 && (word[0] & 0xF8) == 0xF0 && (word[1] & 0xC0) == 0x80 && (word[2] & 0xC0) == 0x80
+             && (word[3] & 0xC0) == 0x80)
+        cp = ((word[0] & 0x07) << 18) | ((word[1] & 0x3F) << 12) | ((word[2] & 0x3F) << 6) | (word[3] & 0x3F);
+    else
+        return -1;
+    nlp_int32_t index = bert_cjk_index(cp);
+    if (index < 0) return -1;
+    nlp_size_t page = vocab->cjk_pages[index >> BERT_CJK_PAGE_BITS];
+    return vocab->cjk_ids[page << BERT_CJK_PAGE_BITS | (index & (BERT_CJK_PAGE_SIZE - 1))];
+}
+
+/* Return NULL if failed */
+bert_vocab_t *bert_vocab_load_text(const char *vocab_path);
+/* Return NULL if failed or the file is not a compiled vocab */
+bert_vocab_t *bert_vocab_load_binary(const char *binary_path);
+/* Return 0 on success, -1 if failed */
+int bert_vocab_save_binary(const bert_vocab_t *vocab, const char *binary_path);
+/* A loaded vocab has one reference, bert_vocab_destroy drops one and frees it with the last */
+void bert_vocab_retain(bert_vocab_t *vocab);
+void bert_vocab_destroy(bert_vocab_t *vocab);
+
+nlp_int32_t bert_vocab_token_to_id(const bert_vocab_t *vocab, const char *token, nlp_size_t len);
+const char *bert_vocab_id_to_token(const bert_vocab_t *vocab, nlp_int32_t id);
+
+#endif
@@ -0,0 +1,652 @@
+#include "tokenizer.h"
+
+#include "char_class.h"
+#include "map.h"
+#include "readutils.h"
+#include "strutils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Byte-level BPE as used by GPT-2 and RoBERTa.
+
+    vocab.json and merges.txt spell tokens in an alphabet where every byte is
+    a printable code point. Tokens are converted back to raw bytes at load
+    time, so encoding works on the input bytes directly and decoding is
+    concatenation. Merges are stored by the ids of their two halves in an
+    open addressing table, and every pre-tokenized word is merged through a
+    binary heap of candidate pairs over a linked list of symbols, taking the
+    lowest rank first and the leftmost pair on ties.
+*/
+
+#define BPE_EMPTY_PAIR UINT64_MAX
+// code points of the byte-level alphabet are all below this
+#define BPE_ALPHABET_SIZE 324
+// words up to this many bytes are merged without touching the heap allocator
+#define BPE_INLINE_WORD_SIZE 64
+
+typedef struct bpe_merge
+{
+    nlp_uint64_t pair;// left id << 32 | right id
+    nlp_int32_t rank;
+    nlp_int32_t merged;
+} bpe_merge_t;
+
+struct bpe_tokenizer
+{
+    // tokens as spelled in vocab.json, NUL terminated, UINT32_MAX for unused ids
+    char *pool;
+    nlp_uint32_t *offsets;
+    // tokens as raw bytes
+    nlp_uint8_t *bytes;
+    nlp_uint32_t *byte_offsets;
+    nlp_uint32_t *byte_lens;
+    nlp_uint32_t size;
+    // raw bytes -> &byte_offsets[id]
+    map_handle_t token_map;
+    bpe_merge_t *merges;
+    nlp_uint32_t merge_mask;
+    nlp_int32_t byte_ids[256];
+    nlp_int16_t alphabet_bytes[BPE_ALPHABET_SIZE];
+};
+
+/* growable buffer used while loading */
+typedef struct bpe_buffer
+{
+    char *data;
+    nlp_size_t len;
+    nlp_size_t cap;
+} bpe_buffer_t;
+
+static bool bpe_buffer_append(bpe_buffer_t *buf, const void *data, nlp_size_t len) {
+    if (buf->len + len > buf->cap) {
+        nlp_size_t cap = buf->cap ? buf->cap : 256;
+        while (cap < buf->len + len) cap *= 2;
+        char *grown = (char *)realloc(buf->data, cap);
+        if (grown == NULL) return false;
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return true;
+}
+
+/* the GPT-2 bytes_to_unicode table, printable latin-1 bytes stand for themselves */
+static void bpe_init_alphabet(bpe_tokenizer_t *tokenizer) {
+    for (int cp = 0; cp < BPE_ALPHABET_SIZE; cp++) tokenizer->alphabet_bytes[cp] = -1;
+    int n = 0;
+    for (int b = 0; b < 256; b++) {
+        bool printable = (b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF);
+        tokenizer->alphabet_bytes[printable ? b : 256 + n++] = (nlp_int16_t)b;
+    }
+}
+
+/*
+    Convert a token from the byte-level alphabet to raw bytes, appended to `out`.
+    A token with other characters, e.g. an added special token, is kept as is.
+*/
+static bool bpe_token_to_bytes(const bpe_tokenizer_t *tokenizer, const char *token, nlp_size_t len, bpe_buffer_t *out) {
+    nlp_size_t start = out->len;
+    const nlp_uint8_t *ptr = (const nlp_uint8_t *)token;
+    const nlp_uint8_t *end = ptr + len;
+    while (ptr < end) {
+        nlp_int32_t cp;
+        nlp_ssize_t char_len = utf8proc_iterate(ptr, end - ptr, &cp);
+        if (char_len < 0 || cp >= BPE_ALPHABET_SIZE || tokenizer->alphabet_bytes[cp] < 0) {
+            out->len = start;
+            return bpe_buffer_append(out, token, len);
+        }
+        nlp_uint8_t byte = (nlp_uint8_t)tokenizer->alphabet_bytes[cp];
+        if (!bpe_buffer_append(out, &byte, 1)) return false;
+        ptr += char_len;
+    }
+    return true;
+}
+
+static const char *json_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+static int json_hex4(const char *p, const char *end) {
+    if (end - p < 4) return -1;
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+/* parse a JSON string at p and append it unescaped to `out`, return the position after it or NULL */
+static const char *json_string(const char *p, const char *end, bpe_buffer_t *out) {
+    if (p >= end || *p != '"') return NULL;
+    p++;
+    while (p < end) {
+        const char *run = p;
+        while (p < end && *p != '"' && *p != '\\') p++;
+        if (!bpe_buffer_append(out, run, p - run)) return NULL;
+        if (p >= end) return NULL;
+        if (*p++ == '"') return p;
+        if (p >= end) return NULL;
+        char c = *p++;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'u': {
+            int cp = json_hex4(p, end);
+            if (cp < 0) return NULL;
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                int low = json_hex4(p + 2, end);
+                if (low >= 0xDC00 && low <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            nlp_uint8_t encoded[MAX_UTF8_CHAR_SIZE];
+            if (!bpe_buffer_append(out, encoded, utf8proc_encode_char(cp, encoded))) return NULL;
+            continue;
+        }
+        default:
+            return NULL;
+        }
+        if (!bpe_buffer_append(out, &c, 1)) return NULL;
+    }
+    return NULL;
+}
+
+typedef struct bpe_vocab_entry
+{
+    nlp_uint32_t offset;
+    nlp_uint32_t len;
+    nlp_int32_t id;
+} bpe_vocab_entry_t;
+
+/* vocab.json is a single object of token -> id */
+static bool bpe_load_vocab(bpe_tokenizer_t *tokenizer, const char *vocab_path) {
+    size_t size;
+    char *text = readfile(vocab_path, &size);
+    if (text == NULL) return false;
+    bpe_buffer_t pool = { NULL, 0, 0 };
+    bpe_buffer_t entries = { NULL, 0, 0 };
+    bpe_buffer_t bytes = { NULL, 0, 0 };
+    bool ok = false;
+    nlp_int32_t max_id = -1;
+    const char *end = text + size;
+    const char *p = json_skip_ws(text, end);
+
+    if (p >= end || *p++ != '{') goto done;
+    for (;;) {
+        p = json_skip_ws(p, end);
+        if (p < end && *p == '}' && entries.len == 0) break;
+        bpe_vocab_entry_t entry;
+        entry.offset = (nlp_uint32_t)pool.len;
+        if ((p = json_string(p, end, &pool)) == NULL) goto done;
+        entry.len = (nlp_uint32_t)(pool.len - entry.offset);
+        if (!bpe_buffer_append(&pool, "", 1)) goto done;
+        p = json_skip_ws(p, end);
+        if (p >= end || *p++ != ':') goto done;
+        p = json_skip_ws(p, end);
+        char *number_end;
+        long id = strtol(p, &number_end, 10);
+        if (number_end == p || id < 0 || id >= INT32_MAX) goto done;
+        p = json_skip_ws(number_end, end);
+        entry.id = (nlp_int32_t)id;
+        if (entry.id > max_id) max_id = entry.id;
+        if (!bpe_buffer_append(&entries, &entry, sizeof(entry))) goto done;
+        if (p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        if (p < end && *p == '}') break;
+        goto done;
+    }
+
+    tokenizer->size = (nlp_uint32_t)(max_id + 1);
+    tokenizer->offsets = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * (tokenizer->size + 1));
+    tokenizer->byte_offsets = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * (tokenizer->size + 1));
+    tokenizer->byte_lens = (nlp_uint32_t *)calloc(tokenizer->size + 1, sizeof(nlp_uint32_t));
+    if (tokenizer->offsets == NULL || tokenizer->byte_offsets == NULL || tokenizer->byte_lens == NULL) goto done;
+    for (nlp_uint32_t i = 0; i < tokenizer->size; i++) tokenizer->offsets[i] = UINT32_MAX;
+
+    const bpe_vocab_entry_t *vocab = (const bpe_vocab_entry_t *)entries.data;
+    nlp_size_t num_entries = entries.len / sizeof(bpe_vocab_entry_t);
+    for (nlp_size_t i = 0; i < num_entries; i++) {
+        nlp_int32_t id = vocab[i].id;
+        tokenizer->offsets[id] = vocab[i].offset;
+        tokenizer->byte_offsets[id] = (nlp_uint32_t)bytes.len;
+        if (!bpe_token_to_bytes(tokenizer, pool.data + vocab[i].offset, vocab[i].len, &bytes)) goto done;
+        tokenizer->byte_lens[id] = (nlp_uint32_t)bytes.len - tokenizer->byte_offsets[id];
+    }
+    // the map keeps pointers to byte_offsets, so it is filled once the arrays are final
+    tokenizer->bytes = (nlp_uint8_t *)bytes.data;
+    bytes.data = NULL;
+    for (nlp_uint32_t id = 0; id < tokenizer->size; id++) {
+        if (tokenizer->offsets[id] == UINT32_MAX) continue;
+        if (map_add(tokenizer->token_map, tokenizer->bytes + tokenizer->byte_offsets[id], tokenizer->byte_lens[id],
+              &tokenizer->byte_offsets[id])
+            == NULL)
+            goto done;
+    }
+    tokenizer->pool = pool.data;
+    pool.data = NULL;
+    ok = true;
+
+done:
+    free(text);
+    free(pool.data);
+    free(entries.data);
+    free(bytes.data);
+    return ok;
+}
+
+static nlp_int32_t bpe_lookup_bytes(const bpe_tokenizer_t *tokenizer, const void *bytes, nlp_size_t len) {
+    const nlp_uint32_t *slot = (const nlp_uint32_t *)map_get(tokenizer->token_map, (void *)bytes, len);
+    return slot != NULL ? (nlp_int32_t)(slot - tokenizer->byte_offsets) : -1;
+}
+
+static inline nlp_uint32_t bpe_pair_hash(nlp_uint64_t pair, nlp_uint32_t mask) {
+    return (nlp_uint32_t)((pair * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+/* both ids must be valid, two -1 ids would spell BPE_EMPTY_PAIR */
+static inline const bpe_merge_t *bpe_find_merge(const bpe_tokenizer_t *tokenizer, nlp_int32_t left, nlp_int32_t right) {
+    nlp_uint64_t pair = ((nlp_uint64_t)(nlp_uint32_t)left << 32) | (nlp_uint32_t)right;
+    nlp_uint32_t i = bpe_pair_hash(pair, tokenizer->merge_mask);
+    for (;;) {
+        const bpe_merge_t *merge = &tokenizer->merges[i];
+        if (merge->pair == BPE_EMPTY_PAIR) return NULL;
+        if (merge->pair == pair) return merge;
+        i = (i + 1) & tokenizer->merge_mask;
+    }
+}
+
+/* merges.txt has one "left right" pair per line in priority order, after an optional #version line */
+static bool bpe_load_merges(bpe_tokenizer_t *tokenizer, const char *merges_path) {
+    size_t size;
+    char *text = readfile(merges_path, &size);
+    if (text == NULL) return false;
+
+    nlp_size_t num_lines = 1;
+    for (size_t i = 0; i < size; i++) num_lines += text[i] == '\n';
+    nlp_uint32_t table_size = 16;
+    while (table_size < 2 * num_lines) table_size *= 2;
+    tokenizer->merges = (bpe_merge_t *)calloc(table_size, sizeof(bpe_merge_t));
+    if (tokenizer->merges == NULL) {
+        free(text);
+        return false;
+    }
+    tokenizer->merge_mask = table_size - 1;
+    for (nlp_uint32_t i = 0; i < table_size; i++) tokenizer->merges[i].pair = BPE_EMPTY_PAIR;
+
+    bpe_buffer_t bytes = { NULL, 0, 0 };
+    bool ok = true;
+    nlp_int32_t rank = 0;
+    const char *line = text;
+    const char *end = text + size;
+    while (ok && line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) eol = end;
+        const char *next = eol + 1;
+        if (eol > line && eol[-1] == '\r') eol--;
+        const char *space = memchr(line, ' ', eol - line);
+        if (space == NULL || (rank == 0 && strncmp(line, "#version", 8) == 0)) {
+            line = next;
+            continue;
+        }
+        bytes.len = 0;
+        ok = bpe_token_to_bytes(tokenizer, line, space - line, &bytes);
+        nlp_size_t left_len = bytes.len;
+        ok = ok && bpe_token_to_bytes(tokenizer, space + 1, eol - space - 1, &bytes);
+        if (ok) {
+            nlp_int32_t left = bpe_lookup_bytes(tokenizer, bytes.data, left_len);
+            nlp_int32_t right = bpe_lookup_bytes(tokenizer, bytes.data + left_len, bytes.len - left_len);
+            nlp_int32_t merged = bpe_lookup_bytes(tokenizer, bytes.data, bytes.len);
+            // merges producing tokens outside the vocab can never apply
+            if (left >= 0 && right >= 0 && merged >= 0 && bpe_find_merge(tokenizer, left, right) == NULL) {
+                nlp_uint64_t pair = ((nlp_uint64_t)(nlp_uint32_t)left << 32) | (nlp_uint32_t)right;
+                nlp_uint32_t i = bpe_pair_hash(pair, tokenizer->merge_mask);
+                while (tokenizer->merges[i].pair != BPE_EMPTY_PAIR) i = (i + 1) & tokenizer->merge_mask;
+                tokenizer->merges[i].pair = pair;
+                tokenizer->merges[i].rank = rank;
+                tokenizer->merges[i].merged = merged;
+            }
+            rank++;
+        }
+        line = next;
+    }
+    free(bytes.data);
+    free(text);
+    return ok;
+}
+
+bpe_tokenizer_t *nlp_bpe_tokenizer_create(const char *vocab_path, const char *merges_path) {
+    if (vocab_path == NULL || merges_path == NULL) return NULL;
+    bpe_tokenizer_t *tokenizer = (bpe_tokenizer_t *)calloc(1, sizeof(bpe_tokenizer_t));
+    if (tokenizer == NULL) return NULL;
+    bpe_init_alphabet(tokenizer);
+    tokenizer->token_map = map_create();
+    if (tokenizer->token_map == NULL || !bpe_load_vocab(tokenizer, vocab_path)
+        || !bpe_load_merges(tokenizer, merges_path)) {
+        nlp_bpe_tokenizer_destory(tokenizer);
+        return NULL;
+    }
+    for (int b = 0; b < 256; b++) {
+        nlp_uint8_t byte = (nlp_uint8_t)b;
+        tokenizer->byte_ids[b] = bpe_lookup_bytes(tokenizer, &byte, 1);
+    }
+    return tokenizer;
+}
+
+void nlp_bpe_tokenizer_destory(bpe_tokenizer_t *tokenizer) {
+    if (tokenizer == NULL) return;
+    if (tokenizer->token_map != NULL) map_delete(tokenizer->token_map, NULL, NULL);
+    free(tokenizer->pool);
+    free(tokenizer->offsets);
+    free(tokenizer->bytes);
+    free(tokenizer->byte_offsets);
+    free(tokenizer->byte_lens);
+    free(tokenizer->merges);
+    free(tokenizer);
+}
+
+nlp_size_t nlp_bpe_tokenizer_vocab_size(const bpe_tokenizer_t *tokenizer) { return tokenizer->size; }
+
+nlp_int32_t nlp_bpe_tokenizer_token_to_id(const bpe_tokenizer_t *tokenizer, const char *token, nlp_size_t len) {
+    bpe_buffer_t bytes = { NULL, 0, 0 };
+    nlp_int32_t id = -1;
+    if (bpe_token_to_bytes(tokenizer, token, len, &bytes)) id = bpe_lookup_bytes(tokenizer, bytes.data, bytes.len);
+    free(bytes.data);
+    return id;
+}
+
+const char *nlp_bpe_tokenizer_id_to_token(const bpe_tokenizer_t *tokenizer, nlp_int32_t id) {
+    if (id < 0 || (nlp_uint32_t)id >= tokenizer->size || tokenizer->offsets[id] == UINT32_MAX) return NULL;
+    return tokenizer->pool + tokenizer->offsets[id];
+}
+
+/* character classes of the GPT-2 pre-tokenization pattern */
+typedef enum bpe_char_class { BPE_CHAR_LETTER, BPE_CHAR_NUMBER, BPE_CHAR_SPACE, BPE_CHAR_OTHER } bpe_char_class_t;
+
+/* the White_Space property, which is what \s matches */
+static inline bool bpe_is_space(nlp_int32_t cp) {
+    if (cp < 0x80) return cp == ' ' || (cp >= '\t' && cp <= '\r');
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029
+           || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+/* class of the character at text[i], its byte length is set to char_len. Invalid bytes are one byte others. */
+static inline bpe_char_class_t bpe_char_class(const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t i,
+  nlp_size_t *char_len) {
+    nlp_uint8_t c = text[i];
+    *char_len = 1;
+    if (c < 0x80) {
+        if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') return BPE_CHAR_LETTER;
+        if (c >= '0' && c <= '9') return BPE_CHAR_NUMBER;
+        return bpe_is_space(c) ? BPE_CHAR_SPACE : BPE_CHAR_OTHER;
+    }
+    nlp_int32_t cp;
+    nlp_ssize_t n = utf8proc_iterate(text + i, len - i, &cp);
+    if (n < 0) return BPE_CHAR_OTHER;
+    *char_len = (nlp_size_t)n;
+    if (bpe_is_space(cp)) return BPE_CHAR_SPACE;
+    nlp_uint8_t char_flags = utf8_char_class(cp);
+    if (char_flags & UTF8_CLASS_LETTER) return BPE_CHAR_LETTER;
+    if (char_flags & UTF8_CLASS_NUMBER) return BPE_CHAR_NUMBER;
+    return BPE_CHAR_OTHER;
+}
+
+/*
+    End of the pre-token starting at text[i], following the GPT-2 pattern
+    's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+*/
+static nlp_size_t bpe_next_pretoken(const nlp_uint8_t *text, nlp_size_t len, nlp_size_t i) {
+    if (text[i] == '\'' && i + 1 < len) {
+        nlp_uint8_t c1 = text[i + 1];
+        nlp_uint8_t c2 = i + 2 < len ? text[i + 2] : 0;
+        if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') return i + 2;
+        if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) return i + 3;
+    }
+
+    nlp_size_t char_len;
+    nlp_size_t j = i;
+    bpe_char_class_t cls = bpe_char_class(text, len, j, &char_len);
+    if (text[i] == ' ' && i + 1 < len) {
+        nlp_size_t next_len;
+        bpe_char_class_t next = bpe_char_class(text, len, i + 1, &next_len);
+        if (next != BPE_CHAR_SPACE) {
+            j = i + 1;
+            cls = next;
+            char_len = next_len;
+        }
+    }
+    if (cls != BPE_CHAR_SPACE) {
+        j += char_len;
+        while (j < len && bpe_char_class(text, len, j, &char_len) == cls) j += char_len;
+        return j;
+    }
+
+    // a whitespace run leaves its last character to the next pre-token if more text follows
+    nlp_size_t last = j;
+    j += char_len;
+    while (j < len && bpe_char_class(text, len, j, &char_len) == BPE_CHAR_SPACE) {
+        last = j;
+        j += char_len;
+    }
+    if (j == len || last == i) return j;
+    return last;
+}
+
+typedef struct bpe_symbol
+{
+    nlp_int32_t id;
+    nlp_int32_t prev;
+    nlp_int32_t next;
+    nlp_uint32_t len;// 0 once merged into the symbol on its left
+} bpe_symbol_t;
+
+typedef struct bpe_candidate
+{
+    nlp_int32_t rank;
+    nlp_int32_t pos;
+    nlp_int32_t left;
+    nlp_int32_t right;
+} bpe_candidate_t;
+
+/* per call memory, a word of n bytes needs n symbols and at most 3n heap entries */
+typedef struct bpe_scratch
+{
+    bpe_symbol_t *symbols;
+    bpe_candidate_t *heap;
+    nlp_size_t cap;
+    bpe_symbol_t inline_symbols[BPE_INLINE_WORD_SIZE];
+    bpe_candidate_t inline_heap[3 * BPE_INLINE_WORD_SIZE];
+} bpe_scratch_t;
+
+static bool bpe_scratch_reserve(bpe_scratch_t *scratch, nlp_size_t len) {
+    if (len <= scratch->cap) return true;
+    bpe_symbol_t *symbols = (bpe_symbol_t *)malloc(sizeof(bpe_symbol_t) * len);
+    bpe_candidate_t *heap = (bpe_candidate_t *)malloc(sizeof(bpe_candidate_t) * 3 * len);
+    if (symbols == NULL || heap == NULL) {
+        free(symbols);
+        free(heap);
+        return false;
+    }
+    if (scratch->symbols != scratch->inline_symbols) {
+        free(scratch->symbols);
+        free(scratch->heap);
+    }
+    scratch->symbols = symbols;
+    scratch->heap = heap;
+    scratch->cap = len;
+    return true;
+}
+
+static inline bool bpe_candidate_less(const bpe_candidate_t *a, const bpe_candidate_t *b) {
+    return a->rank < b->rank || (a->rank == b->rank && a->pos < b->pos);
+}
+
+static void bpe_heap_push(bpe_candidate_t *heap, nlp_size_t *n, bpe_candidate_t candidate) {
+    nlp_size_t i = (*n)++;
+    while (i > 0) {
+        nlp_size_t parent = (i - 1) / 2;
+        if (!bpe_candidate_less(&candidate, &heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = candidate;
+}
+
+static bpe_candidate_t bpe_heap_pop(bpe_candidate_t *heap, nlp_size_t *n) {
+    bpe_candidate_t top = heap[0];
+    bpe_candidate_t last = heap[--(*n)];
+    nlp_size_t i = 0;
+    for (;;) {
+        nlp_size_t child = 2 * i + 1;
+        if (child >= *n) break;
+        if (child + 1 < *n && bpe_candidate_less(&heap[child + 1], &heap[child])) child++;
+        if (!bpe_candidate_less(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static inline void bpe_push_pair(const bpe_tokenizer_t *tokenizer,
+  const bpe_symbol_t *symbols,
+  bpe_candidate_t *heap,
+  nlp_size_t *n,
+  nlp_int32_t pos) {
+    if (pos < 0 || symbols[pos].next < 0) return;
+    nlp_int32_t next = symbols[pos].next;
+    // bytes missing from the vocab have no id and never merge
+    if (symbols[pos].id < 0 || symbols[next].id < 0) return;
+    const bpe_merge_t *merge = bpe_find_merge(tokenizer, symbols[pos].id, symbols[next].id);
+    if (merge == NULL) return;
+    bpe_candidate_t candidate = { merge->rank, pos, symbols[pos].id, symbols[next].id };
+    bpe_heap_push(heap, n, candidate);
+}
+
+/* merge one pre-tokenized word and append its ids */
+static bool bpe_encode_word(const bpe_tokenizer_t *tokenizer,
+  bpe_scratch_t *scratch,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids,
+  nlp_size_t *count) {
+    if (!bpe_scratch_reserve(scratch, len)) return false;
+    bpe_symbol_t *symbols = scratch->symbols;
+    bpe_candidate_t *heap = scratch->heap;
+    nlp_size_t heap_len = 0;
+
+    for (nlp_size_t i = 0; i < len; i++) {
+        symbols[i].id = tokenizer->byte_ids[word[i]];
+        symbols[i].prev = (nlp_int32_t)i - 1;
+        symbols[i].next = i + 1 < len ? (nlp_int32_t)i + 1 : -1;
+        symbols[i].len = 1;
+    }
+    for (nlp_size_t i = 0; i + 1 < len; i++) bpe_push_pair(tokenizer, symbols, heap, &heap_len, (nlp_int32_t)i);
+
+    while (heap_len > 0) {
+        bpe_candidate_t top = bpe_heap_pop(heap, &heap_len);
+        bpe_symbol_t *left = &symbols[top.pos];
+        // skip candidates made stale by earlier merges
+        if (left->len == 0 || left->next < 0 || left->id != top.left || symbols[left->next].id != top.right) continue;
+        bpe_symbol_t *right = &symbols[left->next];
+        left->id = bpe_find_merge(tokenizer, top.left, top.right)->merged;
+        left->len += right->len;
+        left->next = right->next;
+        if (right->next >= 0) symbols[right->next].prev = top.pos;
+        right->len = 0;
+        bpe_push_pair(tokenizer, symbols, heap, &heap_len, left->prev);
+        bpe_push_pair(tokenizer, symbols, heap, &heap_len, top.pos);
+    }
+
+    // bytes missing from the vocab are dropped
+    for (nlp_int32_t i = len > 0 ? 0 : -1; i >= 0; i = symbols[i].next) {
+        if (symbols[i].id < 0) continue;
+        if (*count < max_ids) ids[*count] = symbols[i].id;
+        (*count)++;
+    }
+    return true;
+}
+
+nlp_ssize_t nlp_bpe_tokenizer_encode(const bpe_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids) {
+    if (tokenizer == NULL || (text == NULL && len > 0)) return -1;
+    const nlp_uint8_t *input = (const nlp_uint8_t *)text;
+    bpe_scratch_t scratch;
+    scratch.symbols = scratch.inline_symbols;
+    scratch.heap = scratch.inline_heap;
+    scratch.cap = BPE_INLINE_WORD_SIZE;
+
+    nlp_size_t count = 0;
+    bool ok = true;
+    for (nlp_size_t i = 0; ok && i < len;) {
+        nlp_size_t end = bpe_next_pretoken(input, len, i);
+        ok = bpe_encode_word(tokenizer, &scratch, input + i, end - i, ids, max_ids, &count);
+        i = end;
+    }
+    if (scratch.symbols != scratch.inline_symbols) {
+        free(scratch.symbols);
+        free(scratch.heap);
+    }
+    return ok ? (nlp_ssize_t)count : -1;
+}
+
+nlp_ssize_t nlp_bpe_tokenizer_decode(const bpe_tokenizer_t *tokenizer,
+  const nlp_int32_t *ids,
+  nlp_size_t num_ids,
+  char *out,
+  nlp_size_t out_cap) {
+    if (tokenizer == NULL || (ids == NULL && num_ids > 0) || (out == NULL && out_cap > 0)) return -1;
+    nlp_size_t n = 0;
+    for (nlp_size_t i = 0; i < num_ids; i++) {
+        nlp_int32_t id = ids[i];
+        if (id < 0 || (nlp_uint32_t)id >= tokenizer->size || tokenizer->offsets[id] == UINT32_MAX) return -1;
+        nlp_size_t len = tokenizer->byte_lens[id];
+        if (n < out_cap) {
+            nlp_size_t copy = len < out_cap - n ? len : out_cap - n;
+            memcpy(out + n, tokenizer->bytes + tokenizer->byte_offsets[id], copy);
+        }
+        n += len;
+    }
+    if (n < out_cap) out[n] = '\0';
+    return (nlp_ssize_t)n;
+}
@@ -0,0 +1,54 @@
+#ifndef __CHAR_CLASS_H
+#define __CHAR_CLASS_H
+
+#include "strutils.h"
+
+/*
+    Two-stage table of the UTF8_CLASS_* flags of every codepoint: stage 1
+    maps the high bits of a codepoint to one of the distinct blocks of
+    stage 2, which holds the flags of each codepoint of the block. Most of
+    the 0x110000 codepoints share a few blocks, the whole table is about
+    38 KiB and the blocks of one script stay in L1. The data is generated
+    by tools/gen_char_class.c.
+
+    The simple lowercase and uppercase mappings of utf8proc are two more
+    tables of the same shape, stage 2 holding an index into the distinct
+    differences between a codepoint and its mapping (0 for none). They
+    stop at the Adlam block, no codepoint above has a case.
+*/
+
+#define CHAR_CLASS_BLOCK_SHIFT 7
+#define CHAR_CLASS_BLOCK_SIZE (1 << CHAR_CLASS_BLOCK_SHIFT)
+#define CHAR_CLASS_MAX_CODEPOINT 0x10FFFF
+#define CHAR_CASE_MAX_CODEPOINT 0x1E97F
+
+extern const nlp_uint8_t char_class_stage1[];
+extern const nlp_uint8_t char_class_stage2[][CHAR_CLASS_BLOCK_SIZE];
+extern const nlp_uint8_t char_lower_stage1[];
+extern const nlp_uint8_t char_lower_stage2[][CHAR_CLASS_BLOCK_SIZE];
+extern const nlp_int32_t char_lower_deltas[];
+extern const nlp_uint8_t char_upper_stage1[];
+extern const nlp_uint8_t char_upper_stage2[][CHAR_CLASS_BLOCK_SIZE];
+extern const nlp_int32_t char_upper_deltas[];
+
+/* UTF8_CLASS_* flags of a codepoint, anything outside unicode is a control character like an unassigned one */
+static inline nlp_uint8_t utf8_char_class(nlp_int32_t cp) {
+    if ((nlp_uint32_t)cp > CHAR_CLASS_MAX_CODEPOINT) return UTF8_CLASS_CONTROL;
+    return char_class_stage2[char_class_stage1[cp >> CHAR_CLASS_BLOCK_SHIFT]][cp & (CHAR_CLASS_BLOCK_SIZE - 1)];
+}
+
+/* simple lowercase of a codepoint, like utf8proc_tolower */
+static inline nlp_int32_t utf8_char_lower(nlp_int32_t cp) {
+    if ((nlp_uint32_t)cp > CHAR_CASE_MAX_CODEPOINT) return cp;
+    return cp + char_lower_deltas[char_lower_stage2[char_lower_stage1[cp >> CHAR_CLASS_BLOCK_SHIFT]]
+                                                   [cp & (CHAR_CLASS_BLOCK_SIZE - 1)]];
+}
+
+/* simple uppercase of a codepoint, like utf8proc_toupper */
+static inline nlp_int32_t utf8_char_upper(nlp_int32_t cp) {
+    if ((nlp_uint32_t)cp > CHAR_CASE_MAX_CODEPOINT) return cp;
+    return cp + char_upper_deltas[char_upper_stage2[char_upper_stage1[cp >> CHAR_CLASS_BLOCK_SHIFT]]
+                                                   [cp & (CHAR_CLASS_BLOCK_SIZE - 1)]];
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include "da_trie.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DA_TRIE_FREE (-1)
+// labels are 0 for the end of a key and byte + 1 otherwise
+#define DA_TRIE_NUM_LABELS 257
+
+typedef struct da_trie_builder
+{
+    da_trie_unit_t *units;
+    nlp_size_t cap;
+    nlp_size_t size;
+    // units before this one are (nearly) all taken, the search for a free base starts here
+    nlp_size_t next_check_pos;
+    const nlp_uint8_t *const *keys;
+    const nlp_size_t *lens;
+    const nlp_int32_t *values;
+} da_trie_builder_t;
+
+static bool da_trie_reserve(da_trie_builder_t *builder, nlp_size_t size) {
+    if (size > builder->size) builder->size = size;
+    if (size <= builder->cap) return true;
+    nlp_size_t cap = builder->cap ? builder->cap : 1024;
+    while (cap < size) cap *= 2;
+    if (cap > INT32_MAX) return false;
+    da_trie_unit_t *units = (da_trie_unit_t *)realloc(builder->units, sizeof(da_trie_unit_t) * cap);
+    if (units == NULL) return false;
+    for (nlp_size_t i = builder->cap; i < cap; i++) {
+        units[i].base = 0;
+        units[i].check = DA_TRIE_FREE;
+    }
+    builder->units = units;
+    builder->cap = cap;
+    return true;
+}
+
+/* place the children of `node`, which are the keys [begin, end) at `depth` */
+static bool da_trie_insert(da_trie_builder_t *builder,
+  nlp_size_t node,
+  nlp_size_t begin,
+  nlp_size_t end,
+  nlp_size_t depth) {
+    nlp_int32_t labels[DA_TRIE_NUM_LABELS];
+    nlp_size_t starts[DA_TRIE_NUM_LABELS + 1];
+    nlp_size_t num_labels = 0;
+    for (nlp_size_t i = begin; i < end; i++) {
+        nlp_int32_t label = builder->lens[i] == depth ? 0 : builder->keys[i][depth] + 1;
+        if (num_labels == 0 || labels[num_labels - 1] != label) {
+            labels[num_labels] = label;
+            starts[num_labels++] = i;
+        }
+    }
+    starts[num_labels] = end;
+
+    // first fit from next_check_pos, which moves on once the units before it are 95% taken as in Darts
+    nlp_size_t pos = (nlp_size_t)labels[0] + 1;
+    if (pos < builder->next_check_pos) pos = builder->next_check_pos;
+    nlp_size_t num_taken = 0;
+    bool first = true;
+    nlp_size_t base = 0;
+    for (;; pos++) {
+        if (!da_trie_reserve(builder, pos + 1)) return false;
+        if (builder->units[pos].check != DA_TRIE_FREE) {
+            num_taken++;
+            continue;
+        }
+        if (first) {
+            builder->next_check_pos = pos;
+            first = false;
+        }
+        base = pos - labels[0];
+        if (!da_trie_reserve(builder, base + labels[num_labels - 1] + 1)) return false;
+        nlp_size_t i = 1;
+        while (i < num_labels && builder->units[base + labels[i]].check == DA_TRIE_FREE) i++;
+        if (i == num_labels) break;
+    }
+    if ((double)num_taken / (pos - builder->next_check_pos + 1) >= 0.95) builder->next_check_pos = pos;
+
+    builder->units[node].base = (nlp_int32_t)base;
+    for (nlp_size_t i = 0; i < num_labels; i++) builder->units[base + labels[i]].check = (nlp_int32_t)node;
+    for (nlp_size_t i = 0; i < num_labels; i++) {
+        nlp_size_t child = base + labels[i];
+        if (labels[i] == 0)
+            builder->units[child].base = -builder->values[starts[i]] - 1;
+        else if (!da_trie_insert(builder, child, starts[i], starts[i + 1], depth + 1))
+            return false;
+    }
+    return true;
+}
+
+int da_trie_build(da_trie_t *trie,
+  const nlp_uint8_t *const *keys,
+  const nlp_size_t *lens,
+  const nlp_int32_t *values,
+  nlp_size_t num_keys) {
+    da_trie_builder_t builder = { NULL, 0, 0, 1, keys, lens, values };
+    memset(trie, 0, sizeof(da_trie_t));
+    if (!da_trie_reserve(&builder, 1)) return -1;
+    builder.units[0].check = 0;
+    for (nlp_size_t i = 0; i < num_keys; i++) {
+        if (lens[i] > trie->max_key_len) trie->max_key_len = lens[i];
+    }
+    if (num_keys > 0 && !da_trie_insert(&builder, 0, 0, num_keys, 0)) {
+        free(builder.units);
+        return -1;
+    }
+    // shrink to the used units, a failed shrink keeps the larger block
+    da_trie_unit_t *units = (da_trie_unit_t *)realloc(builder.units, sizeof(da_trie_unit_t) * builder.size);
+    trie->units = units != NULL ? units : builder.units;
+    trie->size = builder.size;
+    return 0;
+}
+
+void da_trie_free(da_trie_t *trie) {
+    free(trie->units);
+    memset(trie, 0, sizeof(da_trie_t));
+}
+
+nlp_int32_t da_trie_exact_match(const da_trie_t *trie, const nlp_uint8_t *key, nlp_size_t len) {
+    nlp_size_t node = 0;
+    for (nlp_size_t i = 0; i < len; i++) {
+        nlp_size_t child = (nlp_size_t)trie->units[node].base + key[i] + 1;
+        if (child >= trie->size || trie->units[child].check != (nlp_int32_t)node) return -1;
+        node = child;
+    }
+    nlp_size_t terminal = (nlp_size_t)trie->units[node].base;
+    if (len == 0 || trie->units[node].base <= 0 || trie->units[terminal].check != (nlp_int32_t)node) return -1;
+    return -trie->units[terminal].base - 1;
+}
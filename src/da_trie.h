@@ -0,0 +1,75 @@
+#ifndef __DA_TRIE_H
+#define __DA_TRIE_H
+
+#include "common.h"
+
+#include <stdbool.h>
+
+/*
+    Static double-array trie over byte strings. Every node is one unit, the
+    child of node s on byte c is the unit t = base[s] + c + 1 with
+    check[t] == s, and a key ending at s has a terminal child on label 0
+    whose base stores the value as -value - 1. A walk costs two loads per
+    byte and the whole trie is two int32 per unit in one array.
+*/
+
+typedef struct da_trie_unit
+{
+    nlp_int32_t base;
+    nlp_int32_t check;
+} da_trie_unit_t;
+
+typedef struct da_trie
+{
+    da_trie_unit_t *units;
+    nlp_size_t size;
+    nlp_size_t max_key_len;
+} da_trie_t;
+
+typedef struct da_trie_match
+{
+    nlp_int32_t value;
+    nlp_size_t len;
+} da_trie_match_t;
+
+/*
+    Build the trie from `num_keys` keys sorted bytewise without duplicates,
+    values must be >= 0. Return 0, or -1 if failed.
+*/
+int da_trie_build(da_trie_t *trie,
+  const nlp_uint8_t *const *keys,
+  const nlp_size_t *lens,
+  const nlp_int32_t *values,
+  nlp_size_t num_keys);
+void da_trie_free(da_trie_t *trie);
+
+/* Return the value of the key, -1 if not found */
+nlp_int32_t da_trie_exact_match(const da_trie_t *trie, const nlp_uint8_t *key, nlp_size_t len);
+
+/*
+    Find every key that is a prefix of text, shortest first. `matches` must
+    hold trie->max_key_len entries. Return the number of matches.
+*/
+static inline nlp_size_t da_trie_prefix_search(const da_trie_t *trie,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  da_trie_match_t *matches) {
+    const da_trie_unit_t *units = trie->units;
+    nlp_size_t num_matches = 0;
+    nlp_size_t node = 0;
+    if (len > trie->max_key_len) len = trie->max_key_len;
+    for (nlp_size_t i = 0; i < len; i++) {
+        nlp_size_t child = (nlp_size_t)units[node].base + text[i] + 1;
+        if (child >= trie->size || units[child].check != (nlp_int32_t)node) break;
+        node = child;
+        nlp_size_t terminal = (nlp_size_t)units[node].base;
+        if (units[node].base > 0 && units[terminal].check == (nlp_int32_t)node) {
+            matches[num_matches].value = -units[terminal].base - 1;
+            matches[num_matches].len = i + 1;
+            num_matches++;
+        }
+    }
+    return num_matches;
+}
+
+#endif
@@ -0,0 +1,342 @@
+#include "pipeline.h"
+
+#include "msgqueue.h"
+#include "thrdpool.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32) && defined(_MSC_VER)
+#include "win/pthread.h"
+#else
+#include <pthread.h>
+#endif
+
+// seq of the batch that tells a worker, and then the writer, that the input is done
+#define PIPELINE_END_SEQ ((nlp_size_t)-1)
+#define PIPELINE_SHARD_PATH_EXTRA 16
+
+/* a batch of whole documents on its way from the reader to the writer */
+typedef struct pipeline_batch
+{
+    void *link;// used by msgqueue
+    nlp_size_t seq;
+    char *text;
+    nlp_size_t len;
+    nlp_int32_t *ids;
+    nlp_size_t num_ids;
+    nlp_size_t cap;
+    nlp_size_t num_documents;
+} pipeline_batch_t;
+
+typedef struct pipeline
+{
+    nlp_pipeline_options_t options;
+    nlp_encode_func_t encode;
+    const void *tokenizer;
+    const char *output_prefix;
+    // reader -> workers -> writer
+    msgqueue_t *input;
+    msgqueue_t *output;
+    nlp_size_t num_workers;
+    pipeline_batch_t *end_batches;
+    // writer state, batches arriving early wait in pending[seq % max_in_flight]
+    pipeline_batch_t **pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    nlp_size_t num_written;
+    bool writer_done;
+    atomic_bool failed;
+    nlp_pipeline_stats_t stats;
+} pipeline_t;
+
+void nlp_pipeline_options_init(nlp_pipeline_options_t *options) {
+    options->document_mode = NLP_DOCUMENT_LINE;
+    options->num_workers = 4;
+    options->batch_bytes = 1 << 20;
+    options->max_in_flight = 16;
+    options->shard_ids = (nlp_size_t)1 << 28;
+    options->eos_id = -1;
+}
+
+static bool pipeline_add_document(pipeline_t *pipeline, pipeline_batch_t *batch, const char *text, nlp_size_t len) {
+    nlp_size_t extra = pipeline->options.eos_id >= 0 ? 1 : 0;
+    nlp_ssize_t n = pipeline->encode(pipeline->tokenizer, text, len, batch->ids + batch->num_ids,
+      batch->cap - batch->num_ids);
+    if (n < 0) return false;
+    if ((nlp_size_t)n + extra > batch->cap - batch->num_ids) {
+        nlp_size_t cap = 2 * batch->cap;
+        if (cap < batch->num_ids + n + extra) cap = batch->num_ids + n + extra;
+        nlp_int32_t *ids = (nlp_int32_t *)realloc(batch->ids, sizeof(nlp_int32_t) * cap);
+        if (ids == NULL) return false;
+        batch->ids = ids;
+        batch->cap = cap;
+        n = pipeline->encode(pipeline->tokenizer, text, len, batch->ids + batch->num_ids, batch->cap - batch->num_ids);
+        if (n < 0 || (nlp_size_t)n + extra > batch->cap - batch->num_ids) return false;
+    }
+    batch->num_ids += n;
+    if (extra) batch->ids[batch->num_ids++] = pipeline->options.eos_id;
+    batch->num_documents++;
+    return true;
+}
+
+static bool pipeline_encode_batch(pipeline_t *pipeline, pipeline_batch_t *batch) {
+    // BPE and WordPiece rarely produce more than one id per 3 bytes
+    batch->cap = batch->len / 3 + 16;
+    batch->ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * batch->cap);
+    if (batch->ids == NULL) return false;
+
+    const char *text = batch->text;
+    const char *end = text + batch->len;
+    const char *paragraph = NULL;
+    const char *paragraph_end = NULL;
+    while (text < end) {
+        const char *eol = (const char *)memchr(text, '\n', end - text);
+        if (eol == NULL) eol = end;
+        const char *line_end = eol > text && eol[-1] == '\r' ? eol - 1 : eol;
+        if (pipeline->options.document_mode == NLP_DOCUMENT_LINE) {
+            if (line_end > text && !pipeline_add_document(pipeline, batch, text, line_end - text)) return false;
+        } else if (line_end > text) {
+            if (paragraph == NULL) paragraph = text;
+            paragraph_end = line_end;
+        } else if (paragraph != NULL) {
+            if (!pipeline_add_document(pipeline, batch, paragraph, paragraph_end - paragraph)) return false;
+            paragraph = NULL;
+        }
+        text = eol + 1;
+    }
+    return paragraph == NULL || pipeline_add_document(pipeline, batch, paragraph, paragraph_end - paragraph);
+}
+
+static void pipeline_worker(void *context) {
+    pipeline_t *pipeline = (pipeline_t *)context;
+    for (;;) {
+        pipeline_batch_t *batch = (pipeline_batch_t *)msgqueue_get(pipeline->input);
+        nlp_size_t seq = batch->seq;
+        if (seq != PIPELINE_END_SEQ && !atomic_load(&pipeline->failed)) {
+            if (!pipeline_encode_batch(pipeline, batch)) atomic_store(&pipeline->failed, true);
+        }
+        free(batch->text);
+        batch->text = NULL;
+        msgqueue_put(batch, pipeline->output);
+        if (seq == PIPELINE_END_SEQ) return;
+    }
+}
+
+static FILE *pipeline_open_shard(pipeline_t *pipeline) {
+    nlp_size_t size = strlen(pipeline->output_prefix) + PIPELINE_SHARD_PATH_EXTRA;
+    char *path = (char *)malloc(size);
+    if (path == NULL) return NULL;
+    snprintf(path, size, "%s-%05zu.bin", pipeline->output_prefix, (size_t)pipeline->stats.shards);
+    FILE *fp = fopen(path, "wb");
+    free(path);
+    if (fp != NULL) pipeline->stats.shards++;
+    return fp;
+}
+
+/* write the batches in reading order and let the reader know when a slot is free */
+static void pipeline_writer(void *context) {
+    pipeline_t *pipeline = (pipeline_t *)context;
+    nlp_size_t window = pipeline->options.max_in_flight;
+    nlp_size_t next = 0;
+    nlp_size_t num_ends = 0;
+    FILE *shard = NULL;
+    nlp_size_t shard_ids = 0;
+
+    while (num_ends < pipeline->num_workers) {
+        pipeline_batch_t *batch = (pipeline_batch_t *)msgqueue_get(pipeline->output);
+        if (batch->seq == PIPELINE_END_SEQ) {
+            num_ends++;
+            continue;
+        }
+        pipeline->pending[batch->seq % window] = batch;
+        while ((batch = pipeline->pending[next % window]) != NULL && batch->seq == next) {
+            pipeline->pending[next % window] = NULL;
+            if (!atomic_load(&pipeline->failed) && batch->num_ids > 0) {
+                if (shard != NULL && shard_ids >= pipeline->options.shard_ids) {
+                    if (fclose(shard) != 0) atomic_store(&pipeline->failed, true);
+                    shard = NULL;
+                }
+                if (shard == NULL) {
+                    shard = pipeline_open_shard(pipeline);
+                    shard_ids = 0;
+                }
+                if (shard == NULL || fwrite(batch->ids, sizeof(nlp_int32_t), batch->num_ids, shard) != batch->num_ids)
+                    atomic_store(&pipeline->failed, true);
+                shard_ids += batch->num_ids;
+            }
+            pipeline->stats.documents += batch->num_documents;
+            pipeline->stats.ids += batch->num_ids;
+            free(batch->ids);
+            free(batch);
+
+            pthread_mutex_lock(&pipeline->mutex);
+            pipeline->num_written = ++next;
+            pthread_cond_broadcast(&pipeline->cond);
+            pthread_mutex_unlock(&pipeline->mutex);
+        }
+    }
+    if (shard != NULL && fclose(shard) != 0) atomic_store(&pipeline->failed, true);
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->writer_done = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+/* end of the last whole document in text, 0 if there is none */
+static nlp_size_t pipeline_last_boundary(nlp_document_mode_t mode, const char *text, nlp_size_t len) {
+    for (nlp_size_t i = len; i > 0; i--) {
+        if (text[i - 1] != '\n') continue;
+        if (mode == NLP_DOCUMENT_LINE) return i;
+        // an empty line ends a paragraph
+        nlp_size_t j = i - 1;
+        if (j > 0 && text[j - 1] == '\r') j--;
+        if (j == 0 || text[j - 1] == '\n') return i;
+    }
+    return 0;
+}
+
+/* read batches of whole documents and hand them to the workers */
+static void pipeline_read(pipeline_t *pipeline, FILE *fp) {
+    nlp_size_t cap = pipeline->options.batch_bytes;
+    nlp_size_t used = 0;
+    char *buffer = (char *)malloc(cap);
+    bool eof = false;
+    nlp_size_t seq = 0;
+
+    while (buffer != NULL && !eof && !atomic_load(&pipeline->failed)) {
+        nlp_size_t n = fread(buffer + used, 1, cap - used, fp);
+        used += n;
+        pipeline->stats.bytes += n;
+        if (used < cap) {
+            if (ferror(fp)) break;
+            eof = true;
+        }
+        nlp_size_t boundary = eof ? used : pipeline_last_boundary(pipeline->options.document_mode, buffer, used);
+        if (boundary == 0 && !eof) {
+            // a document longer than the buffer
+            char *grown = (char *)realloc(buffer, 2 * cap);
+            if (grown == NULL) break;
+            buffer = grown;
+            cap *= 2;
+            continue;
+        }
+        if (boundary == 0) break;
+
+        pipeline_batch_t *batch = (pipeline_batch_t *)calloc(1, sizeof(pipeline_batch_t));
+        nlp_size_t rest = used - boundary;
+        nlp_size_t next_cap = pipeline->options.batch_bytes > 2 * rest ? pipeline->options.batch_bytes : 2 * rest;
+        char *next_buffer = (char *)malloc(next_cap);
+        if (batch == NULL || next_buffer == NULL) {
+            free(batch);
+            free(next_buffer);
+            break;
+        }
+        memcpy(next_buffer, buffer + boundary, rest);
+        batch->seq = seq++;
+        batch->text = buffer;
+        batch->len = boundary;
+        buffer = next_buffer;
+        cap = next_cap;
+        used = rest;
+
+        pthread_mutex_lock(&pipeline->mutex);
+        while (batch->seq - pipeline->num_written >= pipeline->options.max_in_flight)
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+        pthread_mutex_unlock(&pipeline->mutex);
+        msgqueue_put(batch, pipeline->input);
+    }
+    if (!eof) atomic_store(&pipeline->failed, true);
+    free(buffer);
+    for (nlp_size_t i = 0; i < pipeline->num_workers; i++) msgqueue_put(&pipeline->end_batches[i], pipeline->input);
+}
+
+static bool pipeline_init(pipeline_t *pipeline, const nlp_pipeline_options_t *options) {
+    if (options == NULL)
+        nlp_pipeline_options_init(&pipeline->options);
+    else
+        pipeline->options = *options;
+    nlp_pipeline_options_t *opts = &pipeline->options;
+    if (opts->num_workers == 0) opts->num_workers = 1;
+    if (opts->max_in_flight < opts->num_workers) opts->max_in_flight = opts->num_workers;
+    if (opts->batch_bytes == 0) opts->batch_bytes = 1;
+    atomic_init(&pipeline->failed, false);
+
+    pipeline->end_batches = (pipeline_batch_t *)calloc(opts->num_workers, sizeof(pipeline_batch_t));
+    pipeline->pending = (pipeline_batch_t **)calloc(opts->max_in_flight, sizeof(pipeline_batch_t *));
+    if (pipeline->end_batches == NULL || pipeline->pending == NULL) return false;
+    for (nlp_size_t i = 0; i < opts->num_workers; i++) pipeline->end_batches[i].seq = PIPELINE_END_SEQ;
+    // the reader waits for free slots, so the queues never hold more than max_in_flight batches
+    pipeline->input = msgqueue_create(opts->max_in_flight, 0);
+    pipeline->output = msgqueue_create(opts->max_in_flight + opts->num_workers, 0);
+    return pipeline->input != NULL && pipeline->output != NULL;
+}
+
+int nlp_pipeline_run(const char *input_path,
+  const char *output_prefix,
+  nlp_encode_func_t encode,
+  const void *tokenizer,
+  const nlp_pipeline_options_t *options,
+  nlp_pipeline_stats_t *stats) {
+    if (input_path == NULL || output_prefix == NULL || encode == NULL) return -1;
+    pipeline_t *pipeline = (pipeline_t *)calloc(1, sizeof(pipeline_t));
+    if (pipeline == NULL) return -1;
+    pipeline->encode = encode;
+    pipeline->tokenizer = tokenizer;
+    pipeline->output_prefix = output_prefix;
+    FILE *fp = NULL;
+    thrdpool_t *pool = NULL;
+    bool mutex_ready = false;
+    int ret = -1;
+
+    if (!pipeline_init(pipeline, options)) goto done;
+    if (pthread_mutex_init(&pipeline->mutex, NULL) != 0) goto done;
+    if (pthread_cond_init(&pipeline->cond, NULL) != 0) {
+        pthread_mutex_destroy(&pipeline->mutex);
+        goto done;
+    }
+    mutex_ready = true;
+    fp = fopen(input_path, "rb");
+    if (fp == NULL) goto done;
+    // one thread per worker plus the writer, all of them run until the input ends
+    pool = thrdpool_create(pipeline->options.num_workers + 1, 0);
+    if (pool == NULL) goto done;
+
+    struct thrdpool_task task = { pipeline_worker, pipeline };
+    for (nlp_size_t i = 0; i < pipeline->options.num_workers; i++) {
+        if (thrdpool_schedule(&task, pool) < 0) break;
+        pipeline->num_workers++;
+    }
+    task.routine = pipeline_writer;
+    bool writer_scheduled = pipeline->num_workers > 0 && thrdpool_schedule(&task, pool) == 0;
+    if (!writer_scheduled) atomic_store(&pipeline->failed, true);
+
+    pipeline_read(pipeline, fp);
+    if (!writer_scheduled) {
+        // drain the workers on this thread
+        pipeline_writer(pipeline);
+    }
+    pthread_mutex_lock(&pipeline->mutex);
+    while (!pipeline->writer_done) pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    pthread_mutex_unlock(&pipeline->mutex);
+    ret = atomic_load(&pipeline->failed) ? -1 : 0;
+    if (stats != NULL) *stats = pipeline->stats;
+
+done:
+    if (pool != NULL) thrdpool_destroy(NULL, pool);
+    if (fp != NULL) fclose(fp);
+    if (pipeline->input != NULL) msgqueue_destroy(pipeline->input);
+    if (pipeline->output != NULL) msgqueue_destroy(pipeline->output);
+    if (mutex_ready) {
+        pthread_cond_destroy(&pipeline->cond);
+        pthread_mutex_destroy(&pipeline->mutex);
+    }
+    free(pipeline->end_batches);
+    free(pipeline->pending);
+    free(pipeline);
+    return ret;
+}
@@ -28,13 +28,13 @@ size_t readline(char **__restrict line, size_t *__restrict len, FILE *__restrict
 
     // "Empty" the string
     (*line)[0] = '\0';
+    size_t len_used = 0;
 
     while (fgets(chunk, sizeof(chunk), fp) != NULL) {
         // Resize the line buffer if necessary
-        size_t len_used = strlen(*line);
         size_t chunk_used = strlen(chunk);
 
-        if (*len - len_used < chunk_used) {
+        if (*len - len_used <= chunk_used) {
             // Check for overflow
             if (*len > SIZE_MAX / 2) {
                 errno = EOVERFLOW;
@@ -56,5 +56,45 @@ size_t readline(char **__restrict line, size_t *__restrict len, FILE *__restrict
         // Check if *line contains '\n', if yes, return the *line length
         if ((*line)[len_used - 1] == '\n') { return len_used; }
     }
+    // the last line may have no '\n'
+    if (len_used > 0) return len_used;
     return -1;
 }
+
+char *readfile(const char *__restrict path, size_t *__restrict len)
+{
+    if (path == NULL || len == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+
+    size_t cap = 4096;
+    size_t used = 0;
+    char *buffer = (char *)malloc(cap);
+    while (buffer != NULL) {
+        used += fread(buffer + used, 1, cap - used - 1, fp);
+        if (used < cap - 1) break;
+        // Check for overflow
+        if (cap > SIZE_MAX / 2) {
+            free(buffer);
+            buffer = NULL;
+            errno = EOVERFLOW;
+            break;
+        }
+        cap *= 2;
+        char *grown = (char *)realloc(buffer, cap);
+        if (grown == NULL) free(buffer);
+        buffer = grown;
+    }
+    if (buffer != NULL && ferror(fp)) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(fp);
+    if (buffer == NULL) return NULL;
+    buffer[used] = '\0';
+    *len = used;
+    return buffer;
+}
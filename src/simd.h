@@ -0,0 +1,24 @@
+#ifndef __SIMD_H
+#define __SIMD_H
+
+#include "common.h"
+
+/*
+    The SSE/AVX2 kernels of the text functions are compiled with a target
+    attribute rather than with the flags of the whole build, so a default
+    build has them too. They only run when the cpu reports AVX2, built with
+    -mavx2 or -march=native the check folds to true. Define LIBNLP_NO_SIMD
+    to leave them out and test the scalar code.
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_MSC_VER) && defined(__x86_64__) && !defined(LIBNLP_NO_SIMD)
+#include <immintrin.h>
+#define NLP_SIMD_AVX2 1
+#define NLP_TARGET_AVX2 __attribute__((target("avx2")))
+#if defined(__AVX2__)
+#define nlp_cpu_has_avx2() true
+#else
+#define nlp_cpu_has_avx2() (__builtin_cpu_supports("avx2") != 0)
+#endif
+#endif
+
+#endif
@@ -11,7 +11,9 @@
 
 #include "strutils.h"
 
+#include "char_class.h"
 #include "common.h"
+#include "simd.h"
 #include "utf8proc.h"
 
 #include <assert.h>
@@ -21,6 +23,38 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef NLP_SIMD_AVX2
+#define UTF8_SIMD_BLOCK 32
+#endif
+
+#ifdef UTF8_SIMD_BLOCK
+/* the few vector operations the utf-8 kernels need, on 32 bytes */
+typedef __m256i utf8_vec_t;
+#define utf8_vec_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define utf8_vec_store(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+#define utf8_vec_set1(c) _mm256_set1_epi8((char)(c))
+#define utf8_vec_table(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+#define utf8_vec_zero() _mm256_setzero_si256()
+#define utf8_vec_and(a, b) _mm256_and_si256(a, b)
+#define utf8_vec_or(a, b) _mm256_or_si256(a, b)
+#define utf8_vec_xor(a, b) _mm256_xor_si256(a, b)
+#define utf8_vec_subs(a, b) _mm256_subs_epu8(a, b)
+#define utf8_vec_lookup(table, index) _mm256_shuffle_epi8(table, index)
+#define utf8_vec_shr4(a) _mm256_and_si256(_mm256_srli_epi16(a, 4), _mm256_set1_epi8(0x0F))
+#define utf8_vec_movemask(a) ((nlp_uint32_t)_mm256_movemask_epi8(a))
+#define utf8_vec_is_zero(a) _mm256_testz_si256(a, a)
+#define utf8_vec_cmpgt(a, b) _mm256_cmpgt_epi8(a, b)
+#define utf8_vec_sub(a, b) _mm256_sub_epi8(a, b)
+// the block shifted right by n bytes with the last bytes of `prev` shifted in
+#define utf8_vec_prev(input, prev, n) _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - (n))
+/* sum of the unsigned bytes */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_vec_sum(utf8_vec_t a) {
+    __m256i sums = _mm256_sad_epu8(a, _mm256_setzero_si256());
+    return (nlp_size_t)(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2)
+                        + _mm256_extract_epi64(sums, 3));
+}
+#endif
+
 typedef enum casing_option { UTF8_LOWER, UTF8_UPPER } casing_option_t;
 
 char *utf8_case(const char *s, casing_option_t casing, utf8proc_option_t options) {
@@ -71,26 +105,11 @@ char *utf8_case(const char *s, casing_option_t casing, utf8proc_option_t options
 char *utf8str_upper(char *s) { return utf8_case(s, UTF8_UPPER, UTF8PROC_OPTIONS_NFC); }
 char *utf8str_lower(char *s) { return utf8_case(s, UTF8_LOWER, UTF8PROC_OPTIONS_NFC); }
 
-bool utf8str_is_whitespace_char(nlp_int32_t cp) {
-    const char *cat = utf8proc_category_string(cp);
-    if (cp == ' ' || cp == '\t' || cp == '\n' || cp == '\r') { return true; }
-    // Unicode中，每个字符都有Category的属性
-    return cat[0] == 'Z' && cat[1] == 's';
-};
+bool utf8str_is_whitespace_char(nlp_int32_t cp) { return (utf8_char_class(cp) & UTF8_CLASS_WHITESPACE) != 0; }
 
-bool utf8str_is_control_char(nlp_int32_t cp) {
-    const char *cat = utf8proc_category_string(cp);
-    if (cp == '\t' || cp == '\n' || cp == '\r') { return false; }
-    return 'C' == *cat;
-};
-bool utf8str_is_punctuation_char(nlp_int32_t cp) {
-    const char *cat = utf8proc_category_string(cp);
-    // ascii码中的标点符号
-    if ((cp >= 33 && cp <= 47) || (cp >= 58 && cp <= 64) || (cp >= 91 && cp <= 96) || (cp >= 123 && cp <= 126)) {
-        return true;
-    }
-    return 'P' == *cat;
-};
+bool utf8str_is_control_char(nlp_int32_t cp) { return (utf8_char_class(cp) & UTF8_CLASS_CONTROL) != 0; }
+
+bool utf8str_is_punctuation_char(nlp_int32_t cp) { return (utf8_char_class(cp) & UTF8_CLASS_PUNCTUATION) != 0; }
 
 bool utf8str_is_chinese_char(nlp_int32_t cp) {
     // This defines a "chinese character" as anything in the CJK Unicode block:
@@ -101,11 +120,241 @@ bool utf8str_is_chinese_char(nlp_int32_t cp) {
     // as is Japanese Hiragana and Katakana. Those alphabets are used to write
     // space-separated words, so they are not treated specially and handled
     // like the all of the other languages.
-    return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) || (cp >= 0x20000 && cp <= 0x2A6DF)
-           || (cp >= 0x2A700 && cp <= 0x2B73F) || (cp >= 0x2B740 && cp <= 0x2B81F) || (cp >= 0x2B820 && cp <= 0x2CEAF)
-           || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x2F800 && cp <= 0x2FA1F);
-};
+    return (utf8_char_class(cp) & UTF8_CLASS_CHINESE) != 0;
+}
+
+nlp_uint8_t utf8str_char_class(nlp_int32_t cp) { return utf8_char_class(cp); }
+
+nlp_size_t utf8str_classify(const nlp_uint8_t *str, nlp_size_t len, nlp_uint8_t *flags, nlp_size_t cap) {
+    // ascii bytes index the first block directly
+    const nlp_uint8_t *ascii = char_class_stage2[char_class_stage1[0]];
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+    while (i < len) {
+        nlp_uint8_t c = str[i];
+        nlp_uint8_t char_flags;
+        if (c < 0x80) {
+            char_flags = ascii[c];
+            i++;
+        } else {
+            nlp_int32_t cp;
+            nlp_ssize_t char_len = utf8proc_iterate(str + i, (nlp_ssize_t)(len - i), &cp);
+            if (char_len < 0) {
+                char_flags = UTF8_CLASS_INVALID;
+                i++;
+            } else {
+                char_flags = utf8_char_class(cp);
+                i += (nlp_size_t)char_len;
+            }
+        }
+        if (n < cap) flags[n] = char_flags;
+        n++;
+    }
+    return n;
+}
+
+/*
+    Length of the well-formed character at str[0] (table 3-7 of the unicode
+    standard), or minus the length of its maximal ill-formed subpart: the
+    longest prefix of a well-formed sequence, at least one byte.
+*/
+static inline nlp_ssize_t utf8_char_length(const nlp_uint8_t *str, nlp_size_t len) {
+    nlp_uint8_t c = str[0];
+    if (c < 0x80) return 1;
+    nlp_size_t n;
+    nlp_uint8_t lo = 0x80, hi = 0xBF;
+    if (c < 0xC2) {
+        return -1;
+    } else if (c < 0xE0) {
+        n = 2;
+    } else if (c < 0xF0) {
+        n = 3;
+        // overlong forms and surrogates
+        if (c == 0xE0) lo = 0xA0;
+        if (c == 0xED) hi = 0x9F;
+    } else if (c < 0xF5) {
+        n = 4;
+        // overlong forms and codepoints above 0x10FFFF
+        if (c == 0xF0) lo = 0x90;
+        if (c == 0xF4) hi = 0x8F;
+    } else {
+        return -1;
+    }
+    for (nlp_size_t k = 1; k < n; k++) {
+        if (k >= len || str[k] < lo || str[k] > hi) return -(nlp_ssize_t)k;
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return (nlp_ssize_t)n;
+}
+
+static nlp_size_t utf8_valid_prefix_scalar(const nlp_uint8_t *str, nlp_size_t len, nlp_size_t i) {
+    while (i < len) {
+        nlp_uint64_t word;
+        if (len - i >= sizeof(word)) {
+            memcpy(&word, str + i, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                i += sizeof(word);
+                continue;
+            }
+        }
+        if (str[i] < 0x80) {
+            i++;
+            continue;
+        }
+        nlp_ssize_t n = utf8_char_length(str + i, len - i);
+        if (n < 0) break;
+        i += (nlp_size_t)n;
+    }
+    return i;
+}
+
+#ifdef UTF8_SIMD_BLOCK
+/*
+    The lookup validation of simdutf / simdjson (Keiser and Lemire, "Validating
+    UTF-8 In Less Than One Instruction Per Byte"). Each byte is checked
+    against the one before it with three nibble lookups whose bits are the
+    errors the pair of bytes can be part of, a bit is an error if all three
+    lookups have it. The third and fourth bytes of a character are checked
+    against the lead two and three bytes back.
+*/
+#define UTF8_TOO_SHORT 0x01// a lead byte or ascii followed by a lead byte or ascii
+#define UTF8_TOO_LONG 0x02// ascii followed by a continuation
+#define UTF8_OVERLONG_3 0x04
+#define UTF8_TOO_LARGE 0x08
+#define UTF8_SURROGATE 0x10
+#define UTF8_OVERLONG_2 0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4 0x40
+#define UTF8_TWO_CONTS 0x80// two continuations, valid only as the third or fourth byte
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// clang-format off
+#define UTF8_BYTE_1_HIGH_TABLE                                                                            \
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,                                           \
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,                                           \
+    (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS,               \
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,                                                                     \
+    UTF8_TOO_SHORT,                                                                                       \
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,                                                    \
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+#define UTF8_BYTE_1_LOW_TABLE                                                                             \
+    (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),                              \
+    (char)(UTF8_CARRY | UTF8_OVERLONG_2),                                                                 \
+    (char)UTF8_CARRY,                                                                                     \
+    (char)UTF8_CARRY,                                                                                     \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE),                                                                  \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),                           \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),                                            \
+    (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000)
+#define UTF8_BYTE_2_HIGH_TABLE                                                                            \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,                                       \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,                                       \
+    (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000        \
+           | UTF8_OVERLONG_4),                                                                            \
+    (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),          \
+    (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),           \
+    (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),           \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+// clang-format on
+
+/* non-zero bytes where the block, preceded by `prev`, is not valid utf-8 */
+static inline NLP_TARGET_AVX2 utf8_vec_t utf8_check_block(utf8_vec_t input, utf8_vec_t prev) {
+    utf8_vec_t prev1 = utf8_vec_prev(input, prev, 1);
+    utf8_vec_t byte_1_high = utf8_vec_lookup(utf8_vec_table(UTF8_BYTE_1_HIGH_TABLE), utf8_vec_shr4(prev1));
+    utf8_vec_t byte_1_low =
+      utf8_vec_lookup(utf8_vec_table(UTF8_BYTE_1_LOW_TABLE), utf8_vec_and(prev1, utf8_vec_set1(0x0F)));
+    utf8_vec_t byte_2_high = utf8_vec_lookup(utf8_vec_table(UTF8_BYTE_2_HIGH_TABLE), utf8_vec_shr4(input));
+    utf8_vec_t special = utf8_vec_and(utf8_vec_and(byte_1_high, byte_1_low), byte_2_high);
+    // 0x80 where the byte must be the third or fourth byte of a character
+    utf8_vec_t third = utf8_vec_subs(utf8_vec_prev(input, prev, 2), utf8_vec_set1(0xE0 - 0x80));
+    utf8_vec_t fourth = utf8_vec_subs(utf8_vec_prev(input, prev, 3), utf8_vec_set1(0xF0 - 0x80));
+    utf8_vec_t must23 = utf8_vec_and(utf8_vec_or(third, fourth), utf8_vec_set1(0x80));
+    return utf8_vec_xor(must23, special);
+}
 
+/* non-zero bytes where a character starting in the last three bytes of the block is not complete */
+static inline NLP_TARGET_AVX2 utf8_vec_t utf8_incomplete_block(utf8_vec_t input) {
+    const utf8_vec_t max_value = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)0xEF, (char)0xDF, (char)0xBF);
+    return utf8_vec_subs(input, max_value);
+}
+
+/* the blocks from the start of str that are valid, less the character cut at their end */
+static NLP_TARGET_AVX2 nlp_size_t utf8_valid_prefix_avx2(const nlp_uint8_t *str, nlp_size_t len) {
+    nlp_size_t i = 0;
+    utf8_vec_t prev = utf8_vec_zero();
+    utf8_vec_t prev_incomplete = utf8_vec_zero();
+    while (len - i >= UTF8_SIMD_BLOCK) {
+        utf8_vec_t input = utf8_vec_load(str + i);
+        utf8_vec_t error;
+        if (utf8_vec_movemask(input) == 0) {
+            // an ascii block is valid unless it cuts short the character before it
+            error = prev_incomplete;
+        } else {
+            error = utf8_check_block(input, prev);
+            prev_incomplete = utf8_incomplete_block(input);
+            prev = input;
+        }
+        if (!utf8_vec_is_zero(error)) break;
+        i += UTF8_SIMD_BLOCK;
+    }
+    // the text before the character that ends at or after i is valid, the scalar
+    // path finds the error in the block at i or checks the tail
+    for (nlp_size_t k = 1; k <= 3 && k <= i; k++) {
+        if ((str[i - k] & 0xC0) != 0x80) {
+            if (str[i - k] >= 0xC0) i -= k;
+            break;
+        }
+    }
+    return i;
+}
+#endif
+
+nlp_size_t utf8str_valid_prefix(const nlp_uint8_t *str, nlp_size_t len) {
+    if (str == NULL) return 0;
+    nlp_size_t i = 0;
+#ifdef UTF8_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) i = utf8_valid_prefix_avx2(str, len);
+#endif
+    return utf8_valid_prefix_scalar(str, len, i);
+}
+
+bool utf8str_is_valid(const nlp_uint8_t *str, nlp_size_t len) { return utf8str_valid_prefix(str, len) == len; }
+
+nlp_size_t utf8str_repair(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap,
+  utf8_repair_mode_t mode) {
+    static const nlp_uint8_t replacement[] = { 0xEF, 0xBF, 0xBD };
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+    while (i < len) {
+        nlp_size_t valid = utf8str_valid_prefix(str + i, len - i);
+        // memmove, dropping can work in place
+        if (n < out_cap) memmove(out + n, str + i, valid < out_cap - n ? valid : out_cap - n);
+        n += valid;
+        i += valid;
+        if (i == len) break;
+        i += (nlp_size_t)-utf8_char_length(str + i, len - i);
+        if (mode == UTF8_REPAIR_REPLACE) {
+            for (nlp_size_t k = 0; k < sizeof(replacement); k++, n++) {
+                if (n < out_cap) out[n] = replacement[k];
+            }
+        }
+    }
+    if (n < out_cap) out[n] = '\0';
+    return n;
+}
 
 nlp_ssize_t utf8str_iterate(const nlp_uint8_t *str, nlp_ssize_t strlen, nlp_int32_t *dst)
 // https://juliastrings.github.io/utf8proc/doc/utf8proc_8h.html#a48041dd763513b314763f5b40fad50b0
@@ -133,35 +382,483 @@ nlp_ssize_t utf8proc_iterate_reversed(const nlp_uint8_t *str, nlp_ssize_t start,
     return return_len;
 }
 
+/* decode the character at str[0] to *cp, U+FFFD for an ill-formed sequence, return the bytes it takes */
+static inline nlp_size_t utf8_decode_char(const nlp_uint8_t *str, nlp_size_t len, nlp_int32_t *cp) {
+    nlp_uint8_t c = str[0];
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+    if (c >= 0xC2 && c < 0xE0 && len >= 2 && (str[1] & 0xC0) == 0x80) {
+        *cp = ((c & 0x1F) << 6) | (str[1] & 0x3F);
+        return 2;
+    }
+    nlp_ssize_t n = utf8_char_length(str, len);
+    switch (n) {
+    case 2:
+        *cp = ((c & 0x1F) << 6) | (str[1] & 0x3F);
+        break;
+    case 3:
+        *cp = ((c & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
+        break;
+    case 4:
+        *cp = ((c & 0x07) << 18) | ((str[1] & 0x3F) << 12) | ((str[2] & 0x3F) << 6) | (str[3] & 0x3F);
+        break;
+    default:
+        *cp = 0xFFFD;
+        return (nlp_size_t)-n;
+    }
+    return (nlp_size_t)n;
+}
 
-nlp_size_t utf8str_nlen(const nlp_uint8_t *str, nlp_size_t len) {
-    if (str == NULL) return -1;
+/* encode cp to out, which has room for 4 bytes, U+FFFD for a surrogate or what is not a codepoint */
+static inline nlp_size_t utf8_encode_char(nlp_int32_t cp, nlp_uint8_t *out) {
+    if ((nlp_uint32_t)cp < 0x80) {
+        out[0] = (nlp_uint8_t)cp;
+        return 1;
+    }
+    if (cp < 0 || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = 0xFFFD;
+    if (cp < 0x800) {
+        out[0] = (nlp_uint8_t)(0xC0 | (cp >> 6));
+        out[1] = (nlp_uint8_t)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (nlp_uint8_t)(0xE0 | (cp >> 12));
+        out[1] = (nlp_uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (nlp_uint8_t)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (nlp_uint8_t)(0xF0 | (cp >> 18));
+    out[1] = (nlp_uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (nlp_uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (nlp_uint8_t)(0x80 | (cp & 0x3F));
+    return 4;
+}
 
-    if (len == 0) return 0;
+#ifdef UTF8_SIMD_BLOCK
+/*
+    Transcoding kernels on 16 bytes or 16 codepoints. Each handles characters
+    of one length from the start of the block: it stores the whole block and
+    returns how many of its leading characters are that length and valid,
+    the caller moves on by as many. Runs of ascii, of a 2-byte script
+    (cyrillic, greek, arabic) or of CJK go through at a block per step and
+    a word of them at least at a word per step.
+*/
+
+/* 16 ascii bytes widened to codepoints, return the number of leading ascii bytes */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_decode_block_1(__m128i input, nlp_int32_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(input, zero);
+    __m128i hi = _mm_unpackhi_epi8(input, zero);
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(dst + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *)(dst + 12), _mm_unpackhi_epi16(hi, zero));
+    return (nlp_size_t)__builtin_ctz((nlp_uint32_t)_mm_movemask_epi8(input) | 0x10000);
+}
 
-    nlp_int32_t ch = 0;
-    nlp_ssize_t num_utf8_chars = 0;
-    nlp_ssize_t char_len;
+/* decode up to 8 characters of 2 bytes, return the number of leading ones */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_decode_block_2(__m128i input, nlp_int32_t *dst) {
+    // each 16-bit lane is one character, the lead in its low byte
+    const __m128i zero = _mm_setzero_si128();
+    __m128i shape = _mm_cmpeq_epi16(_mm_and_si128(input, _mm_set1_epi16((short)0xC0E0)), _mm_set1_epi16((short)0x80C0));
+    // leads C0 and C1 are overlong forms
+    __m128i overlong = _mm_cmpeq_epi16(_mm_and_si128(input, _mm_set1_epi16(0x1E)), zero);
+    __m128i cp = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(input, _mm_set1_epi16(0x1F)), 6),
+      _mm_and_si128(_mm_srli_epi16(input, 8), _mm_set1_epi16(0x3F)));
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(cp, zero));
+    _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(cp, zero));
+    nlp_uint32_t valid = (nlp_uint32_t)_mm_movemask_epi8(_mm_andnot_si128(overlong, shape));
+    return (nlp_size_t)__builtin_ctz(~valid) / 2;
+}
+
+/* decode up to 4 characters of 3 bytes from the first 12 bytes, return the number of leading ones */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_decode_block_3(__m128i input, nlp_int32_t *dst) {
+    // each character to a 32-bit lane as lead << 16 | second << 8 | third
+    const __m128i spread = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    __m128i v = _mm_shuffle_epi8(input, spread);
+    __m128i shape = _mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32(0xF0C0C0)), _mm_set1_epi32(0xE08080));
+    __m128i lead = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0x0F)), 12);
+    __m128i second = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0x3F)), 6);
+    __m128i cp = _mm_or_si128(_mm_or_si128(lead, second), _mm_and_si128(v, _mm_set1_epi32(0x3F)));
+    // overlong forms and surrogates
+    __m128i invalid = _mm_or_si128(_mm_cmplt_epi32(cp, _mm_set1_epi32(0x800)),
+      _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xF800)), _mm_set1_epi32(0xD800)));
+    _mm_storeu_si128((__m128i *)dst, cp);
+    nlp_uint32_t valid = (nlp_uint32_t)_mm_movemask_epi8(_mm_andnot_si128(invalid, shape));
+    return (nlp_size_t)__builtin_ctz(~valid) / 4;
+}
+
+/* all-ones lanes where lo <= cp <= hi */
+static inline NLP_TARGET_AVX2 __m128i utf8_codepoints_in(__m128i cp, nlp_int32_t lo, nlp_int32_t hi) {
+    return _mm_and_si128(_mm_cmpgt_epi32(cp, _mm_set1_epi32(lo - 1)), _mm_cmplt_epi32(cp, _mm_set1_epi32(hi + 1)));
+}
+
+/* number of leading all-ones lanes of 8 lane masks */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_leading_lanes(__m128i a, __m128i b) {
+    nlp_uint32_t mask = (nlp_uint32_t)_mm_movemask_epi8(_mm_packs_epi32(a, b));
+    return (nlp_size_t)__builtin_ctz(~mask) / 2;
+}
+
+/* encode 16 ascii codepoints to 16 bytes, return the number of leading ascii codepoints */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_encode_block_1(const nlp_int32_t *src, nlp_uint8_t *out) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 4));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 8));
+    __m128i d = _mm_loadu_si128((const __m128i *)(src + 12));
+    // the saturating packs keep ascii and turn everything else into other bytes
+    _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    nlp_size_t ascii = utf8_leading_lanes(utf8_codepoints_in(a, 0, 0x7F), utf8_codepoints_in(b, 0, 0x7F));
+    if (ascii < 8) return ascii;
+    return ascii + utf8_leading_lanes(utf8_codepoints_in(c, 0, 0x7F), utf8_codepoints_in(d, 0, 0x7F));
+}
+
+/* encode up to 8 codepoints of 2 bytes to 16 bytes, return the number of leading ones */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_encode_block_2(const nlp_int32_t *src, nlp_uint8_t *out) {
+    // lead in the low byte, continuation in the next one, then the two low bytes of each lane side by side
+    const __m128i pack = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i units[2];
+    __m128i valid[2];
+    for (int k = 0; k < 2; k++) {
+        __m128i cp = _mm_loadu_si128((const __m128i *)(src + 4 * k));
+        __m128i lead = _mm_or_si128(_mm_srli_epi32(cp, 6), _mm_set1_epi32(0xC0));
+        __m128i cont = _mm_slli_epi32(_mm_or_si128(_mm_and_si128(cp, _mm_set1_epi32(0x3F)), _mm_set1_epi32(0x80)), 8);
+        units[k] = _mm_shuffle_epi8(_mm_or_si128(lead, cont), pack);
+        valid[k] = utf8_codepoints_in(cp, 0x80, 0x7FF);
+    }
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi64(units[0], units[1]));
+    return utf8_leading_lanes(valid[0], valid[1]);
+}
+
+/* encode up to 4 codepoints of 3 bytes to the first 12 of 16 bytes, return the number of leading ones */
+static inline NLP_TARGET_AVX2 nlp_size_t utf8_encode_block_3(const nlp_int32_t *src, nlp_uint8_t *out) {
+    __m128i cp = _mm_loadu_si128((const __m128i *)src);
+    __m128i lead = _mm_or_si128(_mm_srli_epi32(cp, 12), _mm_set1_epi32(0xE0));
+    __m128i second = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(cp, 6), _mm_set1_epi32(0x3F)), _mm_set1_epi32(0x80));
+    __m128i third = _mm_or_si128(_mm_and_si128(cp, _mm_set1_epi32(0x3F)), _mm_set1_epi32(0x80));
+    __m128i bytes = _mm_or_si128(_mm_or_si128(lead, _mm_slli_epi32(second, 8)), _mm_slli_epi32(third, 16));
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(bytes, pack));
+    __m128i valid = _mm_andnot_si128(utf8_codepoints_in(cp, 0xD800, 0xDFFF), utf8_codepoints_in(cp, 0x800, 0xFFFF));
+    return (nlp_size_t)__builtin_ctz(~(nlp_uint32_t)_mm_movemask_epi8(valid)) / 4;
+}
+
+/* utf8str_decode a block at a time while 16 bytes and 16 codepoints fit, set *pos / *count to how far it got */
+static NLP_TARGET_AVX2 void utf8_decode_avx2(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_int32_t *dst,
+  nlp_size_t cap,
+  nlp_size_t *pos,
+  nlp_size_t *count) {
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+    // a step writes at most 16 codepoints, the lead byte picks the kernel. A full
+    // block moves on by a constant so the next load does not wait for the kernel.
+    while (len - i >= 16 && cap - n >= 16) {
+        nlp_uint8_t c = str[i];
+        nlp_size_t k = 0;
+        nlp_size_t width = 1;
+        if (c < 0x80) {
+            k = utf8_decode_block_1(_mm_loadu_si128((const __m128i *)(str + i)), dst + n);
+            if (k == 16) {
+                i += 16;
+                n += 16;
+                continue;
+            }
+        } else if ((c & 0xE0) == 0xC0) {
+            k = utf8_decode_block_2(_mm_loadu_si128((const __m128i *)(str + i)), dst + n);
+            if (k == 8) {
+                i += 16;
+                n += 8;
+                continue;
+            }
+            width = 2;
+        } else if ((c & 0xF0) == 0xE0) {
+            k = utf8_decode_block_3(_mm_loadu_si128((const __m128i *)(str + i)), dst + n);
+            if (k == 4) {
+                i += 12;
+                n += 4;
+                continue;
+            }
+            width = 3;
+        }
+        i += width * k;
+        n += k;
+        if (k == 0) i += utf8_decode_char(str + i, len - i, dst + n++);
+    }
+    *pos = i;
+    *count = n;
+}
+
+/* utf8str_encode a block at a time while 16 codepoints and 16 bytes fit, set *pos / *length to how far it got */
+static NLP_TARGET_AVX2 void utf8_encode_avx2(const nlp_int32_t *src,
+  nlp_size_t n,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap,
+  nlp_size_t *pos,
+  nlp_size_t *length) {
+    nlp_size_t len = 0;
+    nlp_size_t i = 0;
+    // a step writes at most 16 bytes, the first codepoint picks the kernel
+    while (n - i >= 16 && out_cap - len >= 16) {
+        nlp_int32_t cp = src[i];
+        nlp_size_t k = 0;
+        nlp_size_t width = 1;
+        if ((nlp_uint32_t)cp < 0x80 && (nlp_uint32_t)src[i + 1] < 0x80) {
+            // a lone ascii codepoint, like a space between words, is cheaper on its own
+            k = utf8_encode_block_1(src + i, out + len);
+            if (k == 16) {
+                i += 16;
+                len += 16;
+                continue;
+            }
+        } else if (cp >= 0x80 && cp < 0x800) {
+            k = utf8_encode_block_2(src + i, out + len);
+            if (k == 8) {
+                i += 8;
+                len += 16;
+                continue;
+            }
+            width = 2;
+        } else if (cp >= 0x800 && cp < 0x10000) {
+            k = utf8_encode_block_3(src + i, out + len);
+            if (k == 4) {
+                i += 4;
+                len += 12;
+                continue;
+            }
+            width = 3;
+        }
+        i += k;
+        len += width * k;
+        if (k == 0) len += utf8_encode_char(src[i++], out + len);
+    }
+    *pos = i;
+    *length = len;
+}
+#endif
+
+nlp_size_t utf8str_decode(const nlp_uint8_t *str, nlp_size_t len, nlp_int32_t *dst, nlp_size_t cap) {
+    if (str == NULL) return 0;
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+#ifdef UTF8_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) utf8_decode_avx2(str, len, dst, cap, &i, &n);
+#endif
+    while (i < len) {
+        nlp_int32_t cp;
+        i += utf8_decode_char(str + i, len - i, &cp);
+        if (n < cap) dst[n] = cp;
+        n++;
+    }
+    return n;
+}
+
+nlp_size_t utf8str_encode(const nlp_int32_t *src, nlp_size_t n, nlp_uint8_t *out, nlp_size_t out_cap) {
+    if (src == NULL) n = 0;
+    nlp_size_t len = 0;
+    nlp_size_t i = 0;
+#ifdef UTF8_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) utf8_encode_avx2(src, n, out, out_cap, &i, &len);
+#endif
+    for (; i < n; i++) {
+        if (len <= out_cap && out_cap - len >= MAX_UTF8_CHAR_SIZE) {
+            len += utf8_encode_char(src[i], out + len);
+            continue;
+        }
+        nlp_uint8_t bytes[MAX_UTF8_CHAR_SIZE];
+        nlp_size_t char_len = utf8_encode_char(src[i], bytes);
+        for (nlp_size_t k = 0; k < char_len; k++, len++) {
+            if (len < out_cap) out[len] = bytes[k];
+        }
+    }
+    if (len < out_cap) out[len] = '\0';
+    return len;
+}
+
+/* flip the case of the letters lo to hi of 8 ascii bytes */
+static inline nlp_uint64_t utf8_case_word(nlp_uint64_t word, nlp_uint8_t lo, nlp_uint8_t hi) {
+    // adding 0x80 - lo to an ascii byte sets its top bit from lo up and 0x7F - hi above hi, with no carry out
+    const nlp_uint64_t ones = 0x0101010101010101ULL;
+    nlp_uint64_t from_lo = word + ones * (nlp_uint8_t)(0x80 - lo);
+    nlp_uint64_t above_hi = word + ones * (nlp_uint8_t)(0x7F - hi);
+    return word ^ ((from_lo & ~above_hi & ones * 0x80) >> 2);
+}
+
+/* map the character at str[0] to out, which has room for 4 bytes, add its length to *n and return the bytes read */
+static inline nlp_size_t utf8_case_char(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t *n,
+  casing_option_t casing) {
+    nlp_int32_t cp;
+    nlp_size_t char_len = utf8_decode_char(str, len, &cp);
+    nlp_int32_t mapped = casing == UTF8_LOWER ? utf8_char_lower(cp) : utf8_char_upper(cp);
+    if (mapped != cp) {
+        *n += utf8_encode_char(mapped, out);
+        return char_len;
+    }
+    // uncased or ill-formed, copied forward so that out may trail str
+    for (nlp_size_t k = 0; k < char_len; k++) out[k] = str[k];
+    *n += char_len;
+    return char_len;
+}
+
+#ifdef UTF8_SIMD_BLOCK
+/* utf8_case_into a block at a time while a block fits, set *pos / *count to how far it got */
+static NLP_TARGET_AVX2 void utf8_case_avx2(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap,
+  casing_option_t casing,
+  nlp_size_t *pos,
+  nlp_size_t *count) {
+    nlp_uint8_t lo = casing == UTF8_LOWER ? 'A' : 'a';
+    nlp_uint8_t hi = casing == UTF8_LOWER ? 'Z' : 'z';
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+    // bytes from 0x80 are negative, never between lo and hi
+    const utf8_vec_t below = utf8_vec_set1(lo - 1);
+    const utf8_vec_t above = utf8_vec_set1(hi + 1);
+    const utf8_vec_t flip = utf8_vec_set1(0x20);
+    while (len - i >= UTF8_SIMD_BLOCK && out_cap - n >= UTF8_SIMD_BLOCK) {
+        if (str[i] >= 0x80) {
+            i += utf8_case_char(str + i, len - i, out + n, &n, casing);
+            continue;
+        }
+        utf8_vec_t input = utf8_vec_load(str + i);
+        utf8_vec_t letters = utf8_vec_and(utf8_vec_cmpgt(input, below), utf8_vec_cmpgt(above, input));
+        utf8_vec_t mapped = utf8_vec_xor(input, utf8_vec_and(letters, flip));
+        nlp_uint32_t non_ascii = utf8_vec_movemask(input);
+        if (non_ascii == 0) {
+            utf8_vec_store(out + n, mapped);
+            i += UTF8_SIMD_BLOCK;
+            n += UTF8_SIMD_BLOCK;
+            continue;
+        }
+        nlp_size_t k = (nlp_size_t)__builtin_ctz(non_ascii);
+        if (out != str || n == i) {
+            utf8_vec_store(out + n, mapped);
+        } else {
+            // in place behind the input, the block past the ascii prefix is not read yet
+            nlp_uint8_t block[UTF8_SIMD_BLOCK];
+            utf8_vec_store(block, mapped);
+            memcpy(out + n, block, k);
+        }
+        i += k;
+        n += k;
+    }
+    *pos = i;
+    *count = n;
+}
+#endif
+
+/*
+    Case mapping without the NUL. Ascii letters flip their 0x20 bit a block
+    or a word at a time, other characters go through the case tables.
+    `out` may be `str` when no character gets longer.
+*/
+static nlp_size_t utf8_case_into(const nlp_uint8_t *str,
+  nlp_size_t len,
+  nlp_uint8_t *out,
+  nlp_size_t out_cap,
+  casing_option_t casing) {
+    nlp_uint8_t lo = casing == UTF8_LOWER ? 'A' : 'a';
+    nlp_uint8_t hi = casing == UTF8_LOWER ? 'Z' : 'z';
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+#ifdef UTF8_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) utf8_case_avx2(str, len, out, out_cap, casing, &i, &n);
+#endif
+    while (i < len) {
+        nlp_uint64_t word;
+        if (len - i >= sizeof(word) && n <= out_cap && out_cap - n >= sizeof(word)) {
+            memcpy(&word, str + i, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                word = utf8_case_word(word, lo, hi);
+                memcpy(out + n, &word, sizeof(word));
+                i += sizeof(word);
+                n += sizeof(word);
+                continue;
+            }
+        }
+        if (n <= out_cap && out_cap - n >= MAX_UTF8_CHAR_SIZE) {
+            i += utf8_case_char(str + i, len - i, out + n, &n, casing);
+            continue;
+        }
+        nlp_uint8_t bytes[MAX_UTF8_CHAR_SIZE];
+        nlp_size_t char_len = 0;
+        i += utf8_case_char(str + i, len - i, bytes, &char_len, casing);
+        for (nlp_size_t k = 0; k < char_len; k++, n++) {
+            if (n < out_cap) out[n] = bytes[k];
+        }
+    }
+    return n;
+}
 
-    const nlp_uint8_t *ptr = str;
+nlp_size_t utf8str_lower_into(const nlp_uint8_t *str, nlp_size_t len, nlp_uint8_t *out, nlp_size_t out_cap) {
+    if (str == NULL) len = 0;
+    nlp_size_t n = utf8_case_into(str, len, out, out_cap, UTF8_LOWER);
+    if (n < out_cap) out[n] = '\0';
+    return n;
+}
 
-    nlp_size_t remaining = len;
+nlp_size_t utf8str_upper_into(const nlp_uint8_t *str, nlp_size_t len, nlp_uint8_t *out, nlp_size_t out_cap) {
+    if (str == NULL) len = 0;
+    nlp_size_t n = utf8_case_into(str, len, out, out_cap, UTF8_UPPER);
+    if (n < out_cap) out[n] = '\0';
+    return n;
+}
+
+nlp_ssize_t utf8str_lower_inplace(nlp_uint8_t *str, nlp_size_t len) {
+    if (str == NULL) return 0;
+    // U+023A and U+023E (C8 BA, C8 BE) are the only characters whose lowercase is longer
+    for (const nlp_uint8_t *p = memchr(str, 0xC8, len); p != NULL; p = memchr(p + 1, 0xC8, len - (p + 1 - str))) {
+        if (p + 1 < str + len && (p[1] == 0xBA || p[1] == 0xBE)) return -1;
+    }
+    return (nlp_ssize_t)utf8_case_into(str, len, str, len, UTF8_LOWER);
+}
 
-    // 没有'\0'死循环
-    while (1) {
-        char_len = utf8proc_iterate(ptr, -1, &ch);
-        if (ch == 0) break;
-        if (char_len < 0) { return char_len; };
 
-        remaining -= char_len;
-        if (remaining == 0) break;
-        ptr += char_len;
-        num_utf8_chars++;
+#ifdef UTF8_SIMD_BLOCK
+/* characters in the whole blocks from the start of str, set *pos to the end of the last one */
+static NLP_TARGET_AVX2 nlp_size_t utf8_nlen_avx2(const nlp_uint8_t *str, nlp_size_t len, nlp_size_t *pos) {
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+    const utf8_vec_t continuation_max = utf8_vec_set1(0xBF);
+    while (len - i >= UTF8_SIMD_BLOCK) {
+        // the byte counters of the compare masks (-1 per character) can take 255 blocks
+        utf8_vec_t counts = utf8_vec_zero();
+        nlp_size_t blocks = (len - i) / UTF8_SIMD_BLOCK;
+        if (blocks > 255) blocks = 255;
+        for (nlp_size_t k = 0; k < blocks; k++, i += UTF8_SIMD_BLOCK) {
+            utf8_vec_t input = utf8_vec_load(str + i);
+            counts = utf8_vec_sub(counts, utf8_vec_cmpgt(input, continuation_max));
+        }
+        n += utf8_vec_sum(counts);
     }
+    *pos = i;
+    return n;
+}
+#endif
 
-    return num_utf8_chars;
+nlp_size_t utf8str_nlen(const nlp_uint8_t *str, nlp_size_t len) {
+    if (str == NULL) return 0;
+    // every character has exactly one byte that is not a continuation byte 10xxxxxx,
+    // as a signed byte a continuation is -128 to -65
+    nlp_size_t n = 0;
+    nlp_size_t i = 0;
+#ifdef UTF8_SIMD_BLOCK
+    if (nlp_cpu_has_avx2()) n = utf8_nlen_avx2(str, len, &i);
+#endif
+    for (; i < len; i++) n += (str[i] & 0xC0) != 0x80;
+    return n;
+}
+nlp_size_t utf8str_len(const nlp_uint8_t *str) {
+    if (str == NULL) return 0;
+    return utf8str_nlen(str, strlen((const char *)str));
 }
-nlp_size_t utf8str_len(const nlp_uint8_t *str) { return utf8str_nlen(str, SIZE_MAX); }
 
 nlp_uint8_t *utf8str_chr(const nlp_uint8_t *str, nlp_int32_t ch) {
     // reference： GNU libunistring
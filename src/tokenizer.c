@@ -9,55 +9,1904 @@
  */
 #include "tokenizer.h"
 
-#include "map.h"
-#include "readutils.h"
+#include "aho_corasick.h"
+#include "basic_tokenizer.h"
+#include "bert_vocab.h"
 #include "strutils.h"
+#include "thrdpool.h"
+#include "word_cache.h"
+#include "wordpiece.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-struct basic_tokenizer
+#if defined(_WIN32) && defined(_MSC_VER)
+#include "win/pthread.h"
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#define BERT_CLS_TOKEN "[CLS]"
+#define BERT_SEP_TOKEN "[SEP]"
+#define BERT_PAD_TOKEN "[PAD]"
+#define BERT_MASK_TOKEN "[MASK]"
+#define BERT_DEFAULT_MAX_LENGTH 512
+// normalized text up to this size is kept on the stack
+#define BERT_SCRATCH_INLINE_SIZE 512
+// encoding with a cap on the tokens normalizes about this many bytes at a time
+#define BERT_CHUNK_SIZE 4096
+// a stream encodes at most about this many bytes at a time, and reads files in blocks of this size
+#define BERT_STREAM_SEGMENT_SIZE 16384
+
+typedef struct bert_special_token
+{
+    char *token;
+    nlp_size_t len;
+    nlp_int32_t id;
+    // added by nlp_bert_tokenizer_add_special_tokens, kept when the vocab is swapped
+    bool user;
+} bert_special_token_t;
+
+/*
+    Everything that depends on the vocab. Encodes take a reference on the
+    model for the whole call, so a model replaced by a swap is only freed
+    when the last encode using it is done.
+*/
+typedef struct bert_model
 {
+    atomic_int refs;
+    basic_tokenizer_t basic;
+    bert_vocab_t *vocab;
+    // NULL if words are not cached
+    word_cache_t *cache;
+    nlp_int32_t cls_id;
+    nlp_int32_t sep_id;
+    nlp_int32_t pad_id;
+    // special tokens are split off the raw text with one pass of the automaton before normalization
+    bert_special_token_t *specials;
+    nlp_size_t num_specials;
+    nlp_size_t max_special_len;
+    aho_corasick_t special_matcher;
+    // special tokens not in the vocab, added[i] has id vocab->size + i
+    const char **added;
+    nlp_size_t num_added;
+} bert_model_t;
+
+struct bert_tokenizer
+{
+    _Atomic(bert_model_t *) model;
+    /*
+        An encode counts itself in readers[epoch & 1] from before it loads
+        the model pointer until it holds a reference. A swap publishes the
+        new model, moves the epoch on and waits for the old counter to drain,
+        after that no encode can still take a reference on the old model.
+    */
+    atomic_uint epoch;
+    atomic_size_t readers[2];
+    // serializes swaps, encodes never take it
+    pthread_mutex_t swap_mutex;
     bool do_lower_case;
+    nlp_size_t cache_capacity;
+    nlp_cache_policy_t cache_policy;
 };
 
-basic_tokenizer_t *nlp_basic_tokenizer_create(bool do_lower_case) {
-    basic_tokenizer_t *tokenizer;
-    tokenizer = (basic_tokenizer_t *)malloc(sizeof(basic_tokenizer_t));
+static const char *bert_default_special_tokens[] = { BERT_PAD_TOKEN, BERT_UNK_TOKEN, BERT_CLS_TOKEN, BERT_SEP_TOKEN,
+    BERT_MASK_TOKEN };
+
+static void bert_model_free(bert_model_t *model) {
+    word_cache_destroy(model->cache);
+    bert_vocab_destroy(model->vocab);
+    for (nlp_size_t i = 0; i < model->num_specials; i++) free(model->specials[i].token);
+    free(model->specials);
+    free(model->added);
+    aho_corasick_free(&model->special_matcher);
+    free(model);
+}
+
+static void bert_model_release(bert_model_t *model) {
+    if (atomic_fetch_sub(&model->refs, 1) == 1) bert_model_free(model);
+}
+
+/* the current model with a reference taken, without locking anything */
+static bert_model_t *bert_model_acquire(const bert_tokenizer_t *tokenizer) {
+    // the epoch counters are the only state a reader writes
+    bert_tokenizer_t *shared = (bert_tokenizer_t *)tokenizer;
+    for (;;) {
+        unsigned int epoch = atomic_load(&shared->epoch);
+        atomic_size_t *readers = &shared->readers[epoch & 1];
+        atomic_fetch_add(readers, 1);
+        // a swap that already waited for this counter may have freed any model loaded now, start over
+        if (atomic_load(&shared->epoch) != epoch) {
+            atomic_fetch_sub(readers, 1);
+            continue;
+        }
+        bert_model_t *model = atomic_load(&shared->model);
+        atomic_fetch_add(&model->refs, 1);
+        atomic_fetch_sub(readers, 1);
+        return model;
+    }
+}
+
+static int bert_model_add_special_tokens(bert_model_t *model,
+  const char *const *tokens,
+  nlp_size_t num_tokens,
+  bool user) {
+    for (nlp_size_t i = 0; i < num_tokens; i++) {
+        if (tokens[i] == NULL || tokens[i][0] == '\0') return -1;
+    }
+    nlp_size_t cap = model->num_specials + num_tokens;
+    bert_special_token_t *specials = (bert_special_token_t *)malloc(sizeof(bert_special_token_t) * (cap > 0 ? cap : 1));
+    const char **added = (const char **)malloc(sizeof(const char *) * (model->num_added + num_tokens + 1));
+    if (specials == NULL || added == NULL) {
+        free(specials);
+        free(added);
+        return -1;
+    }
+    if (model->num_specials > 0)
+        memcpy(specials, model->specials, sizeof(bert_special_token_t) * model->num_specials);
+    if (model->num_added > 0) memcpy(added, model->added, sizeof(const char *) * model->num_added);
+    nlp_size_t num_specials = model->num_specials;
+    nlp_size_t num_added = model->num_added;
+
+    bool ok = true;
+    for (nlp_size_t i = 0; i < num_tokens && ok; i++) {
+        nlp_size_t len = strlen(tokens[i]);
+        bool known = false;
+        for (nlp_size_t j = 0; j < num_specials && !known; j++)
+            known = specials[j].len == len && memcmp(specials[j].token, tokens[i], len) == 0;
+        if (known) continue;
+        char *token = (char *)malloc(len + 1);
+        if (token == NULL) {
+            ok = false;
+            break;
+        }
+        memcpy(token, tokens[i], len + 1);
+        nlp_int32_t id = bert_vocab_token_to_id(model->vocab, token, len);
+        if (id < 0) {
+            id = (nlp_int32_t)(model->vocab->size + num_added);
+            added[num_added++] = token;
+        }
+        specials[num_specials].token = token;
+        specials[num_specials].len = len;
+        specials[num_specials].id = id;
+        specials[num_specials].user = user;
+        num_specials++;
+    }
+
+    aho_corasick_t matcher;
+    const nlp_uint8_t **patterns = (const nlp_uint8_t **)malloc(sizeof(nlp_uint8_t *) * (num_specials + 1));
+    nlp_size_t *lens = (nlp_size_t *)malloc(sizeof(nlp_size_t) * (num_specials + 1));
+    nlp_int32_t *ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * (num_specials + 1));
+    ok = ok && patterns != NULL && lens != NULL && ids != NULL;
+    if (ok) {
+        for (nlp_size_t i = 0; i < num_specials; i++) {
+            patterns[i] = (const nlp_uint8_t *)specials[i].token;
+            lens[i] = specials[i].len;
+            ids[i] = specials[i].id;
+        }
+        ok = aho_corasick_build(&matcher, patterns, lens, ids, num_specials) == 0;
+    }
+    free(patterns);
+    free(lens);
+    free(ids);
+    if (!ok) {
+        for (nlp_size_t i = model->num_specials; i < num_specials; i++) free(specials[i].token);
+        free(specials);
+        free(added);
+        return -1;
+    }
+    aho_corasick_free(&model->special_matcher);
+    model->special_matcher = matcher;
+    free(model->specials);
+    free(model->added);
+    model->specials = specials;
+    model->num_specials = num_specials;
+    for (nlp_size_t i = 0; i < num_specials; i++) {
+        if (specials[i].len > model->max_special_len) model->max_special_len = specials[i].len;
+    }
+    model->added = added;
+    model->num_added = num_added;
+    return 0;
+}
+
+/*
+    A model for `vocab` configured like `prev`: its user special tokens are
+    added again and it gets an empty cache of the same size. Takes ownership
+    of the vocab, return NULL if failed.
+*/
+static bert_model_t *bert_model_new(const bert_tokenizer_t *tokenizer, bert_vocab_t *vocab, const bert_model_t *prev) {
+    bert_model_t *model;
+    if (vocab == NULL) return NULL;
+    model = (bert_model_t *)calloc(1, sizeof(bert_model_t));
+    if (model == NULL) {
+        bert_vocab_destroy(vocab);
+        return NULL;
+    }
+    atomic_init(&model->refs, 1);
+    model->special_matcher.first_byte = -1;
+    basic_tokenizer_init(&model->basic, tokenizer->do_lower_case, true, tokenizer->do_lower_case);
+    model->vocab = vocab;
+    model->cls_id = bert_vocab_token_to_id(vocab, BERT_CLS_TOKEN, sizeof(BERT_CLS_TOKEN) - 1);
+    model->sep_id = bert_vocab_token_to_id(vocab, BERT_SEP_TOKEN, sizeof(BERT_SEP_TOKEN) - 1);
+    model->pad_id = bert_vocab_token_to_id(vocab, BERT_PAD_TOKEN, sizeof(BERT_PAD_TOKEN) - 1);
+    if (model->pad_id < 0) model->pad_id = 0;
+    // the special tokens of the vocab are never split, like in the reference tokenizer
+    const char *tokens[sizeof(bert_default_special_tokens) / sizeof(bert_default_special_tokens[0])];
+    nlp_size_t num_tokens = 0;
+    for (nlp_size_t i = 0; i < sizeof(bert_default_special_tokens) / sizeof(bert_default_special_tokens[0]); i++) {
+        const char *token = bert_default_special_tokens[i];
+        if (bert_vocab_token_to_id(vocab, token, strlen(token)) >= 0) tokens[num_tokens++] = token;
+    }
+    bool ok = bert_model_add_special_tokens(model, tokens, num_tokens, false) == 0;
+    if (ok && prev != NULL) {
+        const char **user = (const char **)malloc(sizeof(const char *) * (prev->num_specials + 1));
+        nlp_size_t num_user = 0;
+        for (nlp_size_t i = 0; user != NULL && i < prev->num_specials; i++) {
+            if (prev->specials[i].user) user[num_user++] = prev->specials[i].token;
+        }
+        ok = user != NULL && bert_model_add_special_tokens(model, user, num_user, true) == 0;
+        free(user);
+    }
+    if (ok && tokenizer->cache_capacity > 0)
+        ok = (model->cache = word_cache_create(tokenizer->cache_capacity, tokenizer->cache_policy)) != NULL;
+    if (!ok) {
+        bert_model_free(model);
+        return NULL;
+    }
+    return model;
+}
+
+static bert_tokenizer_t *bert_tokenizer_new(bert_vocab_t *vocab, bool do_lower_case) {
+    bert_tokenizer_t *tokenizer;
+    if (vocab == NULL) return NULL;
+    tokenizer = (bert_tokenizer_t *)calloc(1, sizeof(bert_tokenizer_t));
+    if (tokenizer == NULL) {
+        bert_vocab_destroy(vocab);
+        return NULL;
+    }
     tokenizer->do_lower_case = do_lower_case;
+    tokenizer->cache_policy = NLP_CACHE_LRU;
+    bert_model_t *model = bert_model_new(tokenizer, vocab, NULL);
+    if (model == NULL || pthread_mutex_init(&tokenizer->swap_mutex, NULL) != 0) {
+        if (model != NULL) bert_model_free(model);
+        free(tokenizer);
+        return NULL;
+    }
+    atomic_init(&tokenizer->model, model);
+    atomic_init(&tokenizer->epoch, 0);
+    atomic_init(&tokenizer->readers[0], 0);
+    atomic_init(&tokenizer->readers[1], 0);
     return tokenizer;
 }
 
-struct bert_tokenizer
+bert_tokenizer_t *nlp_bert_tokenizer_create(const char *vocab_path, bool do_lower_case) {
+    return bert_tokenizer_new(bert_vocab_load_text(vocab_path), do_lower_case);
+}
+
+bert_tokenizer_t *nlp_bert_tokenizer_create_from_binary(const char *binary_path, bool do_lower_case) {
+    return bert_tokenizer_new(bert_vocab_load_binary(binary_path), do_lower_case);
+}
+
+int nlp_bert_vocab_compile(const char *vocab_path, const char *binary_path) {
+    bert_vocab_t *vocab = bert_vocab_load_text(vocab_path);
+    if (vocab == NULL) return -1;
+    int ret = bert_vocab_save_binary(vocab, binary_path);
+    bert_vocab_destroy(vocab);
+    return ret;
+}
+
+void nlp_bert_tokenizer_destory(bert_tokenizer_t *tokenizer) {
+    if (tokenizer == NULL) return;
+    bert_model_release(atomic_load(&tokenizer->model));
+    pthread_mutex_destroy(&tokenizer->swap_mutex);
+    free(tokenizer);
+}
+
+/*
+    Make `model` the current one, called with the swap mutex held. Return
+    the old model, which the caller releases after unlocking so it is freed
+    once the encodes using it are done.
+*/
+static bert_model_t *bert_tokenizer_publish(bert_tokenizer_t *tokenizer, bert_model_t *model) {
+    bert_model_t *old = atomic_load(&tokenizer->model);
+    atomic_store(&tokenizer->model, model);
+    unsigned int epoch = atomic_fetch_add(&tokenizer->epoch, 1);
+    // readers that may have loaded the old pointer are in the window of a few instructions, yielding is enough
+    while (atomic_load(&tokenizer->readers[epoch & 1]) > 0) sched_yield();
+    return old;
+}
+
+/* publish a model built from `vocab` */
+static int bert_tokenizer_swap(bert_tokenizer_t *tokenizer, bert_vocab_t *vocab) {
+    if (tokenizer == NULL) {
+        bert_vocab_destroy(vocab);
+        return -1;
+    }
+    pthread_mutex_lock(&tokenizer->swap_mutex);
+    bert_model_t *model = bert_model_new(tokenizer, vocab, atomic_load(&tokenizer->model));
+    if (model == NULL) {
+        pthread_mutex_unlock(&tokenizer->swap_mutex);
+        return -1;
+    }
+    bert_model_t *old = bert_tokenizer_publish(tokenizer, model);
+    pthread_mutex_unlock(&tokenizer->swap_mutex);
+    bert_model_release(old);
+    return 0;
+}
+
+int nlp_bert_tokenizer_swap_vocab(bert_tokenizer_t *tokenizer, const char *vocab_path) {
+    if (tokenizer == NULL) return -1;
+    return bert_tokenizer_swap(tokenizer, bert_vocab_load_text(vocab_path));
+}
+
+int nlp_bert_tokenizer_swap_binary_vocab(bert_tokenizer_t *tokenizer, const char *binary_path) {
+    if (tokenizer == NULL) return -1;
+    return bert_tokenizer_swap(tokenizer, bert_vocab_load_binary(binary_path));
+}
+
+nlp_size_t nlp_bert_tokenizer_vocab_size(const bert_tokenizer_t *tokenizer) {
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    nlp_size_t size = model->vocab->size + model->num_added;
+    bert_model_release(model);
+    return size;
+}
+
+nlp_int32_t nlp_bert_tokenizer_token_to_id(const bert_tokenizer_t *tokenizer, const char *token, nlp_size_t len) {
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    nlp_int32_t id = bert_vocab_token_to_id(model->vocab, token, len);
+    for (nlp_size_t i = 0; id < 0 && i < model->num_added; i++) {
+        if (strlen(model->added[i]) == len && memcmp(model->added[i], token, len) == 0)
+            id = (nlp_int32_t)(model->vocab->size + i);
+    }
+    bert_model_release(model);
+    return id;
+}
+
+const char *nlp_bert_tokenizer_id_to_token(const bert_tokenizer_t *tokenizer, nlp_int32_t id) {
+    // the string belongs to the model, which the tokenizer keeps until the next swap
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    nlp_size_t vocab_size = model->vocab->size;
+    const char *token;
+    if (id >= 0 && (nlp_size_t)id >= vocab_size && (nlp_size_t)id - vocab_size < model->num_added)
+        token = model->added[id - vocab_size];
+    else
+        token = bert_vocab_id_to_token(model->vocab, id);
+    bert_model_release(model);
+    return token;
+}
+
+int nlp_bert_tokenizer_add_special_tokens(bert_tokenizer_t *tokenizer,
+  const char *const *tokens,
+  nlp_size_t num_tokens) {
+    if (tokenizer == NULL || (tokens == NULL && num_tokens > 0)) return -1;
+    pthread_mutex_lock(&tokenizer->swap_mutex);
+    // encodes may be reading the current model, the tokens go to a copy of it sharing the vocab
+    bert_model_t *old = atomic_load(&tokenizer->model);
+    bert_vocab_retain(old->vocab);
+    bert_model_t *model = bert_model_new(tokenizer, old->vocab, old);
+    if (model == NULL || bert_model_add_special_tokens(model, tokens, num_tokens, true) != 0) {
+        pthread_mutex_unlock(&tokenizer->swap_mutex);
+        if (model != NULL) bert_model_release(model);
+        return -1;
+    }
+    old = bert_tokenizer_publish(tokenizer, model);
+    pthread_mutex_unlock(&tokenizer->swap_mutex);
+    bert_model_release(old);
+    return 0;
+}
+
+int nlp_bert_tokenizer_set_cache(bert_tokenizer_t *tokenizer, nlp_size_t capacity, nlp_cache_policy_t policy) {
+    if (tokenizer == NULL || (policy != NLP_CACHE_LRU && policy != NLP_CACHE_FIFO)) return -1;
+    pthread_mutex_lock(&tokenizer->swap_mutex);
+    // a model built from now on, for this vocab or a swapped in one, gets a cache with these settings
+    nlp_size_t old_capacity = tokenizer->cache_capacity;
+    nlp_cache_policy_t old_policy = tokenizer->cache_policy;
+    tokenizer->cache_capacity = capacity;
+    tokenizer->cache_policy = policy;
+    bert_model_t *old = atomic_load(&tokenizer->model);
+    bert_vocab_retain(old->vocab);
+    bert_model_t *model = bert_model_new(tokenizer, old->vocab, old);
+    if (model == NULL) {
+        tokenizer->cache_capacity = old_capacity;
+        tokenizer->cache_policy = old_policy;
+        pthread_mutex_unlock(&tokenizer->swap_mutex);
+        return -1;
+    }
+    old = bert_tokenizer_publish(tokenizer, model);
+    pthread_mutex_unlock(&tokenizer->swap_mutex);
+    bert_model_release(old);
+    return 0;
+}
+
+void nlp_bert_tokenizer_cache_stats(const bert_tokenizer_t *tokenizer, nlp_cache_stats_t *stats) {
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    if (model->cache == NULL)
+        memset(stats, 0, sizeof(nlp_cache_stats_t));
+    else
+        word_cache_stats(model->cache, stats);
+    bert_model_release(model);
+}
+
+/* where encoded tokens go, either plain ids or spans */
+typedef struct bert_output
 {
-    bool do_lower_case;
+    nlp_int32_t *ids;
+    nlp_token_span_t *spans;
+    nlp_size_t cap;
+    nlp_size_t n;
+    // input position of the text being encoded, spans are relative to the whole input
+    nlp_size_t base;
+} bert_output_t;
+
+/*
+    Normalized text and, for spans, the input position of every normalized
+    byte. Small texts use the inline buffers, larger ones grow a heap buffer
+    that is kept for the next call when the scratch is reused.
+*/
+typedef struct bert_scratch
+{
+    nlp_uint8_t *text;
+    nlp_size_t *offsets;
+    nlp_size_t text_cap;
+    nlp_size_t offsets_cap;
+    nlp_uint8_t inline_text[BERT_SCRATCH_INLINE_SIZE];
+    nlp_size_t inline_offsets[BERT_SCRATCH_INLINE_SIZE];
+} bert_scratch_t;
+
+static void bert_scratch_init(bert_scratch_t *scratch) {
+    scratch->text = scratch->inline_text;
+    scratch->offsets = scratch->inline_offsets;
+    scratch->text_cap = BERT_SCRATCH_INLINE_SIZE;
+    scratch->offsets_cap = BERT_SCRATCH_INLINE_SIZE;
+}
+
+static void bert_scratch_free(bert_scratch_t *scratch) {
+    if (scratch->text != scratch->inline_text) free(scratch->text);
+    if (scratch->offsets != scratch->inline_offsets) free(scratch->offsets);
+    bert_scratch_init(scratch);
+}
+
+static bool bert_scratch_reserve(bert_scratch_t *scratch, nlp_size_t size, bool with_offsets) {
+    if (scratch->text_cap < size) {
+        nlp_uint8_t *text = (nlp_uint8_t *)malloc(size);
+        if (text == NULL) return false;
+        if (scratch->text != scratch->inline_text) free(scratch->text);
+        scratch->text = text;
+        scratch->text_cap = size;
+    }
+    if (with_offsets && scratch->offsets_cap < size) {
+        nlp_size_t *offsets = (nlp_size_t *)malloc(sizeof(nlp_size_t) * size);
+        if (offsets == NULL) return false;
+        if (scratch->offsets != scratch->inline_offsets) free(scratch->offsets);
+        scratch->offsets = offsets;
+        scratch->offsets_cap = size;
+    }
+    return true;
+}
+
+/* wordpiece_encode_word going through the CJK table and the word cache if there is one */
+static inline nlp_size_t bert_encode_word(const bert_model_t *model,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t cap) {
+    if (model->vocab->cjk_ids != NULL) {
+        nlp_int32_t id = bert_vocab_cjk_id(model->vocab, word, len);
+        if (id >= 0) {
+            if (cap > 0) ids[0] = id;
+            return 1;
+        }
+    }
+    if (model->cache == NULL || len > WORD_CACHE_MAX_WORD_LEN)
+        return wordpiece_encode_word(model->vocab->wordpiece, word, len, ids, cap);
+    nlp_uint64_t hash = word_cache_hash(word, len);
+    nlp_ssize_t cached = word_cache_get(model->cache, hash, word, len, ids, cap);
+    if (cached >= 0) return (nlp_size_t)cached;
+    nlp_size_t n = wordpiece_encode_word(model->vocab->wordpiece, word, len, ids, cap);
+    // a truncated result can not be cached
+    if (n <= cap) word_cache_put(model->cache, hash, word, len, ids, n);
+    return n;
+}
+
+/* run wordpiece on one normalized word and append its tokens */
+static void bert_flush_word(const bert_model_t *model,
+  const nlp_uint8_t *input,
+  const nlp_uint8_t *word,
+  const nlp_size_t *offsets,
+  nlp_size_t len,
+  bert_output_t *out) {
+    const wordpiece_t *wp = model->vocab->wordpiece;
+    if (out->spans == NULL) {
+        nlp_size_t n = out->n;
+        out->n += bert_encode_word(model, word, len, n < out->cap ? out->ids + n : NULL,
+          n < out->cap ? out->cap - n : 0);
+        return;
+    }
+    // a word with more characters than this is a single [UNK]
+    nlp_int32_t ids[WORDPIECE_MAX_INPUT_CHARS_PER_WORD + 1];
+    nlp_size_t count = bert_encode_word(model, word, len, ids, WORDPIECE_MAX_INPUT_CHARS_PER_WORD + 1);
+    nlp_size_t pos = 0;
+    for (nlp_size_t i = 0; i < count; i++, out->n++) {
+        if (i > WORDPIECE_MAX_INPUT_CHARS_PER_WORD) continue;
+        nlp_size_t piece_len = (count == 1 && ids[0] == wp->unk_id) ? len : wp->piece_lens[ids[i]];
+        if (out->n < out->cap) {
+            nlp_size_t last = offsets[pos + piece_len - 1];
+            out->spans[out->n].start = out->base + offsets[pos];
+            out->spans[out->n].end = out->base + last + utf8_sequence_len(input[last]);
+            out->spans[out->n].id = ids[i];
+        }
+        pos += piece_len;
+    }
+}
+
+/* normalize the text in one pass, then run wordpiece on the space separated words */
+static bool bert_encode_text(const bert_model_t *model,
+  bert_scratch_t *scratch,
+  const char *text,
+  nlp_size_t len,
+  bert_output_t *out) {
+    const nlp_uint8_t *input = (const nlp_uint8_t *)text;
+    bool with_offsets = out->spans != NULL;
+    if (!bert_scratch_reserve(scratch, BASIC_NORMALIZE_SIZE_HINT(len), with_offsets)) return false;
+    nlp_size_t n = basic_normalize(&model->basic, input, len, scratch->text,
+      with_offsets ? scratch->offsets : NULL, scratch->text_cap);
+    if (n > scratch->text_cap) {
+        if (!bert_scratch_reserve(scratch, n, with_offsets)) return false;
+        basic_normalize(&model->basic, input, len, scratch->text, with_offsets ? scratch->offsets : NULL,
+          scratch->text_cap);
+    }
+
+    const nlp_uint8_t *normalized = scratch->text;
+    nlp_size_t begin = 0;
+    while (begin < n) {
+        const nlp_uint8_t *space = (const nlp_uint8_t *)memchr(normalized + begin, ' ', n - begin);
+        nlp_size_t end = space != NULL ? (nlp_size_t)(space - normalized) : n;
+        bert_flush_word(model, input, normalized + begin, with_offsets ? scratch->offsets + begin : NULL,
+          end - begin, out);
+        begin = end + 1;
+    }
+    return true;
+}
+
+/* append a special token matched at text[start, end) */
+static inline void bert_output_special(bert_output_t *out, nlp_size_t start, nlp_size_t end, nlp_int32_t id) {
+    if (out->n < out->cap) {
+        if (out->spans != NULL) {
+            out->spans[out->n].start = start;
+            out->spans[out->n].end = end;
+            out->spans[out->n].id = id;
+        } else {
+            out->ids[out->n] = id;
+        }
+    }
+    out->n++;
+}
+
+/* split off the special tokens, the text between them is encoded as usual */
+static bool bert_encode(const bert_model_t *model,
+  bert_scratch_t *scratch,
+  const char *text,
+  nlp_size_t len,
+  bert_output_t *out) {
+    const nlp_uint8_t *input = (const nlp_uint8_t *)text;
+    nlp_size_t pos = 0, start, end;
+    nlp_int32_t id;
+    while (aho_corasick_find(&model->special_matcher, input, len, pos, &start, &end, &id)) {
+        out->base = pos;
+        if (start > pos && !bert_encode_text(model, scratch, text + pos, start - pos, out)) return false;
+        bert_output_special(out, start, end, id);
+        pos = end;
+    }
+    out->base = pos;
+    return bert_encode_text(model, scratch, text + pos, len - pos, out);
+}
+
+static inline bool bert_is_ascii_space(nlp_uint8_t c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+/* ascii bytes the normalizer always makes a word of their own */
+static inline bool bert_is_ascii_punct(nlp_uint8_t c) {
+    return (c >= 33 && c <= 47) || (c >= 58 && c <= 64) || (c >= 91 && c <= 96) || (c >= 123 && c <= 126);
+}
+
+/*
+    Whether text before and after `pos` encode the same on their own as
+    together, as far as the characters go: pos follows ascii whitespace or
+    starts a character that is always a word of its own. Never true inside a
+    utf-8 sequence.
+*/
+static bool bert_is_word_boundary(const nlp_uint8_t *text, nlp_size_t len, nlp_size_t pos) {
+    if (bert_is_ascii_space(text[pos - 1]) || bert_is_ascii_punct(text[pos])) return true;
+    if (text[pos] < 0xE0) return false;
+    nlp_int32_t cp;
+    return utf8proc_iterate(text + pos, len - pos, &cp) > 0 && utf8str_is_chinese_char(cp);
+}
+
+/*
+    bert_encode a chunk at a time, stopping once `limit` tokens are out, so
+    the count is exact only below `limit`. Chunks end at word boundaries and
+    the special tokens of a chunk are searched in it and the
+    max_special_len - 1 bytes after it, which decide every match starting
+    in the chunk. The text after a special token is encoded on its own, a
+    match crossing the end of a chunk ends it instead.
+*/
+static bool bert_encode_prefix(const bert_model_t *model,
+  bert_scratch_t *scratch,
+  const char *text,
+  nlp_size_t len,
+  bert_output_t *out,
+  nlp_size_t limit) {
+    const nlp_uint8_t *input = (const nlp_uint8_t *)text;
+    nlp_size_t context = model->max_special_len > 0 ? model->max_special_len - 1 : 0;
+    nlp_size_t pos = 0, start, match_end;
+    nlp_int32_t id;
+    while (pos < len && out->n < limit) {
+        nlp_size_t end = len - pos > BERT_CHUNK_SIZE ? pos + BERT_CHUNK_SIZE : len;
+        while (end < len && !bert_is_word_boundary(input, len, end)) end++;
+        nlp_size_t window = len - end > context ? end + context : len;
+        while (out->n < limit && aho_corasick_find(&model->special_matcher, input, window, pos, &start, &match_end, &id)
+               && start < end) {
+            out->base = pos;
+            if (start > pos && !bert_encode_text(model, scratch, text + pos, start - pos, out)) return false;
+            bert_output_special(out, start, match_end, id);
+            pos = match_end;
+        }
+        if (out->n >= limit || pos >= end) continue;
+        out->base = pos;
+        if (!bert_encode_text(model, scratch, text + pos, end - pos, out)) return false;
+        pos = end;
+    }
+    return true;
+}
+
+nlp_ssize_t nlp_bert_tokenizer_count(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_size_t max_tokens) {
+    if (tokenizer == NULL || (text == NULL && len > 0)) return -1;
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    nlp_size_t limit = max_tokens > 0 ? max_tokens : SIZE_MAX;
+    bert_output_t out = { NULL, NULL, 0, 0, 0 };
+    bert_scratch_t scratch;
+    bert_scratch_init(&scratch);
+    bool ok = bert_encode_prefix(model, &scratch, text, len, &out, limit);
+    bert_scratch_free(&scratch);
+    bert_model_release(model);
+    if (!ok) return -1;
+    return (nlp_ssize_t)(out.n < limit ? out.n : limit);
+}
+
+/* encode up to `limit` tokens, SIZE_MAX for all of them, see bert_encode_prefix */
+static nlp_ssize_t bert_encode_ids(const bert_model_t *model,
+  bert_scratch_t *scratch,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids,
+  nlp_size_t limit) {
+    if (text == NULL && len > 0) return -1;
+    bert_output_t out = { ids, NULL, max_ids, 0, 0 };
+    bool ok = limit == SIZE_MAX ? bert_encode(model, scratch, text, len, &out)
+                                : bert_encode_prefix(model, scratch, text, len, &out, limit);
+    return ok ? (nlp_ssize_t)out.n : -1;
+}
+
+nlp_ssize_t nlp_bert_tokenizer_encode(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids) {
+    if (tokenizer == NULL) return -1;
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    bert_scratch_t scratch;
+    bert_scratch_init(&scratch);
+    nlp_ssize_t n = bert_encode_ids(model, &scratch, text, len, ids, max_ids, SIZE_MAX);
+    bert_scratch_free(&scratch);
+    bert_model_release(model);
+    return n;
+}
+
+nlp_ssize_t nlp_bert_tokenizer_encode_spans(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_token_span_t *spans,
+  nlp_size_t max_spans) {
+    if (tokenizer == NULL || (text == NULL && len > 0)) return -1;
+    // without spans this only counts the tokens
+    bert_output_t out = { NULL, spans, spans != NULL ? max_spans : 0, 0, 0 };
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    bert_scratch_t scratch;
+    bert_scratch_init(&scratch);
+    bool ok = bert_encode(model, &scratch, text, len, &out);
+    bert_scratch_free(&scratch);
+    bert_model_release(model);
+    return ok ? (nlp_ssize_t)out.n : -1;
+}
+
+/* index of the first span ending after `pos`, spans are in text order */
+static nlp_size_t bert_spans_after(const nlp_token_span_t *spans, nlp_size_t num_spans, nlp_size_t pos) {
+    nlp_size_t lo = 0, hi = num_spans;
+    while (lo < hi) {
+        nlp_size_t mid = lo + (hi - lo) / 2;
+        if (spans[mid].end <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+    A position encoding can restart from: a word boundary, so no word
+    continues across it, and not inside a token of the old encoding, which
+    only a special token can span. Search back from `pos` if `backward`,
+    forward otherwise. `shift` maps text positions to positions of the old
+    encoding.
+*/
+static nlp_size_t bert_restart_position(const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t pos,
+  bool backward,
+  const nlp_token_span_t *spans,
+  nlp_size_t num_spans,
+  nlp_ssize_t shift) {
+    for (;;) {
+        if (backward) {
+            while (pos > 0 && (pos == len || !bert_is_word_boundary(text, len, pos))) pos--;
+        } else {
+            while (pos < len && (pos == 0 || !bert_is_word_boundary(text, len, pos))) pos++;
+        }
+        if (pos == 0 || pos == len) return pos;
+        nlp_size_t old_pos = (nlp_size_t)((nlp_ssize_t)pos - shift);
+        nlp_size_t i = bert_spans_after(spans, num_spans, old_pos);
+        if (i == num_spans || spans[i].start >= old_pos) return pos;
+        pos = (nlp_size_t)((nlp_ssize_t)(backward ? spans[i].start : spans[i].end) + shift);
+    }
+}
+
+nlp_ssize_t nlp_bert_tokenizer_reencode_spans(const bert_tokenizer_t *tokenizer,
+  const nlp_token_span_t *prev_spans,
+  nlp_size_t num_prev_spans,
+  nlp_size_t edit_start,
+  nlp_size_t edit_end,
+  nlp_size_t replacement_len,
+  const char *text,
+  nlp_size_t len,
+  nlp_token_span_t *spans,
+  nlp_size_t max_spans) {
+    if (tokenizer == NULL || (prev_spans == NULL && num_prev_spans > 0) || (text == NULL && len > 0)) return -1;
+    if (edit_start > edit_end || edit_start + replacement_len > len) return -1;
+    const nlp_uint8_t *input = (const nlp_uint8_t *)text;
+    nlp_ssize_t shift = (nlp_ssize_t)replacement_len - (nlp_ssize_t)(edit_end - edit_start);
+    nlp_size_t replaced_end = edit_start + replacement_len;
+    bert_model_t *model = bert_model_acquire(tokenizer);
+
+    // whether a special token matches at a position depends on the next max_special_len - 1 bytes,
+    // so the text the edit can affect starts that much earlier and ends that much later. A word
+    // boundary depends on the bytes on both sides of it, which must be outside the edit too
+    nlp_size_t context = model->max_special_len > 0 ? model->max_special_len - 1 : 0;
+    nlp_size_t begin = edit_start > context + 1 ? edit_start - context - 1 : 0;
+    begin = bert_restart_position(input, len, begin, true, prev_spans, num_prev_spans, 0);
+    nlp_size_t end = replaced_end + context + 1 < len ? replaced_end + context + 1 : len;
+    end = bert_restart_position(input, len, end, false, prev_spans, num_prev_spans, shift);
+
+    bert_output_t out = { NULL, spans, spans != NULL ? max_spans : 0, 0, 0 };
+    // tokens before the edit are kept, the ones after it move by the size change
+    nlp_size_t head = bert_spans_after(prev_spans, num_prev_spans, begin);
+    for (nlp_size_t i = 0; i < head; i++, out.n++) {
+        if (out.n < out.cap) spans[out.n] = prev_spans[i];
+    }
+    nlp_size_t first = out.n;
+    bert_scratch_t scratch;
+    bert_scratch_init(&scratch);
+    bool ok = bert_encode(model, &scratch, text + begin, end - begin, &out);
+    bert_scratch_free(&scratch);
+    bert_model_release(model);
+    if (!ok) return -1;
+    for (nlp_size_t i = first; i < out.n && i < out.cap; i++) {
+        spans[i].start += begin;
+        spans[i].end += begin;
+    }
+    if (end < len) {
+        for (nlp_size_t i = bert_spans_after(prev_spans, num_prev_spans, (nlp_size_t)((nlp_ssize_t)end - shift));
+             i < num_prev_spans; i++, out.n++) {
+            if (out.n < out.cap) {
+                spans[out.n].start = (nlp_size_t)((nlp_ssize_t)prev_spans[i].start + shift);
+                spans[out.n].end = (nlp_size_t)((nlp_ssize_t)prev_spans[i].end + shift);
+                spans[out.n].id = prev_spans[i].id;
+            }
+        }
+    }
+    return (nlp_ssize_t)out.n;
+}
+
+/*
+    The last word boundary in text(0, limit] that no special token crosses,
+    0 if there is none. Deciding the special tokens across a position takes
+    the max_special_len - 1 bytes after it, which `len` must include.
+*/
+static nlp_size_t bert_stream_cut(const bert_model_t *model,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t limit) {
+    nlp_size_t pos = limit;
+    while (pos > 0) {
+        if (!bert_is_word_boundary(text, len, pos)) {
+            pos--;
+            continue;
+        }
+        // the matches are the same whatever the cut, the last one starting before it must end by then
+        nlp_size_t next = 0, start, end;
+        nlp_int32_t id;
+        bool crossed = false;
+        while (aho_corasick_find(&model->special_matcher, text, len, next, &start, &end, &id) && start < pos) {
+            if (end > pos) {
+                crossed = true;
+                break;
+            }
+            next = end;
+        }
+        if (!crossed) return pos;
+        pos = start;
+    }
+    return 0;
+}
+
+struct bert_stream
+{
+    // the whole stream is encoded with the vocab of when it was created
+    bert_model_t *model;
+    nlp_token_callback_t callback;
+    void *context;
+    // bytes after the last word boundary, waiting for the rest of their word
+    nlp_uint8_t *carry;
+    nlp_size_t carry_len;
+    nlp_size_t carry_cap;
+    // stream position of the next byte to encode
+    nlp_size_t position;
+    bert_scratch_t scratch;
+    nlp_token_span_t *spans;
+    nlp_size_t spans_cap;
+    bool failed;
 };
 
+bert_stream_t *nlp_bert_stream_create(const bert_tokenizer_t *tokenizer,
+  nlp_token_callback_t callback,
+  void *context) {
+    if (tokenizer == NULL || callback == NULL) return NULL;
+    bert_stream_t *stream = (bert_stream_t *)calloc(1, sizeof(bert_stream_t));
+    if (stream == NULL) return NULL;
+    stream->spans_cap = BERT_STREAM_SEGMENT_SIZE;
+    stream->spans = (nlp_token_span_t *)malloc(sizeof(nlp_token_span_t) * stream->spans_cap);
+    if (stream->spans == NULL) {
+        free(stream);
+        return NULL;
+    }
+    stream->model = bert_model_acquire(tokenizer);
+    stream->callback = callback;
+    stream->context = context;
+    bert_scratch_init(&stream->scratch);
+    return stream;
+}
 
-void nlp_basic_tokenizer_destory(basic_tokenizer_t *tokenizer) { free(tokenizer); }
-bert_tokenizer_t *nlp_bert_tokenizer_create(const char *vocab_path, bool do_lower_case) {
-    bert_tokenizer_t *tokenizer;
-    tokenizer = (bert_tokenizer_t *)malloc(sizeof(bert_tokenizer_t));
+void nlp_bert_stream_destory(bert_stream_t *stream) {
+    if (stream == NULL) return;
+    bert_model_release(stream->model);
+    bert_scratch_free(&stream->scratch);
+    free(stream->carry);
+    free(stream->spans);
+    free(stream);
+}
+
+/* encode text[0, len) and hand its tokens to the callback */
+static bool bert_stream_emit(bert_stream_t *stream, const nlp_uint8_t *text, nlp_size_t len) {
+    bert_output_t out = { NULL, stream->spans, stream->spans_cap, 0, 0 };
+    if (!bert_encode(stream->model, &stream->scratch, (const char *)text, len, &out)) return false;
+    if (out.n > stream->spans_cap) {
+        // normalization made more tokens than bytes, which is rare enough to encode again
+        nlp_token_span_t *spans = (nlp_token_span_t *)malloc(sizeof(nlp_token_span_t) * out.n);
+        if (spans == NULL) return false;
+        free(stream->spans);
+        stream->spans = spans;
+        stream->spans_cap = out.n;
+        out = (bert_output_t){ NULL, spans, out.n, 0, 0 };
+        if (!bert_encode(stream->model, &stream->scratch, (const char *)text, len, &out)) return false;
+    }
+    for (nlp_size_t i = 0; i < out.n; i++) {
+        stream->spans[i].start += stream->position;
+        stream->spans[i].end += stream->position;
+    }
+    stream->position += len;
+    return out.n == 0 || stream->callback(stream->context, stream->spans, out.n) == 0;
+}
+
+/*
+    Encode text up to the last word boundary, a segment at a time, or all of
+    it if `final`. Return the number of bytes encoded, -1 if failed.
+*/
+static nlp_ssize_t bert_stream_encode(bert_stream_t *stream, const nlp_uint8_t *text, nlp_size_t len, bool final) {
+    const bert_model_t *model = stream->model;
+    // a cut needs the byte after it and the lookahead of the special tokens
+    nlp_size_t context = model->max_special_len > 1 ? model->max_special_len - 1 : 1;
+    nlp_size_t done = 0;
+    while (done < len) {
+        nlp_size_t rest = len - done;
+        nlp_size_t limit = rest > context ? rest - context : 0;
+        nlp_size_t cut = 0;
+        if (final && rest <= BERT_STREAM_SEGMENT_SIZE) cut = rest;
+        // the window doubles while it has no boundary, so a long word is still searched in linear time
+        for (nlp_size_t window = BERT_STREAM_SEGMENT_SIZE; cut == 0 && window < limit; window *= 2)
+            cut = bert_stream_cut(model, text + done, window + context, window);
+        if (cut == 0 && limit > 0) cut = bert_stream_cut(model, text + done, rest, limit);
+        if (cut == 0 && final) cut = rest;
+        if (cut == 0) break;
+        if (!bert_stream_emit(stream, text + done, cut)) return -1;
+        done += cut;
+    }
+    return (nlp_ssize_t)done;
+}
+
+static bool bert_stream_carry(bert_stream_t *stream, const nlp_uint8_t *data, nlp_size_t len) {
+    if (stream->carry_cap - stream->carry_len < len) {
+        nlp_size_t cap = stream->carry_cap > 0 ? stream->carry_cap : BERT_SCRATCH_INLINE_SIZE;
+        while (cap - stream->carry_len < len) cap *= 2;
+        nlp_uint8_t *carry = (nlp_uint8_t *)realloc(stream->carry, cap);
+        if (carry == NULL) return false;
+        stream->carry = carry;
+        stream->carry_cap = cap;
+    }
+    memcpy(stream->carry + stream->carry_len, data, len);
+    stream->carry_len += len;
+    return true;
+}
+
+int nlp_bert_stream_write(bert_stream_t *stream, const char *data, nlp_size_t len) {
+    if (stream == NULL || (data == NULL && len > 0) || stream->failed) return -1;
+    const nlp_uint8_t *input = (const nlp_uint8_t *)data;
+    nlp_size_t pos = 0;
+    // the carried word is finished with pieces of the new data, each at least as long as the carry,
+    // so a long word is copied a bounded number of times
+    while (stream->carry_len > 0 && pos < len) {
+        nlp_size_t piece = stream->carry_len > BERT_STREAM_SEGMENT_SIZE ? stream->carry_len : BERT_STREAM_SEGMENT_SIZE;
+        if (piece > len - pos) piece = len - pos;
+        if (!bert_stream_carry(stream, input + pos, piece)) goto error;
+        pos += piece;
+        nlp_ssize_t done = bert_stream_encode(stream, stream->carry, stream->carry_len, false);
+        if (done < 0) goto error;
+        nlp_size_t left = stream->carry_len - (nlp_size_t)done;
+        if (left <= piece) {
+            // what is left is still in the new data, go on from there without copying
+            pos -= left;
+            stream->carry_len = 0;
+        } else {
+            memmove(stream->carry, stream->carry + done, left);
+            stream->carry_len = left;
+        }
+    }
+    if (stream->carry_len == 0 && pos < len) {
+        nlp_ssize_t done = bert_stream_encode(stream, input + pos, len - pos, false);
+        if (done < 0 || !bert_stream_carry(stream, input + pos + done, len - pos - (nlp_size_t)done)) goto error;
+    }
+    return 0;
+
+error:
+    stream->failed = true;
+    return -1;
+}
+
+int nlp_bert_stream_finish(bert_stream_t *stream) {
+    if (stream == NULL || stream->failed) return -1;
+    nlp_ssize_t done = bert_stream_encode(stream, stream->carry, stream->carry_len, true);
+    stream->carry_len = 0;
+    if (done < 0) {
+        stream->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int nlp_bert_tokenizer_encode_file(const bert_tokenizer_t *tokenizer,
+  FILE *fp,
+  nlp_token_callback_t callback,
+  void *context) {
+    if (fp == NULL) return -1;
+    bert_stream_t *stream = nlp_bert_stream_create(tokenizer, callback, context);
+    char *buffer = (char *)malloc(BERT_STREAM_SEGMENT_SIZE);
+    int ret = stream != NULL && buffer != NULL ? 0 : -1;
+    nlp_size_t n;
+    while (ret == 0 && (n = fread(buffer, 1, BERT_STREAM_SEGMENT_SIZE, fp)) > 0)
+        ret = nlp_bert_stream_write(stream, buffer, n);
+    if (ret == 0 && ferror(fp)) ret = -1;
+    if (ret == 0) ret = nlp_bert_stream_finish(stream);
+    free(buffer);
+    nlp_bert_stream_destory(stream);
+    return ret;
+}
+
+int nlp_bert_tokenizer_encode_fd(const bert_tokenizer_t *tokenizer,
+  int fd,
+  nlp_token_callback_t callback,
+  void *context) {
+    if (fd < 0) return -1;
+    bert_stream_t *stream = nlp_bert_stream_create(tokenizer, callback, context);
+    char *buffer = (char *)malloc(BERT_STREAM_SEGMENT_SIZE);
+    int ret = stream != NULL && buffer != NULL ? 0 : -1;
+    while (ret == 0) {
+#if defined(_WIN32)
+        int n = _read(fd, buffer, BERT_STREAM_SEGMENT_SIZE);
+#else
+        ssize_t n = read(fd, buffer, BERT_STREAM_SEGMENT_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n < 0) ret = -1;
+        if (n <= 0) break;
+        ret = nlp_bert_stream_write(stream, buffer, (nlp_size_t)n);
+    }
+    if (ret == 0) ret = nlp_bert_stream_finish(stream);
+    free(buffer);
+    nlp_bert_stream_destory(stream);
+    return ret;
+}
+
+void nlp_bert_encode_options_init(nlp_bert_encode_options_t *options) {
+    options->max_length = BERT_DEFAULT_MAX_LENGTH;
+    options->padding = NLP_PADDING_MAX_LENGTH;
+    options->truncation = NLP_TRUNCATION_LONGEST_FIRST;
+    options->add_special_tokens = true;
+    options->pool = NULL;
+    options->num_workers = 0;
+}
+
+/* lengths of the two sequences after truncating them to `budget` tokens in total */
+static bool bert_truncate_lengths(nlp_truncation_strategy_t truncation,
+  bool is_pair,
+  nlp_size_t budget,
+  nlp_size_t *len_a,
+  nlp_size_t *len_b) {
+    if (*len_a + *len_b <= budget) return true;
+    if (!is_pair) {
+        if (truncation == NLP_TRUNCATION_NONE || truncation == NLP_TRUNCATION_ONLY_SECOND) return false;
+        *len_a = budget;
+        return true;
+    }
+    switch (truncation) {
+    case NLP_TRUNCATION_ONLY_FIRST:
+        if (*len_b > budget) return false;
+        *len_a = budget - *len_b;
+        return true;
+    case NLP_TRUNCATION_ONLY_SECOND:
+        if (*len_a > budget) return false;
+        *len_b = budget - *len_a;
+        return true;
+    case NLP_TRUNCATION_LONGEST_FIRST: {
+        // same result as removing one token at a time from the longer one, the second one on ties
+        nlp_size_t shorter = *len_a < *len_b ? *len_a : *len_b;
+        if (budget >= 2 * shorter) {
+            if (*len_a > *len_b)
+                *len_a = budget - shorter;
+            else
+                *len_b = budget - shorter;
+        } else {
+            *len_b = budget / 2;
+            *len_a = budget - *len_b;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/*
+    Encode one row of a batch into `row_ids` / `row_mask` / `row_types`, which
+    hold max_length values each, padding included. `ids` holds 2 * max_length
+    ids. Return the row length before padding, -1 if failed.
+*/
+static nlp_ssize_t bert_encode_row(const bert_model_t *model,
+  const nlp_bert_encode_options_t *options,
+  const char *text,
+  nlp_size_t text_len,
+  const char *pair,
+  nlp_size_t pair_len,
+  bert_scratch_t *scratch,
+  nlp_int32_t *ids,
+  nlp_int32_t *row_ids,
+  nlp_int32_t *row_mask,
+  nlp_int32_t *row_types) {
+    nlp_size_t max_length = options->max_length;
+    bool is_pair = pair != NULL;
+    nlp_size_t num_special = options->add_special_tokens ? (is_pair ? 3 : 2) : 0;
+    if (num_special > max_length) return -1;
+    if (num_special > 0 && (model->cls_id < 0 || model->sep_id < 0)) return -1;
+
+    // a sequence never keeps more than the budget, and truncating only needs to know which ones are longer,
+    // so the encoding of a long text stops one token past it
+    nlp_size_t budget = max_length - num_special;
+    nlp_int32_t *ids_a = ids;
+    nlp_int32_t *ids_b = ids + max_length;
+    nlp_ssize_t len_a = bert_encode_ids(model, scratch, text, text_len, ids_a, max_length, budget + 1);
+    nlp_ssize_t len_b = is_pair ? bert_encode_ids(model, scratch, pair, pair_len, ids_b, max_length, budget + 1) : 0;
+    if (len_a < 0 || len_b < 0) return -1;
+
+    nlp_size_t keep_a = (nlp_size_t)len_a;
+    nlp_size_t keep_b = (nlp_size_t)len_b;
+    if (!bert_truncate_lengths(options->truncation, is_pair, budget, &keep_a, &keep_b)) return -1;
+
+    nlp_size_t n = 0;
+    if (options->add_special_tokens) row_ids[n++] = model->cls_id;
+    memcpy(row_ids + n, ids_a, sizeof(nlp_int32_t) * keep_a);
+    n += keep_a;
+    if (options->add_special_tokens) row_ids[n++] = model->sep_id;
+    nlp_size_t first_len = n;
+    if (is_pair) {
+        memcpy(row_ids + n, ids_b, sizeof(nlp_int32_t) * keep_b);
+        n += keep_b;
+        if (options->add_special_tokens) row_ids[n++] = model->sep_id;
+    }
+
+    for (nlp_size_t j = n; j < max_length; j++) row_ids[j] = model->pad_id;
+    if (row_mask != NULL) {
+        for (nlp_size_t j = 0; j < n; j++) row_mask[j] = 1;
+        for (nlp_size_t j = n; j < max_length; j++) row_mask[j] = 0;
+    }
+    if (row_types != NULL) {
+        for (nlp_size_t j = 0; j < first_len; j++) row_types[j] = 0;
+        for (nlp_size_t j = first_len; j < n; j++) row_types[j] = 1;
+        for (nlp_size_t j = n; j < max_length; j++) row_types[j] = 0;
+    }
+    return (nlp_ssize_t)n;
+}
+
+/* rows are written max_length apart, move them together for a seq_len stride */
+static void bert_compact_rows(nlp_int32_t *tensor, nlp_size_t batch_size, nlp_size_t max_length, nlp_size_t seq_len) {
+    if (tensor == NULL || seq_len == max_length) return;
+    for (nlp_size_t i = 1; i < batch_size; i++)
+        memmove(tensor + i * seq_len, tensor + i * max_length, sizeof(nlp_int32_t) * seq_len);
+}
+
+/*
+    Scratch and id buffer of the thread running batch rows, kept in thread
+    local storage so a pool thread reuses them across calls. Freed when the
+    thread exits.
+*/
+typedef struct bert_worker_scratch
+{
+    bert_scratch_t scratch;
+    nlp_int32_t *ids;
+    nlp_size_t ids_cap;
+} bert_worker_scratch_t;
+
+static pthread_key_t bert_worker_key;
+static pthread_once_t bert_worker_once = PTHREAD_ONCE_INIT;
+static bool bert_worker_key_created = false;
+
+static void bert_worker_scratch_free(void *ptr) {
+    bert_worker_scratch_t *worker = (bert_worker_scratch_t *)ptr;
+    bert_scratch_free(&worker->scratch);
+    free(worker->ids);
+    free(worker);
+}
+
+static void bert_worker_key_create(void) {
+    bert_worker_key_created = pthread_key_create(&bert_worker_key, bert_worker_scratch_free) == 0;
+}
+
+/* the scratch of the calling thread with room for `num_ids` ids, NULL if out of memory */
+static bert_worker_scratch_t *bert_worker_scratch_get(nlp_size_t num_ids) {
+    pthread_once(&bert_worker_once, bert_worker_key_create);
+    if (!bert_worker_key_created) return NULL;
+    bert_worker_scratch_t *worker = (bert_worker_scratch_t *)pthread_getspecific(bert_worker_key);
+    if (worker == NULL) {
+        worker = (bert_worker_scratch_t *)calloc(1, sizeof(bert_worker_scratch_t));
+        if (worker == NULL) return NULL;
+        bert_scratch_init(&worker->scratch);
+        if (pthread_setspecific(bert_worker_key, worker) != 0) {
+            free(worker);
+            return NULL;
+        }
+    }
+    if (worker->ids_cap < num_ids) {
+        nlp_int32_t *ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * num_ids);
+        if (ids == NULL) return NULL;
+        free(worker->ids);
+        worker->ids = ids;
+        worker->ids_cap = num_ids;
+    }
+    return worker;
+}
+
+/*
+    State shared by the tasks of one batch call. A pool task can not be
+    cancelled and may run long after its batch call returned, or never if the
+    pool is destroyed first, so the job is on the heap and every task holds a
+    reference. Rows are claimed one at a time from next_row and the caller
+    only returns once all of them are done, so a task that starts late claims
+    nothing and never reads the texts or outputs of the caller.
+*/
+typedef struct bert_batch_job
+{
+    atomic_size_t refs;
+    // every row of the batch is encoded with this model, whatever is swapped in meanwhile
+    bert_model_t *model;
+    nlp_bert_encode_options_t options;
+    const char *const *texts;
+    const nlp_size_t *text_lens;
+    const char *const *text_pairs;
+    const nlp_size_t *text_pair_lens;
+    nlp_size_t batch_size;
+    nlp_int32_t *input_ids;
+    nlp_int32_t *attention_mask;
+    nlp_int32_t *token_type_ids;
+    atomic_size_t next_row;
+    atomic_bool failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    nlp_size_t rows_done;
+    nlp_size_t seq_len;
+} bert_batch_job_t;
+
+static void bert_batch_job_release(bert_batch_job_t *job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    pthread_mutex_destroy(&job->mutex);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+static void bert_batch_work(bert_batch_job_t *job, bert_worker_scratch_t *worker) {
+    nlp_size_t max_length = job->options.max_length;
+    nlp_size_t rows_done = 0;
+    nlp_size_t seq_len = 0;
+    nlp_size_t i;
+
+    while ((i = atomic_fetch_add(&job->next_row, 1)) < job->batch_size) {
+        rows_done++;
+        if (atomic_load_explicit(&job->failed, memory_order_relaxed)) continue;
+        const char *pair = job->text_pairs != NULL ? job->text_pairs[i] : NULL;
+        nlp_size_t text_len = job->text_lens != NULL ? job->text_lens[i] : strlen(job->texts[i]);
+        nlp_size_t pair_len = pair == NULL ? 0 : (job->text_pair_lens != NULL ? job->text_pair_lens[i] : strlen(pair));
+        nlp_size_t offset = i * max_length;
+        nlp_ssize_t n = bert_encode_row(job->model, &job->options, job->texts[i], text_len, pair, pair_len,
+          &worker->scratch, worker->ids, job->input_ids + offset,
+          job->attention_mask != NULL ? job->attention_mask + offset : NULL,
+          job->token_type_ids != NULL ? job->token_type_ids + offset : NULL);
+        if (n < 0)
+            atomic_store(&job->failed, true);
+        else if ((nlp_size_t)n > seq_len)
+            seq_len = (nlp_size_t)n;
+    }
+    if (rows_done == 0) return;
+
+    pthread_mutex_lock(&job->mutex);
+    job->rows_done += rows_done;
+    if (seq_len > job->seq_len) job->seq_len = seq_len;
+    if (job->rows_done == job->batch_size) pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static void bert_batch_routine(void *context) {
+    bert_batch_job_t *job = (bert_batch_job_t *)context;
+    // a task that can not get its scratch leaves the rows to the others, the caller always works
+    if (atomic_load(&job->next_row) < job->batch_size) {
+        bert_worker_scratch_t *worker = bert_worker_scratch_get(2 * job->options.max_length);
+        if (worker != NULL) bert_batch_work(job, worker);
+    }
+    bert_batch_job_release(job);
+}
+
+nlp_ssize_t nlp_bert_tokenizer_encode_batch(const bert_tokenizer_t *tokenizer,
+  const char *const *texts,
+  const nlp_size_t *text_lens,
+  const char *const *text_pairs,
+  const nlp_size_t *text_pair_lens,
+  nlp_size_t batch_size,
+  const nlp_bert_encode_options_t *options,
+  nlp_int32_t *input_ids,
+  nlp_int32_t *attention_mask,
+  nlp_int32_t *token_type_ids) {
+    if (tokenizer == NULL || texts == NULL || input_ids == NULL) return -1;
+    bert_batch_job_t *job = (bert_batch_job_t *)malloc(sizeof(bert_batch_job_t));
+    if (job == NULL) return -1;
+    if (options == NULL)
+        nlp_bert_encode_options_init(&job->options);
+    else
+        job->options = *options;
+    nlp_bert_encode_options_t opts = job->options;
+    nlp_size_t max_length = opts.max_length;
+    bert_worker_scratch_t *worker = max_length > 0 ? bert_worker_scratch_get(2 * max_length) : NULL;
+    if (worker == NULL || pthread_mutex_init(&job->mutex, NULL) != 0) {
+        free(job);
+        return -1;
+    }
+    if (pthread_cond_init(&job->cond, NULL) != 0) {
+        pthread_mutex_destroy(&job->mutex);
+        free(job);
+        return -1;
+    }
+    atomic_init(&job->refs, 1);
+    job->model = bert_model_acquire(tokenizer);
+    job->texts = texts;
+    job->text_lens = text_lens;
+    job->text_pairs = text_pairs;
+    job->text_pair_lens = text_pair_lens;
+    job->batch_size = batch_size;
+    job->input_ids = input_ids;
+    job->attention_mask = attention_mask;
+    job->token_type_ids = token_type_ids;
+    atomic_init(&job->next_row, 0);
+    atomic_init(&job->failed, false);
+    job->rows_done = 0;
+    job->seq_len = 0;
+
+    nlp_size_t num_tasks = opts.num_workers < batch_size ? opts.num_workers : batch_size;
+    if (opts.pool != NULL) {
+        struct thrdpool_task task = { bert_batch_routine, job };
+        for (nlp_size_t i = 1; i < num_tasks; i++) {
+            atomic_fetch_add(&job->refs, 1);
+            if (thrdpool_schedule(&task, opts.pool) < 0) {
+                atomic_fetch_sub(&job->refs, 1);
+                break;
+            }
+        }
+    }
+    // the calling thread takes rows as well and then waits for the rows other tasks claimed
+    bert_batch_work(job, worker);
+
+    pthread_mutex_lock(&job->mutex);
+    while (job->rows_done < batch_size) pthread_cond_wait(&job->cond, &job->mutex);
+    nlp_size_t seq_len = job->seq_len;
+    pthread_mutex_unlock(&job->mutex);
+    bool failed = atomic_load(&job->failed);
+    bert_model_release(job->model);
+    bert_batch_job_release(job);
+    if (failed) return -1;
+
+    if (opts.padding == NLP_PADDING_MAX_LENGTH) return (nlp_ssize_t)max_length;
+    bert_compact_rows(input_ids, batch_size, max_length, seq_len);
+    bert_compact_rows(attention_mask, batch_size, max_length, seq_len);
+    bert_compact_rows(token_type_ids, batch_size, max_length, seq_len);
+    return (nlp_ssize_t)seq_len;
+}
+
+nlp_encoding_t *nlp_encoding_create(void) {
+    nlp_encoding_t *encoding = (nlp_encoding_t *)calloc(1, sizeof(nlp_encoding_t));
+    if (encoding == NULL) return NULL;
+    bert_scratch_t *scratch = (bert_scratch_t *)malloc(sizeof(bert_scratch_t));
+    if (scratch == NULL) {
+        free(encoding);
+        return NULL;
+    }
+    bert_scratch_init(scratch);
+    encoding->scratch = scratch;
+    return encoding;
+}
+
+void nlp_encoding_destory(nlp_encoding_t *encoding) {
+    if (encoding == NULL) return;
+    bert_scratch_free((bert_scratch_t *)encoding->scratch);
+    free(encoding->scratch);
+    free(encoding->input_ids);
+    free(encoding->attention_mask);
+    free(encoding->token_type_ids);
+    free(encoding->spans);
+    free(encoding);
+}
+
+/* grow the arrays to hold `cap` values each, the values are not kept */
+static bool bert_encoding_reserve(nlp_encoding_t *encoding, nlp_size_t cap) {
+    if (encoding->cap >= cap) return true;
+    nlp_int32_t *input_ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * cap);
+    nlp_int32_t *attention_mask = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * cap);
+    nlp_int32_t *token_type_ids = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * cap);
+    nlp_token_span_t *spans = (nlp_token_span_t *)malloc(sizeof(nlp_token_span_t) * cap);
+    if (input_ids == NULL || attention_mask == NULL || token_type_ids == NULL || spans == NULL) {
+        free(input_ids);
+        free(attention_mask);
+        free(token_type_ids);
+        free(spans);
+        return false;
+    }
+    free(encoding->input_ids);
+    free(encoding->attention_mask);
+    free(encoding->token_type_ids);
+    free(encoding->spans);
+    encoding->input_ids = input_ids;
+    encoding->attention_mask = attention_mask;
+    encoding->token_type_ids = token_type_ids;
+    encoding->spans = spans;
+    encoding->cap = cap;
+    return true;
+}
+
+static inline void bert_set_span(nlp_token_span_t *span, nlp_size_t start, nlp_size_t end, nlp_int32_t id) {
+    span->start = start;
+    span->end = end;
+    span->id = id;
+}
+
+nlp_ssize_t nlp_bert_tokenizer_encode_into(const bert_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  const char *pair,
+  nlp_size_t pair_len,
+  const nlp_bert_encode_options_t *options,
+  nlp_encoding_t *encoding) {
+    if (tokenizer == NULL || encoding == NULL || (text == NULL && len > 0) || (pair == NULL && pair_len > 0)) return -1;
+    encoding->len = 0;
+    nlp_bert_encode_options_t defaults;
+    if (options == NULL) {
+        nlp_bert_encode_options_init(&defaults);
+        options = &defaults;
+    }
+    nlp_size_t max_length = options->max_length;
+    bool is_pair = pair != NULL;
+    nlp_size_t num_special = options->add_special_tokens ? (is_pair ? 3 : 2) : 0;
+    if (max_length == 0 || num_special > max_length) return -1;
+    // the sequences are encoded into the two halves, a sequence never keeps more than its half
+    if (!bert_encoding_reserve(encoding, 2 * max_length)) return -1;
+    bert_model_t *model = bert_model_acquire(tokenizer);
+    bert_scratch_t *scratch = (bert_scratch_t *)encoding->scratch;
+    nlp_token_span_t *spans = encoding->spans;
+    nlp_size_t first = options->add_special_tokens ? 1 : 0;
+    nlp_size_t budget = max_length - num_special;
+    bert_output_t out_a = { NULL, spans + first, budget, 0, 0 };
+    bert_output_t out_b = { NULL, spans + max_length, budget, 0, 0 };
+    // as for a batch row, the encoding of a long text stops one token past the budget
+    bool ok = (num_special == 0 || (model->cls_id >= 0 && model->sep_id >= 0))
+              && bert_encode_prefix(model, scratch, text, len, &out_a, budget + 1)
+              && (!is_pair || bert_encode_prefix(model, scratch, pair, pair_len, &out_b, budget + 1));
+    nlp_size_t keep_a = out_a.n;
+    nlp_size_t keep_b = out_b.n;
+    ok = ok && bert_truncate_lengths(options->truncation, is_pair, budget, &keep_a, &keep_b);
+    if (!ok) {
+        bert_model_release(model);
+        return -1;
+    }
+
+    nlp_size_t n = 0;
+    if (options->add_special_tokens) bert_set_span(&spans[n++], 0, 0, model->cls_id);
+    n += keep_a;
+    if (options->add_special_tokens) bert_set_span(&spans[n++], 0, 0, model->sep_id);
+    nlp_size_t first_len = n;
+    if (is_pair) {
+        memmove(spans + n, spans + max_length, sizeof(nlp_token_span_t) * keep_b);
+        n += keep_b;
+        if (options->add_special_tokens) bert_set_span(&spans[n++], 0, 0, model->sep_id);
+    }
+    nlp_size_t total = options->padding == NLP_PADDING_MAX_LENGTH ? max_length : n;
+    for (nlp_size_t i = n; i < total; i++) bert_set_span(&spans[i], 0, 0, model->pad_id);
+    bert_model_release(model);
+
+    for (nlp_size_t i = 0; i < total; i++) {
+        encoding->input_ids[i] = spans[i].id;
+        encoding->attention_mask[i] = i < n;
+        encoding->token_type_ids[i] = i >= first_len && i < n;
+    }
+    encoding->len = total;
+    return (nlp_ssize_t)total;
+}
+
+#define BERT_BATCHER_DEFAULT_MAX_TOKENS 8192
+#define BERT_BATCHER_DEFAULT_MAX_BATCH_SIZE 256
+#define BERT_BATCHER_DEFAULT_BUCKET_WIDTH 8
+
+/* an encoded request, ids without padding */
+typedef struct bert_batch_row
+{
+    nlp_uint64_t request_id;
+    nlp_size_t len;
+    // tokens of the first sequence, the rest have token type 1
+    nlp_size_t first_len;
+    // of the vocab the row was encoded with, which a swap may have replaced since
+    nlp_int32_t pad_id;
+    nlp_int32_t ids[];
+} bert_batch_row_t;
+
+/* rows of a bucket being filled, or of a batch waiting to be returned */
+typedef struct bert_batch_rows
+{
+    struct bert_batch_rows *next;
+    nlp_size_t count;
+    bert_batch_row_t *rows[];
+} bert_batch_rows_t;
+
+typedef struct bert_batch_bucket
+{
+    // allocated with the first row
+    bert_batch_rows_t *rows;
+    nlp_size_t cap;
+} bert_batch_bucket_t;
+
+struct bert_batcher
+{
+    const bert_tokenizer_t *tokenizer;
+    nlp_bert_batcher_options_t options;
+    bert_batch_bucket_t *buckets;
+    nlp_size_t num_buckets;
+    // full batches in the order they filled up
+    bert_batch_rows_t *ready_head;
+    bert_batch_rows_t *ready_tail;
+    nlp_uint64_t next_request_id;
+    // requests scheduled on the pool and not inserted yet
+    nlp_size_t in_flight;
+    // requests that failed on the pool, reported with the next batch
+    struct bert_batcher_request *failed;
+    nlp_size_t num_failed;
+    nlp_bert_batcher_stats_t stats;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/* a request encoded on the pool, the texts are stored after the struct */
+typedef struct bert_batcher_request
+{
+    // in the failed list of the batcher once it failed
+    struct bert_batcher_request *next;
+    bert_batcher_t *batcher;
+    nlp_uint64_t request_id;
+    const char *text;
+    nlp_size_t len;
+    const char *pair;
+    nlp_size_t pair_len;
+} bert_batcher_request_t;
+
+void nlp_bert_batcher_options_init(nlp_bert_batcher_options_t *options) {
+    nlp_bert_encode_options_init(&options->encode);
+    options->max_tokens = BERT_BATCHER_DEFAULT_MAX_TOKENS;
+    options->max_batch_size = BERT_BATCHER_DEFAULT_MAX_BATCH_SIZE;
+    options->bucket_width = BERT_BATCHER_DEFAULT_BUCKET_WIDTH;
+}
+
+bert_batcher_t *nlp_bert_batcher_create(const bert_tokenizer_t *tokenizer, const nlp_bert_batcher_options_t *options) {
     if (tokenizer == NULL) return NULL;
-    map_handle_t *vocab = map_create();
-    FILE *vocab_file = fopen(vocab_path, "r");
-    if (vocab_file != NULL) {
-        char *rawline;
-        nlp_size_t index = 0;
-        nlp_size_t len = 1024;
-        rawline = (char *)malloc(sizeof(char) * len);
-        while (readline(&rawline, &len, vocab_file)) {
-            // hashmap_set(vocab, rawline, strlen(rawline), index);
-            // hashmap_set(invert_vocab, index, sizeof(index), rawline);
-            index++;
-            printf("%s\n", rawline);
-        }
-        // tokenizer->vocab = vocab;
-        // tokenizer->inv_vocab = invert_vocab;
+    bert_batcher_t *batcher = (bert_batcher_t *)calloc(1, sizeof(bert_batcher_t));
+    if (batcher == NULL) return NULL;
+    if (options == NULL)
+        nlp_bert_batcher_options_init(&batcher->options);
+    else
+        batcher->options = *options;
+    nlp_size_t max_length = batcher->options.encode.max_length;
+    nlp_size_t width = batcher->options.bucket_width;
+    if (max_length == 0 || width == 0 || batcher->options.max_batch_size == 0
+        || batcher->options.max_tokens < max_length) {
+        free(batcher);
+        return NULL;
+    }
+    batcher->tokenizer = tokenizer;
+    // bucket b holds rows of (b * width, (b + 1) * width] tokens, an empty row goes to bucket 0
+    batcher->num_buckets = (max_length + width - 1) / width;
+    batcher->buckets = (bert_batch_bucket_t *)calloc(batcher->num_buckets, sizeof(bert_batch_bucket_t));
+    if (batcher->buckets == NULL || pthread_mutex_init(&batcher->mutex, NULL) != 0) {
+        free(batcher->buckets);
+        free(batcher);
+        return NULL;
+    }
+    if (pthread_cond_init(&batcher->cond, NULL) != 0) {
+        pthread_mutex_destroy(&batcher->mutex);
+        free(batcher->buckets);
+        free(batcher);
+        return NULL;
+    }
+    for (nlp_size_t b = 0; b < batcher->num_buckets; b++) {
+        // every row of the bucket pads to at most its upper bound, so this many rows fit max_tokens
+        nlp_size_t upper = (b + 1) * width < max_length ? (b + 1) * width : max_length;
+        nlp_size_t cap = batcher->options.max_tokens / upper;
+        batcher->buckets[b].cap = cap < batcher->options.max_batch_size ? cap : batcher->options.max_batch_size;
+    }
+    return batcher;
+}
+
+static void bert_batch_rows_free(bert_batch_rows_t *rows) {
+    while (rows != NULL) {
+        bert_batch_rows_t *next = rows->next;
+        for (nlp_size_t i = 0; i < rows->count; i++) free(rows->rows[i]);
+        free(rows);
+        rows = next;
+    }
+}
+
+static void bert_batcher_requests_free(bert_batcher_request_t *request) {
+    while (request != NULL) {
+        bert_batcher_request_t *next = request->next;
+        free(request);
+        request = next;
+    }
+}
+
+void nlp_bert_batcher_destory(bert_batcher_t *batcher) {
+    if (batcher == NULL) return;
+    pthread_mutex_lock(&batcher->mutex);
+    while (batcher->in_flight > 0) pthread_cond_wait(&batcher->cond, &batcher->mutex);
+    pthread_mutex_unlock(&batcher->mutex);
+    for (nlp_size_t b = 0; b < batcher->num_buckets; b++) bert_batch_rows_free(batcher->buckets[b].rows);
+    bert_batch_rows_free(batcher->ready_head);
+    bert_batcher_requests_free(batcher->failed);
+    pthread_mutex_destroy(&batcher->mutex);
+    pthread_cond_destroy(&batcher->cond);
+    free(batcher->buckets);
+    free(batcher);
+}
+
+static void bert_batcher_push_ready(bert_batcher_t *batcher, bert_batch_rows_t *rows) {
+    rows->next = NULL;
+    if (batcher->ready_tail != NULL)
+        batcher->ready_tail->next = rows;
+    else
+        batcher->ready_head = rows;
+    batcher->ready_tail = rows;
+}
+
+/* add an encoded row to its bucket, a bucket that is full becomes a batch. Called with the mutex held */
+static bool bert_batcher_insert(bert_batcher_t *batcher, bert_batch_row_t *row) {
+    nlp_size_t b = row->len > 0 ? (row->len - 1) / batcher->options.bucket_width : 0;
+    bert_batch_bucket_t *bucket = &batcher->buckets[b];
+    if (bucket->rows == NULL) {
+        bucket->rows =
+          (bert_batch_rows_t *)malloc(sizeof(bert_batch_rows_t) + sizeof(bert_batch_row_t *) * bucket->cap);
+        if (bucket->rows == NULL) return false;
+        bucket->rows->count = 0;
+    }
+    bucket->rows->rows[bucket->rows->count++] = row;
+    if (bucket->rows->count == bucket->cap) {
+        bert_batcher_push_ready(batcher, bucket->rows);
+        bucket->rows = NULL;
+    }
+    return true;
+}
+
+/* encode one request and insert its row, `buffer` holds 4 * max_length ids */
+static bool bert_batcher_encode(bert_batcher_t *batcher,
+  nlp_uint64_t request_id,
+  const char *text,
+  nlp_size_t len,
+  const char *pair,
+  nlp_size_t pair_len,
+  bert_scratch_t *scratch,
+  nlp_int32_t *buffer) {
+    nlp_size_t max_length = batcher->options.encode.max_length;
+    nlp_int32_t *row_ids = buffer + 2 * max_length;
+    nlp_int32_t *row_types = buffer + 3 * max_length;
+    bert_model_t *model = bert_model_acquire(batcher->tokenizer);
+    nlp_ssize_t n = bert_encode_row(model, &batcher->options.encode, text, len, pair, pair_len, scratch, buffer,
+      row_ids, NULL, row_types);
+    nlp_int32_t pad_id = model->pad_id;
+    bert_model_release(model);
+    bert_batch_row_t *row = NULL;
+    if (n >= 0) row = (bert_batch_row_t *)malloc(sizeof(bert_batch_row_t) + sizeof(nlp_int32_t) * (nlp_size_t)n);
+    if (row != NULL) {
+        row->request_id = request_id;
+        row->pad_id = pad_id;
+        row->len = (nlp_size_t)n;
+        row->first_len = 0;
+        while (row->first_len < row->len && row_types[row->first_len] == 0) row->first_len++;
+        memcpy(row->ids, row_ids, sizeof(nlp_int32_t) * row->len);
+    }
+
+    pthread_mutex_lock(&batcher->mutex);
+    bool inserted = row != NULL && bert_batcher_insert(batcher, row);
+    if (!inserted) batcher->stats.failed++;
+    pthread_mutex_unlock(&batcher->mutex);
+    if (!inserted) free(row);
+    return inserted;
+}
+
+static void bert_batcher_routine(void *context) {
+    bert_batcher_request_t *request = (bert_batcher_request_t *)context;
+    bert_batcher_t *batcher = request->batcher;
+    bert_worker_scratch_t *worker = bert_worker_scratch_get(4 * batcher->options.encode.max_length);
+    bool ok = worker != NULL
+              && bert_batcher_encode(batcher, request->request_id, request->text, request->len, request->pair,
+                request->pair_len, &worker->scratch, worker->ids);
+
+    pthread_mutex_lock(&batcher->mutex);
+    if (!ok) {
+        // the caller already has the id, so the request is kept to report it
+        if (worker == NULL) batcher->stats.failed++;
+        request->next = batcher->failed;
+        batcher->failed = request;
+        batcher->num_failed++;
+    }
+    if (--batcher->in_flight == 0) pthread_cond_broadcast(&batcher->cond);
+    pthread_mutex_unlock(&batcher->mutex);
+    if (ok) free(request);
+}
+
+nlp_int64_t nlp_bert_batcher_add(bert_batcher_t *batcher,
+  const char *text,
+  nlp_size_t len,
+  const char *pair,
+  nlp_size_t pair_len) {
+    if (batcher == NULL || (text == NULL && len > 0) || (pair == NULL && pair_len > 0)) return -1;
+    pthread_mutex_lock(&batcher->mutex);
+    nlp_uint64_t request_id = batcher->next_request_id++;
+    batcher->stats.requests++;
+    pthread_mutex_unlock(&batcher->mutex);
+
+    if (batcher->options.encode.pool != NULL) {
+        bert_batcher_request_t *request =
+          (bert_batcher_request_t *)malloc(sizeof(bert_batcher_request_t) + len + pair_len);
+        if (request != NULL) {
+            char *copy = (char *)(request + 1);
+            if (len > 0) memcpy(copy, text, len);
+            if (pair_len > 0) memcpy(copy + len, pair, pair_len);
+            request->batcher = batcher;
+            request->request_id = request_id;
+            request->text = copy;
+            request->len = len;
+            request->pair = pair != NULL ? copy + len : NULL;
+            request->pair_len = pair_len;
+            struct thrdpool_task task = { bert_batcher_routine, request };
+            pthread_mutex_lock(&batcher->mutex);
+            batcher->in_flight++;
+            pthread_mutex_unlock(&batcher->mutex);
+            if (thrdpool_schedule(&task, batcher->options.encode.pool) == 0) return (nlp_int64_t)request_id;
+            pthread_mutex_lock(&batcher->mutex);
+            batcher->in_flight--;
+            pthread_mutex_unlock(&batcher->mutex);
+            free(request);
+        }
+        // encode here if the request can not go to the pool
+    }
+
+    bert_worker_scratch_t *worker = bert_worker_scratch_get(4 * batcher->options.encode.max_length);
+    bool ok = false;
+    if (worker != NULL) {
+        ok = bert_batcher_encode(batcher, request_id, text, len, pair, pair_len, &worker->scratch, worker->ids);
     } else {
-        fclose(vocab_file);
-        exit(1);
+        pthread_mutex_lock(&batcher->mutex);
+        batcher->stats.failed++;
+        pthread_mutex_unlock(&batcher->mutex);
     }
+    return ok ? (nlp_int64_t)request_id : -1;
+}
 
+static int bert_batch_row_compare(const void *a, const void *b) {
+    nlp_size_t len_a = (*(bert_batch_row_t *const *)a)->len;
+    nlp_size_t len_b = (*(bert_batch_row_t *const *)b)->len;
+    return len_a < len_b ? -1 : len_a > len_b;
+}
 
-    return tokenizer;
+/*
+    Turn the rows left in the buckets into batches, shortest first, each batch
+    taking rows while they fit max_tokens padded to the last (longest) one.
+    Called with the mutex held. Return false if out of memory, the rows not
+    packed yet stay in their buckets.
+*/
+static bool bert_batcher_pack(bert_batcher_t *batcher) {
+    for (nlp_size_t b = 0; b < batcher->num_buckets; b++) {
+        bert_batch_rows_t *bucket = batcher->buckets[b].rows;
+        if (bucket == NULL) continue;
+        // buckets are in length order already, only the rows of one bucket need sorting
+        qsort(bucket->rows, bucket->count, sizeof(bert_batch_row_t *), bert_batch_row_compare);
+        nlp_size_t begin = 0;
+        while (begin < bucket->count) {
+            nlp_size_t end = begin + 1;
+            while (end < bucket->count && end - begin < batcher->options.max_batch_size
+                   && (end - begin + 1) * bucket->rows[end]->len <= batcher->options.max_tokens)
+                end++;
+            bert_batch_rows_t *rows =
+              (bert_batch_rows_t *)malloc(sizeof(bert_batch_rows_t) + sizeof(bert_batch_row_t *) * (end - begin));
+            if (rows == NULL) {
+                memmove(bucket->rows, bucket->rows + begin, sizeof(bert_batch_row_t *) * (bucket->count - begin));
+                bucket->count -= begin;
+                return false;
+            }
+            rows->count = end - begin;
+            memcpy(rows->rows, bucket->rows + begin, sizeof(bert_batch_row_t *) * rows->count);
+            bert_batcher_push_ready(batcher, rows);
+            begin = end;
+        }
+        free(bucket);
+        batcher->buckets[b].rows = NULL;
+    }
+    return true;
+}
+
+/*
+    Copy the rows into padded tensors, the batch, its tensors and the ids of
+    the failed requests are one allocation. `rows` may be NULL for a batch
+    that only reports failed requests.
+*/
+static nlp_batch_t *bert_batcher_materialize(const bert_batch_rows_t *rows,
+  const bert_batcher_request_t *failed,
+  nlp_size_t num_failed) {
+    nlp_size_t count = rows != NULL ? rows->count : 0;
+    nlp_size_t seq_len = 0;
+    for (nlp_size_t i = 0; i < count; i++) {
+        if (rows->rows[i]->len > seq_len) seq_len = rows->rows[i]->len;
+    }
+    nlp_size_t size = count * seq_len;
+    nlp_batch_t *batch = (nlp_batch_t *)malloc(
+      sizeof(nlp_batch_t) + sizeof(nlp_uint64_t) * (count + num_failed) + sizeof(nlp_int32_t) * 3 * size);
+    if (batch == NULL) return NULL;
+    batch->batch_size = count;
+    batch->seq_len = seq_len;
+    batch->request_ids = (nlp_uint64_t *)(batch + 1);
+    batch->num_failed = num_failed;
+    batch->failed_ids = batch->request_ids + count;
+    batch->input_ids = (nlp_int32_t *)(batch->failed_ids + num_failed);
+    batch->attention_mask = batch->input_ids + size;
+    batch->token_type_ids = batch->attention_mask + size;
+    for (nlp_size_t i = 0; i < num_failed; i++, failed = failed->next) batch->failed_ids[i] = failed->request_id;
+    for (nlp_size_t i = 0; i < count; i++) {
+        const bert_batch_row_t *row = rows->rows[i];
+        nlp_int32_t *ids = batch->input_ids + i * seq_len;
+        nlp_int32_t *mask = batch->attention_mask + i * seq_len;
+        nlp_int32_t *types = batch->token_type_ids + i * seq_len;
+        batch->request_ids[i] = row->request_id;
+        memcpy(ids, row->ids, sizeof(nlp_int32_t) * row->len);
+        for (nlp_size_t j = row->len; j < seq_len; j++) ids[j] = row->pad_id;
+        for (nlp_size_t j = 0; j < seq_len; j++) {
+            mask[j] = j < row->len;
+            types[j] = j >= row->first_len && j < row->len;
+        }
+    }
+    return batch;
+}
+
+nlp_batch_t *nlp_bert_batcher_next(bert_batcher_t *batcher, bool flush) {
+    if (batcher == NULL) return NULL;
+    pthread_mutex_lock(&batcher->mutex);
+    if (flush) {
+        while (batcher->in_flight > 0) pthread_cond_wait(&batcher->cond, &batcher->mutex);
+        bert_batcher_pack(batcher);
+    }
+    bert_batch_rows_t *rows = batcher->ready_head;
+    if (rows != NULL) {
+        batcher->ready_head = rows->next;
+        if (batcher->ready_head == NULL) batcher->ready_tail = NULL;
+    }
+    bert_batcher_request_t *failed = batcher->failed;
+    nlp_size_t num_failed = batcher->num_failed;
+    batcher->failed = NULL;
+    batcher->num_failed = 0;
+    pthread_mutex_unlock(&batcher->mutex);
+    if (rows == NULL && failed == NULL) return NULL;
+
+    nlp_batch_t *batch = bert_batcher_materialize(rows, failed, num_failed);
+    pthread_mutex_lock(&batcher->mutex);
+    if (batch == NULL) {
+        // put the rows and the failed requests back to retry with the next call
+        if (rows != NULL) {
+            rows->next = batcher->ready_head;
+            batcher->ready_head = rows;
+            if (batcher->ready_tail == NULL) batcher->ready_tail = rows;
+        }
+        if (failed != NULL) {
+            bert_batcher_request_t *tail = failed;
+            while (tail->next != NULL) tail = tail->next;
+            tail->next = batcher->failed;
+            batcher->failed = failed;
+            batcher->num_failed += num_failed;
+        }
+    } else if (rows != NULL) {
+        nlp_uint64_t tokens = 0;
+        for (nlp_size_t i = 0; i < rows->count; i++) tokens += rows->rows[i]->len;
+        batcher->stats.batches++;
+        batcher->stats.tokens += tokens;
+        batcher->stats.padding += (nlp_uint64_t)batch->batch_size * batch->seq_len - tokens;
+    }
+    pthread_mutex_unlock(&batcher->mutex);
+    if (batch != NULL) {
+        if (rows != NULL) rows->next = NULL;
+        bert_batch_rows_free(rows);
+        bert_batcher_requests_free(failed);
+    }
+    return batch;
 }
+
+void nlp_bert_batcher_stats(bert_batcher_t *batcher, nlp_bert_batcher_stats_t *stats) {
+    if (batcher == NULL || stats == NULL) return;
+    pthread_mutex_lock(&batcher->mutex);
+    *stats = batcher->stats;
+    pthread_mutex_unlock(&batcher->mutex);
+}
+
+void nlp_batch_free(nlp_batch_t *batch) { free(batch); }
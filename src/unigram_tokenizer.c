@@ -0,0 +1,683 @@
+#include "tokenizer.h"
+
+#include "da_trie.h"
+#include "map.h"
+#include "readutils.h"
+#include "strutils.h"
+
+#include <float.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    SentencePiece Unigram model (T5, XLM-R, ALBERT, ...).
+
+    The .model file is a ModelProto protobuf, only the pieces, the model type,
+    byte fallback and the normalizer flags are read from it. The model's
+    precompiled normalization map is approximated by utf8proc NFKC, which is
+    what it is built from for the nfkc and nmt_nfkc rules.
+
+    Pieces are matched with common prefix search on a double-array trie.
+    Viterbi keeps one node per end position of the lattice, the best path
+    ending there, so a text of n bytes needs n + 1 nodes. Those and the
+    normalized text come from an arena that starts on the stack and grows
+    by blocks, which are all freed when the call returns.
+*/
+
+// ModelProto.SentencePiece.Type
+enum {
+    UNIGRAM_PIECE_NORMAL = 1,
+    UNIGRAM_PIECE_UNKNOWN = 2,
+    UNIGRAM_PIECE_CONTROL = 3,
+    UNIGRAM_PIECE_USER_DEFINED = 4,
+    UNIGRAM_PIECE_UNUSED = 5,
+    UNIGRAM_PIECE_BYTE = 6,
+};
+
+// TrainerSpec.ModelType
+#define UNIGRAM_MODEL_TYPE 1
+// SentencePiece's score for an unknown character is the lowest score minus this
+#define UNIGRAM_UNK_PENALTY 10.0f
+#define UNIGRAM_ARENA_INLINE_SIZE 8192
+// U+2581 LOWER ONE EIGHTH BLOCK, which stands for ' ' in pieces
+#define UNIGRAM_SPACE_SYMBOL "\xE2\x96\x81"
+#define UNIGRAM_SPACE_SYMBOL_LEN 3
+
+struct unigram_tokenizer
+{
+    // pieces, NUL terminated
+    char *pool;
+    nlp_uint32_t *offsets;
+    nlp_uint32_t *lens;
+    float *scores;
+    nlp_uint8_t *types;
+    nlp_uint32_t size;
+    // piece -> &offsets[id]
+    map_handle_t piece_map;
+    // normal and user defined pieces
+    da_trie_t trie;
+    nlp_int32_t unk_id;
+    float unk_score;
+    float max_score;
+    bool byte_fallback;
+    nlp_int32_t byte_ids[256];
+    char *unk_surface;
+    bool nfkc;
+    bool add_dummy_prefix;
+    bool remove_extra_whitespaces;
+    bool escape_whitespaces;
+};
+
+/* minimal protobuf wire format reader */
+enum { PB_VARINT = 0, PB_FIXED64 = 1, PB_BYTES = 2, PB_FIXED32 = 5 };
+
+typedef struct pb_reader
+{
+    const nlp_uint8_t *ptr;
+    const nlp_uint8_t *end;
+} pb_reader_t;
+
+typedef struct pb_field
+{
+    nlp_uint32_t number;
+    nlp_uint32_t wire_type;
+    nlp_uint64_t value;// PB_VARINT, PB_FIXED64 and PB_FIXED32
+    pb_reader_t bytes; // PB_BYTES
+} pb_field_t;
+
+static bool pb_varint(pb_reader_t *reader, nlp_uint64_t *value) {
+    nlp_uint64_t result = 0;
+    for (int shift = 0; shift < 64 && reader->ptr < reader->end; shift += 7) {
+        nlp_uint8_t byte = *reader->ptr++;
+        result |= (nlp_uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Return 1 and the next field, 0 at the end, -1 on malformed input */
+static int pb_next_field(pb_reader_t *reader, pb_field_t *field) {
+    if (reader->ptr >= reader->end) return 0;
+    nlp_uint64_t key;
+    if (!pb_varint(reader, &key)) return -1;
+    field->number = (nlp_uint32_t)(key >> 3);
+    field->wire_type = (nlp_uint32_t)(key & 7);
+    field->value = 0;
+    field->bytes.ptr = field->bytes.end = NULL;
+    switch (field->wire_type) {
+    case PB_VARINT:
+        return pb_varint(reader, &field->value) ? 1 : -1;
+    case PB_FIXED64:
+    case PB_FIXED32: {
+        nlp_size_t size = field->wire_type == PB_FIXED64 ? 8 : 4;
+        if ((nlp_size_t)(reader->end - reader->ptr) < size) return -1;
+        // little endian on the wire
+        for (nlp_size_t i = 0; i < size; i++) field->value |= (nlp_uint64_t)reader->ptr[i] << (8 * i);
+        reader->ptr += size;
+        return 1;
+    }
+    case PB_BYTES: {
+        nlp_uint64_t len;
+        if (!pb_varint(reader, &len) || len > (nlp_uint64_t)(reader->end - reader->ptr)) return -1;
+        field->bytes.ptr = reader->ptr;
+        field->bytes.end = reader->ptr + len;
+        reader->ptr += len;
+        return 1;
+    }
+    default:
+        return -1;
+    }
+}
+
+static float pb_float(const pb_field_t *field) {
+    nlp_uint32_t bits = (nlp_uint32_t)field->value;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* a piece as stored in the model */
+typedef struct unigram_piece
+{
+    const nlp_uint8_t *data;
+    nlp_size_t len;
+    float score;
+    nlp_uint8_t type;
+} unigram_piece_t;
+
+static bool unigram_parse_piece(pb_reader_t reader, unigram_piece_t *piece) {
+    piece->data = NULL;
+    piece->len = 0;
+    piece->score = 0.0f;
+    piece->type = UNIGRAM_PIECE_NORMAL;
+    pb_field_t field;
+    int ret;
+    while ((ret = pb_next_field(&reader, &field)) > 0) {
+        if (field.number == 1 && field.wire_type == PB_BYTES) {
+            piece->data = field.bytes.ptr;
+            piece->len = field.bytes.end - field.bytes.ptr;
+        } else if (field.number == 2 && field.wire_type == PB_FIXED32) {
+            piece->score = pb_float(&field);
+        } else if (field.number == 3 && field.wire_type == PB_VARINT) {
+            piece->type = (nlp_uint8_t)field.value;
+        }
+    }
+    return ret == 0 && piece->len < UINT32_MAX;
+}
+
+/* TrainerSpec, return false for a model that is not Unigram */
+static bool unigram_parse_trainer_spec(unigram_tokenizer_t *tokenizer, pb_reader_t reader) {
+    nlp_uint64_t model_type = UNIGRAM_MODEL_TYPE;
+    pb_field_t field;
+    int ret;
+    while ((ret = pb_next_field(&reader, &field)) > 0) {
+        if (field.number == 3 && field.wire_type == PB_VARINT) {
+            model_type = field.value;
+        } else if (field.number == 35 && field.wire_type == PB_VARINT) {
+            tokenizer->byte_fallback = field.value != 0;
+        } else if (field.number == 44 && field.wire_type == PB_BYTES) {
+            nlp_size_t len = field.bytes.end - field.bytes.ptr;
+            free(tokenizer->unk_surface);
+            tokenizer->unk_surface = (char *)malloc(len + 1);
+            if (tokenizer->unk_surface == NULL) return false;
+            memcpy(tokenizer->unk_surface, field.bytes.ptr, len);
+            tokenizer->unk_surface[len] = '\0';
+        }
+    }
+    return ret == 0 && model_type == UNIGRAM_MODEL_TYPE;
+}
+
+static bool unigram_parse_normalizer_spec(unigram_tokenizer_t *tokenizer, pb_reader_t reader) {
+    pb_field_t field;
+    int ret;
+    while ((ret = pb_next_field(&reader, &field)) > 0) {
+        if (field.number == 1 && field.wire_type == PB_BYTES) {
+            nlp_size_t len = field.bytes.end - field.bytes.ptr;
+            tokenizer->nfkc = !(len == 8 && memcmp(field.bytes.ptr, "identity", 8) == 0);
+        } else if (field.wire_type == PB_VARINT) {
+            if (field.number == 3) tokenizer->add_dummy_prefix = field.value != 0;
+            if (field.number == 4) tokenizer->remove_extra_whitespaces = field.value != 0;
+            if (field.number == 5) tokenizer->escape_whitespaces = field.value != 0;
+        }
+    }
+    return ret == 0;
+}
+
+typedef struct unigram_key
+{
+    const nlp_uint8_t *data;
+    nlp_size_t len;
+    nlp_int32_t id;
+} unigram_key_t;
+
+static int unigram_key_compare(const void *a, const void *b) {
+    const unigram_key_t *x = (const unigram_key_t *)a;
+    const unigram_key_t *y = (const unigram_key_t *)b;
+    int cmp = memcmp(x->data, y->data, x->len < y->len ? x->len : y->len);
+    if (cmp != 0) return cmp;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static bool unigram_build_trie(unigram_tokenizer_t *tokenizer) {
+    unigram_key_t *keys = (unigram_key_t *)malloc(sizeof(unigram_key_t) * (tokenizer->size + 1));
+    const nlp_uint8_t **key_data = (const nlp_uint8_t **)malloc(sizeof(nlp_uint8_t *) * (tokenizer->size + 1));
+    nlp_size_t *key_lens = (nlp_size_t *)malloc(sizeof(nlp_size_t) * (tokenizer->size + 1));
+    nlp_int32_t *values = (nlp_int32_t *)malloc(sizeof(nlp_int32_t) * (tokenizer->size + 1));
+    bool ok = keys != NULL && key_data != NULL && key_lens != NULL && values != NULL;
+    if (ok) {
+        nlp_size_t num_keys = 0;
+        for (nlp_uint32_t id = 0; id < tokenizer->size; id++) {
+            nlp_uint8_t type = tokenizer->types[id];
+            if ((type != UNIGRAM_PIECE_NORMAL && type != UNIGRAM_PIECE_USER_DEFINED) || tokenizer->lens[id] == 0)
+                continue;
+            keys[num_keys].data = (const nlp_uint8_t *)tokenizer->pool + tokenizer->offsets[id];
+            keys[num_keys].len = tokenizer->lens[id];
+            keys[num_keys].id = (nlp_int32_t)id;
+            num_keys++;
+        }
+        qsort(keys, num_keys, sizeof(unigram_key_t), unigram_key_compare);
+        // the first id of a duplicated piece wins
+        nlp_size_t n = 0;
+        for (nlp_size_t i = 0; i < num_keys; i++) {
+            if (n > 0 && key_lens[n - 1] == keys[i].len && memcmp(key_data[n - 1], keys[i].data, keys[i].len) == 0)
+                continue;
+            key_data[n] = keys[i].data;
+            key_lens[n] = keys[i].len;
+            values[n] = keys[i].id;
+            n++;
+        }
+        ok = da_trie_build(&tokenizer->trie, key_data, key_lens, values, n) == 0;
+    }
+    free(keys);
+    free(key_data);
+    free(key_lens);
+    free(values);
+    return ok;
+}
+
+/* "<0x41>" -> 0x41, -1 if the piece is not spelled like a byte */
+static int unigram_byte_piece_value(const char *piece, nlp_size_t len) {
+    if (len != 6 || memcmp(piece, "<0x", 3) != 0 || piece[5] != '>') return -1;
+    int value = 0;
+    for (int i = 3; i < 5; i++) {
+        char c = piece[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+static bool unigram_load(unigram_tokenizer_t *tokenizer, const nlp_uint8_t *data, nlp_size_t size) {
+    // first pass counts the pieces and sizes the pool, and reads the specs
+    pb_reader_t reader = { data, data + size };
+    pb_field_t field;
+    unigram_piece_t piece;
+    nlp_size_t num_pieces = 0;
+    nlp_size_t pool_size = 0;
+    int ret;
+    while ((ret = pb_next_field(&reader, &field)) > 0) {
+        if (field.wire_type != PB_BYTES) continue;
+        if (field.number == 1) {
+            if (!unigram_parse_piece(field.bytes, &piece)) return false;
+            num_pieces++;
+            pool_size += piece.len + 1;
+        } else if (field.number == 2) {
+            if (!unigram_parse_trainer_spec(tokenizer, field.bytes)) return false;
+        } else if (field.number == 3) {
+            if (!unigram_parse_normalizer_spec(tokenizer, field.bytes)) return false;
+        }
+    }
+    if (ret < 0 || num_pieces == 0 || num_pieces > INT32_MAX || pool_size > UINT32_MAX) return false;
+
+    tokenizer->size = (nlp_uint32_t)num_pieces;
+    tokenizer->pool = (char *)malloc(pool_size);
+    tokenizer->offsets = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_pieces);
+    tokenizer->lens = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_pieces);
+    tokenizer->scores = (float *)malloc(sizeof(float) * num_pieces);
+    tokenizer->types = (nlp_uint8_t *)malloc(num_pieces);
+    if (tokenizer->pool == NULL || tokenizer->offsets == NULL || tokenizer->lens == NULL || tokenizer->scores == NULL
+        || tokenizer->types == NULL)
+        return false;
+
+    reader.ptr = data;
+    nlp_uint32_t id = 0;
+    nlp_uint32_t offset = 0;
+    float min_score = FLT_MAX;
+    tokenizer->max_score = -FLT_MAX;
+    while (pb_next_field(&reader, &field) > 0) {
+        if (field.number != 1 || field.wire_type != PB_BYTES) continue;
+        unigram_parse_piece(field.bytes, &piece);
+        memcpy(tokenizer->pool + offset, piece.data, piece.len);
+        tokenizer->pool[offset + piece.len] = '\0';
+        tokenizer->offsets[id] = offset;
+        tokenizer->lens[id] = (nlp_uint32_t)piece.len;
+        tokenizer->scores[id] = piece.score;
+        tokenizer->types[id] = piece.type;
+        offset += (nlp_uint32_t)piece.len + 1;
+        if (piece.type == UNIGRAM_PIECE_NORMAL) {
+            if (piece.score < min_score) min_score = piece.score;
+            if (piece.score > tokenizer->max_score) tokenizer->max_score = piece.score;
+        } else if (piece.type == UNIGRAM_PIECE_UNKNOWN && tokenizer->unk_id < 0) {
+            tokenizer->unk_id = (nlp_int32_t)id;
+        } else if (piece.type == UNIGRAM_PIECE_BYTE) {
+            int byte = unigram_byte_piece_value(tokenizer->pool + tokenizer->offsets[id], piece.len);
+            if (byte >= 0) tokenizer->byte_ids[byte] = (nlp_int32_t)id;
+        }
+        id++;
+    }
+    if (tokenizer->unk_id < 0) return false;
+    if (min_score == FLT_MAX) min_score = 0.0f;
+    if (tokenizer->max_score == -FLT_MAX) tokenizer->max_score = 0.0f;
+    tokenizer->unk_score = min_score - UNIGRAM_UNK_PENALTY;
+
+    for (id = 0; id < tokenizer->size; id++) {
+        if (map_add(tokenizer->piece_map, tokenizer->pool + tokenizer->offsets[id], tokenizer->lens[id],
+              &tokenizer->offsets[id])
+            == NULL)
+            return false;
+    }
+    return unigram_build_trie(tokenizer);
+}
+
+unigram_tokenizer_t *nlp_unigram_tokenizer_create(const char *model_path) {
+    if (model_path == NULL) return NULL;
+    unigram_tokenizer_t *tokenizer = (unigram_tokenizer_t *)calloc(1, sizeof(unigram_tokenizer_t));
+    if (tokenizer == NULL) return NULL;
+    tokenizer->unk_id = -1;
+    for (int i = 0; i < 256; i++) tokenizer->byte_ids[i] = -1;
+    tokenizer->nfkc = true;
+    tokenizer->add_dummy_prefix = true;
+    tokenizer->remove_extra_whitespaces = true;
+    tokenizer->escape_whitespaces = true;
+
+    size_t size;
+    char *data = readfile(model_path, &size);
+    tokenizer->piece_map = map_create();
+    if (data == NULL || tokenizer->piece_map == NULL || !unigram_load(tokenizer, (const nlp_uint8_t *)data, size)) {
+        free(data);
+        nlp_unigram_tokenizer_destory(tokenizer);
+        return NULL;
+    }
+    free(data);
+    if (tokenizer->unk_surface == NULL) {
+        // TrainerSpec's default, " ⁇ "
+        static const char default_unk_surface[] = " \xE2\x81\x87 ";
+        tokenizer->unk_surface = (char *)malloc(sizeof(default_unk_surface));
+        if (tokenizer->unk_surface == NULL) {
+            nlp_unigram_tokenizer_destory(tokenizer);
+            return NULL;
+        }
+        memcpy(tokenizer->unk_surface, default_unk_surface, sizeof(default_unk_surface));
+    }
+    return tokenizer;
+}
+
+void nlp_unigram_tokenizer_destory(unigram_tokenizer_t *tokenizer) {
+    if (tokenizer == NULL) return;
+    if (tokenizer->piece_map != NULL) map_delete(tokenizer->piece_map, NULL, NULL);
+    da_trie_free(&tokenizer->trie);
+    free(tokenizer->pool);
+    free(tokenizer->offsets);
+    free(tokenizer->lens);
+    free(tokenizer->scores);
+    free(tokenizer->types);
+    free(tokenizer->unk_surface);
+    free(tokenizer);
+}
+
+nlp_size_t nlp_unigram_tokenizer_vocab_size(const unigram_tokenizer_t *tokenizer) { return tokenizer->size; }
+
+nlp_int32_t nlp_unigram_tokenizer_token_to_id(const unigram_tokenizer_t *tokenizer, const char *token, nlp_size_t len) {
+    const nlp_uint32_t *slot = (const nlp_uint32_t *)map_get(tokenizer->piece_map, (void *)token, len);
+    return slot != NULL ? (nlp_int32_t)(slot - tokenizer->offsets) : -1;
+}
+
+const char *nlp_unigram_tokenizer_id_to_token(const unigram_tokenizer_t *tokenizer, nlp_int32_t id) {
+    if (id < 0 || (nlp_uint32_t)id >= tokenizer->size) return NULL;
+    return tokenizer->pool + tokenizer->offsets[id];
+}
+
+typedef struct unigram_arena_block
+{
+    struct unigram_arena_block *prev;
+    nlp_size_t cap;
+    max_align_t data[];
+} unigram_arena_block_t;
+
+/* bump allocator for the memory of one call */
+typedef struct unigram_arena
+{
+    nlp_uint8_t *ptr;
+    nlp_size_t left;
+    nlp_size_t last_cap;
+    unigram_arena_block_t *blocks;
+    max_align_t inline_block[UNIGRAM_ARENA_INLINE_SIZE / sizeof(max_align_t)];
+} unigram_arena_t;
+
+static void unigram_arena_init(unigram_arena_t *arena) {
+    arena->ptr = (nlp_uint8_t *)arena->inline_block;
+    arena->left = sizeof(arena->inline_block);
+    arena->last_cap = sizeof(arena->inline_block);
+    arena->blocks = NULL;
+}
+
+static void *unigram_arena_alloc(unigram_arena_t *arena, nlp_size_t size) {
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    if (size > arena->left) {
+        nlp_size_t cap = 2 * arena->last_cap > size ? 2 * arena->last_cap : size;
+        unigram_arena_block_t *block = (unigram_arena_block_t *)malloc(sizeof(unigram_arena_block_t) + cap);
+        if (block == NULL) return NULL;
+        block->prev = arena->blocks;
+        block->cap = cap;
+        arena->blocks = block;
+        arena->ptr = (nlp_uint8_t *)block->data;
+        arena->left = cap;
+        arena->last_cap = cap;
+    }
+    void *ptr = arena->ptr;
+    arena->ptr += size;
+    arena->left -= size;
+    return ptr;
+}
+
+static void unigram_arena_free(unigram_arena_t *arena) {
+    while (arena->blocks != NULL) {
+        unigram_arena_block_t *prev = arena->blocks->prev;
+        free(arena->blocks);
+        arena->blocks = prev;
+    }
+}
+
+static inline bool unigram_is_space(const unigram_tokenizer_t *tokenizer, nlp_uint8_t c) {
+    // NFKC based rules treat tabs and line breaks as spaces
+    return c == ' ' || (tokenizer->nfkc && (c == '\t' || c == '\n' || c == '\r'));
+}
+
+/*
+    NFKC, then drop leading, trailing and repeated spaces, add the dummy
+    prefix and replace spaces by U+2581, as configured by the model.
+    Return NULL if failed.
+*/
+static nlp_uint8_t *unigram_normalize(const unigram_tokenizer_t *tokenizer,
+  unigram_arena_t *arena,
+  const nlp_uint8_t *text,
+  nlp_size_t len,
+  nlp_size_t *out_len) {
+    const nlp_uint8_t *src = text;
+    nlp_size_t src_len = len;
+    bool ascii = true;
+    for (nlp_size_t i = 0; i < len && ascii; i++) ascii = text[i] < 0x80;
+    if (tokenizer->nfkc && !ascii) {
+        // ASCII is NFKC already, other text is decomposed to code points and composed again in place
+        utf8proc_option_t options = UTF8PROC_STABLE | UTF8PROC_COMPOSE | UTF8PROC_COMPAT;
+        utf8proc_ssize_t n = utf8proc_decompose(text, (utf8proc_ssize_t)len, NULL, 0, options);
+        if (n >= 0) {
+            utf8proc_int32_t *buffer =
+              (utf8proc_int32_t *)unigram_arena_alloc(arena, sizeof(utf8proc_int32_t) * (n + 1));
+            if (buffer == NULL) return NULL;
+            utf8proc_decompose(text, (utf8proc_ssize_t)len, buffer, n, options);
+            n = utf8proc_reencode(buffer, n, options);
+            if (n >= 0) {
+                src = (const nlp_uint8_t *)buffer;
+                src_len = (nlp_size_t)n;
+            }
+        }
+    }
+
+    nlp_uint8_t *out = (nlp_uint8_t *)unigram_arena_alloc(arena, UNIGRAM_SPACE_SYMBOL_LEN * (src_len + 1));
+    if (out == NULL) return NULL;
+    const char *space = tokenizer->escape_whitespaces ? UNIGRAM_SPACE_SYMBOL : " ";
+    nlp_size_t space_len = tokenizer->escape_whitespaces ? UNIGRAM_SPACE_SYMBOL_LEN : 1;
+    nlp_size_t n = 0;
+    bool started = false;
+    bool pending_space = false;
+    for (nlp_size_t i = 0; i < src_len; i++) {
+        bool is_space = unigram_is_space(tokenizer, src[i]);
+        if (is_space && tokenizer->remove_extra_whitespaces) {
+            pending_space = started;
+            continue;
+        }
+        if (!started) {
+            started = true;
+            if (tokenizer->add_dummy_prefix) {
+                memcpy(out + n, space, space_len);
+                n += space_len;
+            }
+        }
+        if (pending_space || is_space) {
+            memcpy(out + n, space, space_len);
+            n += space_len;
+            pending_space = false;
+        }
+        if (!is_space) out[n++] = src[i];
+    }
+    *out_len = n;
+    return out;
+}
+
+/* the best path to an end position of the lattice */
+typedef struct unigram_node
+{
+    float score;
+    nlp_int32_t start;// -1 if no path ends here
+    nlp_int32_t id;
+} unigram_node_t;
+
+static inline void unigram_relax(unigram_node_t *node, float score, nlp_size_t start, nlp_int32_t id) {
+    if (node->start < 0 || score > node->score) {
+        node->score = score;
+        node->start = (nlp_int32_t)start;
+        node->id = id;
+    }
+}
+
+static inline void unigram_emit(nlp_int32_t id, nlp_int32_t *ids, nlp_size_t max_ids, nlp_size_t *count) {
+    if (*count < max_ids) ids[*count] = id;
+    (*count)++;
+}
+
+/* emit the best path, runs of unknown characters become one <unk> or, with byte fallback, their bytes */
+static void unigram_emit_path(const unigram_tokenizer_t *tokenizer,
+  const nlp_uint8_t *text,
+  const unigram_node_t *nodes,
+  nlp_int32_t *path,
+  nlp_size_t end,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids,
+  nlp_size_t *count) {
+    nlp_size_t num_nodes = 0;
+    for (nlp_size_t pos = end; pos > 0; pos = (nlp_size_t)nodes[pos].start) path[num_nodes++] = (nlp_int32_t)pos;
+    bool prev_unk = false;
+    while (num_nodes > 0) {
+        const unigram_node_t *node = &nodes[path[--num_nodes]];
+        if (node->id != tokenizer->unk_id) {
+            unigram_emit(node->id, ids, max_ids, count);
+            prev_unk = false;
+        } else if (tokenizer->byte_fallback) {
+            for (nlp_size_t i = (nlp_size_t)node->start; i < (nlp_size_t)path[num_nodes]; i++) {
+                nlp_int32_t id = tokenizer->byte_ids[text[i]];
+                unigram_emit(id >= 0 ? id : tokenizer->unk_id, ids, max_ids, count);
+            }
+        } else if (!prev_unk) {
+            unigram_emit(node->id, ids, max_ids, count);
+            prev_unk = true;
+        }
+    }
+}
+
+nlp_ssize_t nlp_unigram_tokenizer_encode(const unigram_tokenizer_t *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids) {
+    if (tokenizer == NULL || (text == NULL && len > 0)) return -1;
+    unigram_arena_t arena;
+    unigram_arena_init(&arena);
+    nlp_ssize_t ret = -1;
+    nlp_size_t n = 0;
+    const nlp_uint8_t *normalized = unigram_normalize(tokenizer, &arena, (const nlp_uint8_t *)text, len, &n);
+    unigram_node_t *nodes = (unigram_node_t *)unigram_arena_alloc(&arena, sizeof(unigram_node_t) * (n + 1));
+    nlp_int32_t *path = (nlp_int32_t *)unigram_arena_alloc(&arena, sizeof(nlp_int32_t) * (n + 1));
+    da_trie_match_t *matches =
+      (da_trie_match_t *)unigram_arena_alloc(&arena, sizeof(da_trie_match_t) * (tokenizer->trie.max_key_len + 1));
+    if (normalized == NULL || nodes == NULL || path == NULL || matches == NULL) goto done;
+    if (n > INT32_MAX) goto done;
+
+    nodes[0].score = 0.0f;
+    nodes[0].start = 0;
+    nodes[0].id = -1;
+    for (nlp_size_t i = 1; i <= n; i++) nodes[i].start = -1;
+    for (nlp_size_t pos = 0; pos < n; pos++) {
+        if (nodes[pos].start < 0) continue;
+        nlp_int32_t codepoint;
+        nlp_ssize_t char_len = utf8proc_iterate(normalized + pos, n - pos, &codepoint);
+        if (char_len < 1) char_len = 1;
+        float score = nodes[pos].score;
+        bool has_single_char = false;
+        nlp_size_t num_matches = da_trie_prefix_search(&tokenizer->trie, normalized + pos, n - pos, matches);
+        for (nlp_size_t i = 0; i < num_matches; i++) {
+            nlp_int32_t id = matches[i].value;
+            nlp_size_t match_len = matches[i].len;
+            // user defined pieces always win over the pieces inside them
+            float piece_score = tokenizer->types[id] == UNIGRAM_PIECE_USER_DEFINED
+                                  ? match_len * tokenizer->max_score - 0.1f
+                                  : tokenizer->scores[id];
+            unigram_relax(&nodes[pos + match_len], score + piece_score, pos, id);
+            has_single_char |= match_len == (nlp_size_t)char_len;
+        }
+        if (!has_single_char)
+            unigram_relax(&nodes[pos + char_len], score + tokenizer->unk_score, pos, tokenizer->unk_id);
+    }
+
+    nlp_size_t count = 0;
+    unigram_emit_path(tokenizer, normalized, nodes, path, n, ids, max_ids, &count);
+    ret = (nlp_ssize_t)count;
+
+done:
+    unigram_arena_free(&arena);
+    return ret;
+}
+
+static inline void unigram_put(char *out, nlp_size_t out_cap, nlp_size_t *n, const void *data, nlp_size_t len) {
+    if (*n < out_cap) memcpy(out + *n, data, len < out_cap - *n ? len : out_cap - *n);
+    *n += len;
+}
+
+nlp_ssize_t nlp_unigram_tokenizer_decode(const unigram_tokenizer_t *tokenizer,
+  const nlp_int32_t *ids,
+  nlp_size_t num_ids,
+  char *out,
+  nlp_size_t out_cap) {
+    if (tokenizer == NULL || (ids == NULL && num_ids > 0) || (out == NULL && out_cap > 0)) return -1;
+    nlp_size_t n = 0;
+    bool first = true;
+    for (nlp_size_t i = 0; i < num_ids; i++) {
+        nlp_int32_t id = ids[i];
+        if (id < 0 || (nlp_uint32_t)id >= tokenizer->size) return -1;
+        const char *piece = tokenizer->pool + tokenizer->offsets[id];
+        nlp_size_t len = tokenizer->lens[id];
+        switch (tokenizer->types[id]) {
+        case UNIGRAM_PIECE_CONTROL:
+        case UNIGRAM_PIECE_UNUSED:
+            continue;
+        case UNIGRAM_PIECE_UNKNOWN:
+            unigram_put(out, out_cap, &n, tokenizer->unk_surface, strlen(tokenizer->unk_surface));
+            break;
+        case UNIGRAM_PIECE_BYTE: {
+            int byte = unigram_byte_piece_value(piece, len);
+            nlp_uint8_t value = (nlp_uint8_t)byte;
+            if (byte >= 0) unigram_put(out, out_cap, &n, &value, 1);
+            break;
+        }
+        default: {
+            const char *end = piece + len;
+            // the dummy prefix of the first piece is not part of the text
+            if (first && tokenizer->add_dummy_prefix && len >= UNIGRAM_SPACE_SYMBOL_LEN
+                && memcmp(piece, UNIGRAM_SPACE_SYMBOL, UNIGRAM_SPACE_SYMBOL_LEN) == 0)
+                piece += UNIGRAM_SPACE_SYMBOL_LEN;
+            while (piece < end) {
+                const char *space = strstr(piece, UNIGRAM_SPACE_SYMBOL);
+                if (space == NULL || space >= end) space = end;
+                unigram_put(out, out_cap, &n, piece, space - piece);
+                if (space == end) break;
+                unigram_put(out, out_cap, &n, " ", 1);
+                piece = space + UNIGRAM_SPACE_SYMBOL_LEN;
+            }
+            break;
+        }
+        }
+        first = false;
+    }
+    if (n < out_cap) out[n] = '\0';
+    return (nlp_ssize_t)n;
+}
@@ -0,0 +1,223 @@
+#include "word_cache.h"
+
+#include "hash/xxhash.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD_CACHE_WAYS 8
+#define WORD_CACHE_KEY_WORDS (WORD_CACHE_MAX_WORD_LEN / sizeof(nlp_uint64_t))
+// hits and misses are counted in this many cache lines, picked by set
+#define WORD_CACHE_STRIPES 16
+// a reader that keeps racing writers gives up and reports a miss
+#define WORD_CACHE_READ_TRIES 4
+
+/*
+    A cached word. Every field is an atomic read with relaxed loads, a reader
+    copies what it needs and the sequence number of the set tells it whether
+    a writer changed the slot meanwhile. The key is zero padded to whole words.
+*/
+typedef struct word_cache_slot
+{
+    atomic_uint_least64_t hash;
+    // key_len << 8 | num_ids, 0 for an empty slot
+    atomic_uint_least32_t meta;
+    // set by hits, cleared by the clock hand of the LRU policy
+    atomic_uchar referenced;
+    atomic_uint_least64_t key[WORD_CACHE_KEY_WORDS];
+    atomic_int_least32_t ids[WORD_CACHE_MAX_IDS];
+} word_cache_slot_t;
+
+typedef struct word_cache_set
+{
+    // odd while a writer changes the set, writers that find it odd give up
+    atomic_uint seq;
+    // next way the eviction looks at, only used by the writer holding seq
+    nlp_uint32_t hand;
+    word_cache_slot_t slots[WORD_CACHE_WAYS];
+} word_cache_set_t;
+
+typedef struct word_cache_counter
+{
+    atomic_uint_least64_t hits;
+    atomic_uint_least64_t misses;
+    char padding[64 - 2 * sizeof(atomic_uint_least64_t)];
+} word_cache_counter_t;
+
+struct word_cache
+{
+    nlp_cache_policy_t policy;
+    nlp_size_t num_sets;
+    nlp_size_t num_ways;
+    word_cache_set_t *sets;
+    atomic_size_t size;
+    atomic_uint_least64_t evictions;
+    word_cache_counter_t counters[WORD_CACHE_STRIPES];
+};
+
+word_cache_t *word_cache_create(nlp_size_t capacity, nlp_cache_policy_t policy) {
+    if (capacity == 0) return NULL;
+    word_cache_t *cache = (word_cache_t *)calloc(1, sizeof(word_cache_t));
+    if (cache == NULL) return NULL;
+    cache->policy = policy;
+    // a small cache is a single set with fewer ways, a larger one is rounded down to whole sets
+    cache->num_ways = capacity < WORD_CACHE_WAYS ? capacity : WORD_CACHE_WAYS;
+    cache->num_sets = capacity / cache->num_ways;
+    if (cache->num_sets > UINT32_MAX) cache->num_sets = UINT32_MAX;
+    cache->sets = (word_cache_set_t *)calloc(cache->num_sets, sizeof(word_cache_set_t));
+    if (cache->sets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    atomic_init(&cache->size, 0);
+    atomic_init(&cache->evictions, 0);
+    return cache;
+}
+
+void word_cache_destroy(word_cache_t *cache) {
+    if (cache == NULL) return;
+    free(cache->sets);
+    free(cache);
+}
+
+nlp_uint64_t word_cache_hash(const nlp_uint8_t *word, nlp_size_t len) { return XXH3_64bits(word, len); }
+
+/* the hash of a word picks its set from the high bits and tells slots apart */
+static inline nlp_size_t word_cache_set_index(const word_cache_t *cache, nlp_uint64_t hash) {
+    return (nlp_size_t)(((hash >> 32) * (nlp_uint64_t)cache->num_sets) >> 32);
+}
+
+static inline void word_cache_load_key(nlp_uint64_t *key, const nlp_uint8_t *word, nlp_size_t len) {
+    memset(key, 0, sizeof(nlp_uint64_t) * WORD_CACHE_KEY_WORDS);
+    memcpy(key, word, len);
+}
+
+static inline bool word_cache_key_equal(word_cache_slot_t *slot, const nlp_uint64_t *key, nlp_size_t num_words) {
+    for (nlp_size_t k = 0; k < num_words; k++) {
+        if (atomic_load_explicit(&slot->key[k], memory_order_relaxed) != key[k]) return false;
+    }
+    return true;
+}
+
+nlp_ssize_t word_cache_get(word_cache_t *cache,
+  nlp_uint64_t hash,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t cap) {
+    if (len == 0 || len > WORD_CACHE_MAX_WORD_LEN) return -1;
+    nlp_size_t index = word_cache_set_index(cache, hash);
+    word_cache_set_t *set = &cache->sets[index];
+    word_cache_counter_t *counter = &cache->counters[index % WORD_CACHE_STRIPES];
+    nlp_uint64_t key[WORD_CACHE_KEY_WORDS];
+    word_cache_load_key(key, word, len);
+    nlp_size_t num_words = (len + sizeof(nlp_uint64_t) - 1) / sizeof(nlp_uint64_t);
+
+    for (int tries = 0; tries < WORD_CACHE_READ_TRIES; tries++) {
+        unsigned int seq = atomic_load_explicit(&set->seq, memory_order_acquire);
+        if (seq & 1) break;
+        nlp_int32_t found[WORD_CACHE_MAX_IDS];
+        nlp_ssize_t n = -1;
+        word_cache_slot_t *hit = NULL;
+        for (nlp_size_t way = 0; way < cache->num_ways; way++) {
+            word_cache_slot_t *slot = &set->slots[way];
+            if (atomic_load_explicit(&slot->hash, memory_order_relaxed) != hash) continue;
+            nlp_uint32_t meta = atomic_load_explicit(&slot->meta, memory_order_relaxed);
+            if ((meta >> 8) != len || (meta & 0xFF) > WORD_CACHE_MAX_IDS) continue;
+            if (!word_cache_key_equal(slot, key, num_words)) continue;
+            n = (nlp_ssize_t)(meta & 0xFF);
+            for (nlp_ssize_t k = 0; k < n; k++) found[k] = atomic_load_explicit(&slot->ids[k], memory_order_relaxed);
+            hit = slot;
+            break;
+        }
+        // what was read is only a consistent copy if no writer started since
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&set->seq, memory_order_relaxed) != seq) continue;
+        if (n < 0) break;
+
+        if (cache->policy == NLP_CACHE_LRU && !atomic_load_explicit(&hit->referenced, memory_order_relaxed))
+            atomic_store_explicit(&hit->referenced, 1, memory_order_relaxed);
+        memcpy(ids, found, sizeof(nlp_int32_t) * ((nlp_size_t)n < cap ? (nlp_size_t)n : cap));
+        atomic_fetch_add_explicit(&counter->hits, 1, memory_order_relaxed);
+        return n;
+    }
+    atomic_fetch_add_explicit(&counter->misses, 1, memory_order_relaxed);
+    return -1;
+}
+
+/* an empty way, else the next one the clock hand finds unreferenced (LRU) or the oldest one (FIFO) */
+static nlp_size_t word_cache_victim(word_cache_t *cache, word_cache_set_t *set) {
+    for (nlp_size_t way = 0; way < cache->num_ways; way++) {
+        if (atomic_load_explicit(&set->slots[way].meta, memory_order_relaxed) == 0) return way;
+    }
+    nlp_size_t way = set->hand;
+    if (cache->policy == NLP_CACHE_LRU) {
+        // each way loses its reference on the first pass, so the second one finds a victim
+        for (nlp_size_t k = 0; k < 2 * cache->num_ways; k++) {
+            if (!atomic_load_explicit(&set->slots[way].referenced, memory_order_relaxed)) break;
+            atomic_store_explicit(&set->slots[way].referenced, 0, memory_order_relaxed);
+            way = (way + 1) % cache->num_ways;
+        }
+    }
+    set->hand = (nlp_uint32_t)((way + 1) % cache->num_ways);
+    return way;
+}
+
+void word_cache_put(word_cache_t *cache,
+  nlp_uint64_t hash,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  const nlp_int32_t *ids,
+  nlp_size_t n) {
+    if (len == 0 || len > WORD_CACHE_MAX_WORD_LEN || n > WORD_CACHE_MAX_IDS) return;
+    word_cache_set_t *set = &cache->sets[word_cache_set_index(cache, hash)];
+    unsigned int seq = atomic_load_explicit(&set->seq, memory_order_relaxed);
+    // a set another thread is writing is skipped, the word is cached some other time
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&set->seq, &seq, seq + 1, memory_order_acquire,
+                       memory_order_relaxed))
+        return;
+    // readers that see any of the stores below also see the odd sequence number
+    atomic_thread_fence(memory_order_release);
+
+    nlp_uint64_t key[WORD_CACHE_KEY_WORDS];
+    word_cache_load_key(key, word, len);
+    nlp_size_t num_words = (len + sizeof(nlp_uint64_t) - 1) / sizeof(nlp_uint64_t);
+    nlp_uint32_t meta = (nlp_uint32_t)(len << 8 | n);
+    for (nlp_size_t way = 0; way < cache->num_ways; way++) {
+        word_cache_slot_t *slot = &set->slots[way];
+        if (atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash
+            && atomic_load_explicit(&slot->meta, memory_order_relaxed) == meta
+            && word_cache_key_equal(slot, key, num_words)) {
+            // another thread added the word first
+            atomic_store_explicit(&set->seq, seq + 2, memory_order_release);
+            return;
+        }
+    }
+
+    word_cache_slot_t *slot = &set->slots[word_cache_victim(cache, set)];
+    if (atomic_load_explicit(&slot->meta, memory_order_relaxed) != 0)
+        atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&cache->size, 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&slot->meta, meta, memory_order_relaxed);
+    // a word has to be hit once to outlive the next pass of the clock hand
+    atomic_store_explicit(&slot->referenced, 0, memory_order_relaxed);
+    for (nlp_size_t k = 0; k < WORD_CACHE_KEY_WORDS; k++)
+        atomic_store_explicit(&slot->key[k], key[k], memory_order_relaxed);
+    for (nlp_size_t k = 0; k < n; k++) atomic_store_explicit(&slot->ids[k], ids[k], memory_order_relaxed);
+    atomic_store_explicit(&set->seq, seq + 2, memory_order_release);
+}
+
+void word_cache_stats(word_cache_t *cache, nlp_cache_stats_t *stats) {
+    stats->hits = 0;
+    stats->misses = 0;
+    for (nlp_size_t i = 0; i < WORD_CACHE_STRIPES; i++) {
+        stats->hits += atomic_load_explicit(&cache->counters[i].hits, memory_order_relaxed);
+        stats->misses += atomic_load_explicit(&cache->counters[i].misses, memory_order_relaxed);
+    }
+    stats->evictions = atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+    stats->capacity = cache->num_sets * cache->num_ways;
+    stats->size = atomic_load_explicit(&cache->size, memory_order_relaxed);
+}
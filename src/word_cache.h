@@ -0,0 +1,50 @@
+#ifndef __WORD_CACHE_H
+#define __WORD_CACHE_H
+
+#include "common.h"
+#include "tokenizer.h"
+
+/*
+    Bounded cache from a normalized word to its wordpiece ids, shared by all
+    threads encoding with a model. It is a set associative table of fixed
+    size slots: the hash of a word picks a set of 8 ways, so nothing is
+    allocated per word. Lookups take no lock, a sequence number per set
+    tells a reader whether a writer changed the set while it was reading,
+    and a writer that finds the set busy skips the word. LRU is approximated
+    with a clock hand per set. Only words up to WORD_CACHE_MAX_WORD_LEN bytes
+    and WORD_CACHE_MAX_IDS ids are cached, longer words are rare and cheap to
+    encode relative to their length.
+*/
+
+#define WORD_CACHE_MAX_WORD_LEN 64
+#define WORD_CACHE_MAX_IDS 16
+
+typedef struct word_cache word_cache_t;
+
+/* Return NULL if failed or capacity is 0. The capacity is rounded down to whole sets. */
+word_cache_t *word_cache_create(nlp_size_t capacity, nlp_cache_policy_t policy);
+void word_cache_destroy(word_cache_t *cache);
+
+/* The hash word_cache_get and word_cache_put take, computed once per word */
+nlp_uint64_t word_cache_hash(const nlp_uint8_t *word, nlp_size_t len);
+/*
+    Copy at most `cap` ids of a cached word to `ids`.
+    Return the number of ids of the word, -1 if it is not cached.
+*/
+nlp_ssize_t word_cache_get(word_cache_t *cache,
+  nlp_uint64_t hash,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t cap);
+/* Add a word, evicting another one of its set if the set is full. Failing to add is not an error. */
+void word_cache_put(word_cache_t *cache,
+  nlp_uint64_t hash,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  const nlp_int32_t *ids,
+  nlp_size_t n);
+
+void word_cache_stats(word_cache_t *cache, nlp_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,353 @@
+#include "wordpiece.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __GNUC__
+#define __builtin_expect(EXP, C) (EXP)
+#endif
+
+/* trie used while building, children are kept in a sorted sibling list */
+typedef struct build_node
+{
+    nlp_uint32_t first_child;
+    nlp_uint32_t next_sibling;
+    nlp_int32_t token;
+    nlp_uint8_t label;
+} build_node_t;
+
+typedef struct build_trie
+{
+    build_node_t *nodes;
+    nlp_uint32_t len;
+    nlp_uint32_t cap;
+} build_trie_t;
+
+static nlp_uint32_t build_trie_new_node(build_trie_t *trie, nlp_uint8_t label) {
+    if (trie->len == trie->cap) {
+        nlp_uint32_t cap = trie->cap ? trie->cap * 2 : 1024;
+        build_node_t *nodes = (build_node_t *)realloc(trie->nodes, sizeof(build_node_t) * cap);
+        if (nodes == NULL) return WORDPIECE_NULL_NODE;
+        trie->nodes = nodes;
+        trie->cap = cap;
+    }
+    build_node_t *node = &trie->nodes[trie->len];
+    node->first_child = WORDPIECE_NULL_NODE;
+    node->next_sibling = WORDPIECE_NULL_NODE;
+    node->token = -1;
+    node->label = label;
+    return trie->len++;
+}
+
+static bool build_trie_insert(build_trie_t *trie,
+  nlp_uint32_t node,
+  const nlp_uint8_t *key,
+  nlp_size_t len,
+  nlp_int32_t token) {
+    for (nlp_size_t i = 0; i < len; i++) {
+        nlp_uint8_t c = key[i];
+        nlp_uint32_t prev = WORDPIECE_NULL_NODE;
+        nlp_uint32_t child = trie->nodes[node].first_child;
+        while (child != WORDPIECE_NULL_NODE && trie->nodes[child].label < c) {
+            prev = child;
+            child = trie->nodes[child].next_sibling;
+        }
+        if (child == WORDPIECE_NULL_NODE || trie->nodes[child].label != c) {
+            nlp_uint32_t new_node = build_trie_new_node(trie, c);
+            if (new_node == WORDPIECE_NULL_NODE) return false;
+            trie->nodes[new_node].next_sibling = child;
+            if (prev == WORDPIECE_NULL_NODE)
+                trie->nodes[node].first_child = new_node;
+            else
+                trie->nodes[prev].next_sibling = new_node;
+            child = new_node;
+        }
+        node = child;
+    }
+    trie->nodes[node].token = token;
+    return true;
+}
+
+static inline nlp_uint32_t wordpiece_goto(const wordpiece_t *wp, nlp_uint32_t node, nlp_uint8_t c) {
+    const wordpiece_node_t *n = &wp->nodes[node];
+    const nlp_uint8_t *labels = wp->edge_labels + n->edge_begin;
+    nlp_uint32_t lo = 0;
+    nlp_uint32_t hi = n->edge_count;
+    // the roots fan out to a lot of bytes, other nodes usually have a few children
+    while (hi - lo > 8) {
+        nlp_uint32_t mid = (lo + hi) / 2;
+        if (labels[mid] <= c)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    for (; lo < hi; lo++) {
+        if (labels[lo] == c) return wp->edge_targets[n->edge_begin + lo];
+        if (labels[lo] > c) break;
+    }
+    return WORDPIECE_NULL_NODE;
+}
+
+/* growable id array for the failure pops */
+typedef struct pops_buffer
+{
+    nlp_int32_t *data;
+    nlp_uint32_t len;
+    nlp_uint32_t cap;
+} pops_buffer_t;
+
+static bool pops_buffer_reserve(pops_buffer_t *buf, nlp_uint32_t len) {
+    if (buf->len + len <= buf->cap) return true;
+    nlp_uint32_t cap = buf->cap ? buf->cap : 1024;
+    while (cap < buf->len + len) cap *= 2;
+    nlp_int32_t *data = (nlp_int32_t *)realloc(buf->data, sizeof(nlp_int32_t) * cap);
+    if (data == NULL) return false;
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+static bool pops_buffer_append(pops_buffer_t *buf, nlp_int32_t id) {
+    if (!pops_buffer_reserve(buf, 1)) return false;
+    buf->data[buf->len++] = id;
+    return true;
+}
+
+/* append a range of the buffer to itself */
+static bool pops_buffer_repeat(pops_buffer_t *buf, nlp_uint32_t begin, nlp_uint32_t len) {
+    // the buffer is still NULL for a vocab without continuation pieces
+    if (len == 0) return true;
+    if (!pops_buffer_reserve(buf, len)) return false;
+    memmove(buf->data + buf->len, buf->data + begin, sizeof(nlp_int32_t) * len);
+    buf->len += len;
+    return true;
+}
+
+/*
+    Renumber the build trie in BFS order starting from both roots, so that
+    parents come before children and shorter strings before longer ones,
+    then compute the failure links and pops in that order.
+*/
+static wordpiece_t *wordpiece_freeze(const build_trie_t *trie,
+  const nlp_uint16_t *piece_lens,
+  nlp_uint32_t num_tokens,
+  nlp_int32_t unk_id) {
+    nlp_uint32_t num_nodes = trie->len;
+    nlp_uint32_t num_edges = num_nodes - 2;
+    wordpiece_t *wp = NULL;
+    nlp_uint32_t *order = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_nodes);
+    nlp_uint32_t *parent = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_nodes);
+    nlp_uint32_t *fail = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_nodes);
+    nlp_uint32_t *pops_begin = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_nodes);
+    nlp_uint32_t *pops_len = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * num_nodes);
+    nlp_uint8_t *labels = (nlp_uint8_t *)malloc(num_edges + 1);
+    wordpiece_node_t *nodes = (wordpiece_node_t *)malloc(sizeof(wordpiece_node_t) * num_nodes);
+    nlp_uint32_t *targets = (nlp_uint32_t *)malloc(sizeof(nlp_uint32_t) * (num_edges + 1));
+    pops_buffer_t pops = { NULL, 0, 0 };
+    if (!order || !parent || !fail || !pops_begin || !pops_len || !labels || !nodes || !targets) goto cleanup;
+
+    // BFS, order[new index] = build index, the edge of a node is its new index - 2
+    order[0] = 0;
+    order[1] = 1;
+    parent[0] = parent[1] = WORDPIECE_NULL_NODE;
+    nlp_uint32_t tail = 2;
+    for (nlp_uint32_t head = 0; head < num_nodes; head++) {
+        const build_node_t *bn = &trie->nodes[order[head]];
+        nodes[head].edge_begin = tail - 2;
+        nodes[head].edge_count = 0;
+        for (nlp_uint32_t c = bn->first_child; c != WORDPIECE_NULL_NODE; c = trie->nodes[c].next_sibling) {
+            labels[tail - 2] = trie->nodes[c].label;
+            targets[tail - 2] = tail;
+            parent[tail] = head;
+            order[tail++] = c;
+            nodes[head].edge_count++;
+        }
+    }
+
+    wp = (wordpiece_t *)malloc(sizeof(wordpiece_t));
+    if (wp == NULL) goto cleanup;
+    wp->nodes = nodes;
+    wp->edge_labels = labels;
+    wp->edge_targets = targets;
+    wp->num_nodes = num_nodes;
+    wp->num_edges = num_edges;
+    wp->root = 0;
+    wp->suffix_root = 1;
+    wp->unk_id = unk_id;
+    wp->max_input_chars_per_word = WORDPIECE_MAX_INPUT_CHARS_PER_WORD;
+
+    fail[0] = fail[1] = WORDPIECE_NULL_NODE;
+    pops_begin[0] = pops_begin[1] = 0;
+    pops_len[0] = pops_len[1] = 0;
+    for (nlp_uint32_t v = 2; v < num_nodes; v++) {
+        nlp_int32_t token = trie->nodes[order[v]].token;
+        pops_begin[v] = pops.len;
+        if (token >= 0) {
+            // a token matches as a whole and the rest continues as a suffix
+            if (!pops_buffer_append(&pops, token)) goto error;
+            fail[v] = wp->suffix_root;
+            pops_len[v] = 1;
+            continue;
+        }
+        // F(v) = F(u) + F(z1) + F(z2) ..., following failure links of the parent u
+        // until one of them can be extended by the label of v
+        nlp_uint32_t u = parent[v];
+        nlp_uint8_t c = labels[v - 2];
+        nlp_uint32_t z = fail[u];
+        if (!pops_buffer_repeat(&pops, pops_begin[u], pops_len[u])) goto error;
+        while (z != WORDPIECE_NULL_NODE && wordpiece_goto(wp, z, c) == WORDPIECE_NULL_NODE) {
+            if (!pops_buffer_repeat(&pops, pops_begin[z], pops_len[z])) goto error;
+            z = fail[z];
+        }
+        if (z != WORDPIECE_NULL_NODE) {
+            fail[v] = wordpiece_goto(wp, z, c);
+            pops_len[v] = pops.len - pops_begin[v];
+        } else {
+            fail[v] = WORDPIECE_NULL_NODE;
+            pops_len[v] = 0;
+            pops.len = pops_begin[v];
+        }
+    }
+
+    for (nlp_uint32_t v = 0; v < num_nodes; v++) {
+        nodes[v].fail = fail[v];
+        nodes[v].pops_begin = pops_begin[v];
+        nodes[v].pops_len = (nlp_uint16_t)pops_len[v];
+    }
+
+    // pack everything into one block
+    nlp_size_t nodes_size = sizeof(wordpiece_node_t) * num_nodes;
+    nlp_size_t targets_size = sizeof(nlp_uint32_t) * num_edges;
+    nlp_size_t pops_size = sizeof(nlp_int32_t) * pops.len;
+    nlp_size_t lens_size = sizeof(nlp_uint16_t) * num_tokens;
+    nlp_uint8_t *block = (nlp_uint8_t *)malloc(nodes_size + targets_size + pops_size + lens_size + num_edges + 1);
+    if (block == NULL) goto error;
+    nlp_uint8_t *p = block;
+    memcpy(p, nodes, nodes_size);
+    wp->nodes = (const wordpiece_node_t *)p;
+    p += nodes_size;
+    memcpy(p, targets, targets_size);
+    wp->edge_targets = (const nlp_uint32_t *)p;
+    p += targets_size;
+    if (pops_size) memcpy(p, pops.data, pops_size);
+    wp->pops = (const nlp_int32_t *)p;
+    p += pops_size;
+    if (lens_size) memcpy(p, piece_lens, lens_size);
+    wp->piece_lens = (const nlp_uint16_t *)p;
+    p += lens_size;
+    memcpy(p, labels, num_edges);
+    wp->edge_labels = p;
+    wp->num_pops = pops.len;
+    wp->num_tokens = num_tokens;
+    wp->owned = block;
+    goto cleanup;
+
+error:
+    free(wp);
+    wp = NULL;
+cleanup:
+    free(order);
+    free(parent);
+    free(fail);
+    free(pops_begin);
+    free(pops_len);
+    free(labels);
+    free(nodes);
+    free(targets);
+    free(pops.data);
+    return wp;
+}
+
+wordpiece_t *wordpiece_build(const char *const *tokens,
+  const nlp_size_t *token_lens,
+  nlp_size_t num_tokens,
+  const char *suffix_indicator,
+  nlp_int32_t unk_id) {
+    build_trie_t trie = { NULL, 0, 0 };
+    nlp_size_t suffix_len = strlen(suffix_indicator);
+    wordpiece_t *wp = NULL;
+    nlp_uint16_t *piece_lens = (nlp_uint16_t *)malloc(sizeof(nlp_uint16_t) * (num_tokens + 1));
+    if (piece_lens == NULL) return NULL;
+
+    nlp_uint32_t root = build_trie_new_node(&trie, 0);
+    nlp_uint32_t suffix_root = build_trie_new_node(&trie, 0);
+    if (root == WORDPIECE_NULL_NODE || suffix_root == WORDPIECE_NULL_NODE) goto cleanup;
+
+    for (nlp_size_t i = 0; i < num_tokens; i++) {
+        const nlp_uint8_t *token = (const nlp_uint8_t *)tokens[i];
+        nlp_size_t len = token_lens[i];
+        bool ok = true;
+        if (len > suffix_len && memcmp(token, suffix_indicator, suffix_len) == 0) {
+            len -= suffix_len;
+            ok = build_trie_insert(&trie, suffix_root, token + suffix_len, len, (nlp_int32_t)i);
+        } else if (len > 0) {
+            ok = build_trie_insert(&trie, root, token, len, (nlp_int32_t)i);
+        }
+        if (!ok) goto cleanup;
+        // longer tokens never match a word of max_input_chars_per_word characters anyway
+        piece_lens[i] = len > UINT16_MAX ? UINT16_MAX : (nlp_uint16_t)len;
+    }
+
+    wp = wordpiece_freeze(&trie, piece_lens, (nlp_uint32_t)num_tokens, unk_id);
+cleanup:
+    free(trie.nodes);
+    free(piece_lens);
+    return wp;
+}
+
+void wordpiece_destroy(wordpiece_t *wp) {
+    if (wp == NULL) return;
+    free(wp->owned);
+    free(wp);
+}
+
+nlp_int32_t wordpiece_lookup(const wordpiece_t *wp, const nlp_uint8_t *token, nlp_size_t len, bool suffix) {
+    nlp_uint32_t node = suffix ? wp->suffix_root : wp->root;
+    for (nlp_size_t i = 0; i < len; i++) {
+        node = wordpiece_goto(wp, node, token[i]);
+        if (node == WORDPIECE_NULL_NODE) return -1;
+    }
+    // only the node of a whole token fails over to the suffix root
+    if (node == wp->root || wp->nodes[node].fail != wp->suffix_root) return -1;
+    return wp->pops[wp->nodes[node].pops_begin];
+}
+
+nlp_size_t wordpiece_encode_word(const wordpiece_t *wp,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t cap) {
+    nlp_size_t n = 0;
+    nlp_size_t chars = 0;
+    nlp_uint32_t node = wp->root;
+    const wordpiece_node_t *nodes = wp->nodes;
+
+    for (nlp_size_t i = 0; i < len; i++) {
+        nlp_uint8_t c = word[i];
+        nlp_uint32_t next;
+        chars += (c & 0xC0) != 0x80;
+        if (__builtin_expect(chars > wp->max_input_chars_per_word, 0)) goto unk;
+        while ((next = wordpiece_goto(wp, node, c)) == WORDPIECE_NULL_NODE) {
+            if (nodes[node].fail == WORDPIECE_NULL_NODE) goto unk;
+            for (nlp_uint32_t k = 0; k < nodes[node].pops_len; k++, n++) {
+                if (n < cap) ids[n] = wp->pops[nodes[node].pops_begin + k];
+            }
+            node = nodes[node].fail;
+        }
+        node = next;
+    }
+    // flush the tokens still pending at the end of the word
+    while (node != wp->suffix_root && node != wp->root) {
+        if (nodes[node].fail == WORDPIECE_NULL_NODE) goto unk;
+        for (nlp_uint32_t k = 0; k < nodes[node].pops_len; k++, n++) {
+            if (n < cap) ids[n] = wp->pops[nodes[node].pops_begin + k];
+        }
+        node = nodes[node].fail;
+    }
+    return n;
+
+unk:
+    if (wp->unk_id < 0) return 0;
+    if (cap > 0) ids[0] = wp->unk_id;
+    return 1;
+}
@@ -0,0 +1,82 @@
+#ifndef __WORDPIECE_H
+#define __WORDPIECE_H
+
+#include "common.h"
+
+#include <stdbool.h>
+
+/*
+    WordPiece matcher based on LinMaxMatch (Song et al., "Fast WordPiece
+    Tokenization", 2021).
+
+    All vocab tokens are stored in a byte trie with two roots: `root` for
+    word-start tokens and `suffix_root` for continuation tokens with the
+    "##" indicator removed. Every node carries a precomputed failure link
+    and a list of failure pops, i.e. the tokens greedy longest-match-first
+    would emit before it can continue matching from the failure node.
+    Encoding a word is then a single left-to-right pass over its bytes.
+
+    The frozen trie is a set of flat arrays without pointers so that it can
+    be written to and mapped from a file as is.
+*/
+
+#define WORDPIECE_NULL_NODE ((nlp_uint32_t)-1)
+#define WORDPIECE_MAX_INPUT_CHARS_PER_WORD 100
+
+typedef struct wordpiece_node
+{
+    nlp_uint32_t edge_begin;// first outgoing edge, edges are sorted by label
+    nlp_uint16_t edge_count;
+    nlp_uint16_t pops_len;
+    nlp_uint32_t fail;// WORDPIECE_NULL_NODE if matching fails here
+    nlp_uint32_t pops_begin;
+} wordpiece_node_t;
+
+typedef struct wordpiece
+{
+    const wordpiece_node_t *nodes;
+    const nlp_uint8_t *edge_labels;
+    const nlp_uint32_t *edge_targets;
+    const nlp_int32_t *pops;
+    // bytes a token covers in a word, its length without the suffix indicator
+    const nlp_uint16_t *piece_lens;
+    nlp_uint32_t num_tokens;
+    nlp_uint32_t num_nodes;
+    nlp_uint32_t num_edges;
+    nlp_uint32_t num_pops;
+    nlp_uint32_t root;
+    nlp_uint32_t suffix_root;
+    nlp_int32_t unk_id;
+    nlp_uint32_t max_input_chars_per_word;
+    // backing memory of the arrays above, NULL if they are borrowed
+    void *owned;
+} wordpiece_t;
+
+/*
+    Build the matcher from `num_tokens` vocab tokens, token i has id i.
+    Tokens starting with `suffix_indicator` (usually "##") go to the suffix trie.
+    Return NULL if failed.
+*/
+wordpiece_t *wordpiece_build(const char *const *tokens,
+  const nlp_size_t *token_lens,
+  nlp_size_t num_tokens,
+  const char *suffix_indicator,
+  nlp_int32_t unk_id);
+void wordpiece_destroy(wordpiece_t *wp);
+
+/* Return the vocab id of a token (with "##" removed if suffix), -1 if not in vocab */
+nlp_int32_t wordpiece_lookup(const wordpiece_t *wp, const nlp_uint8_t *token, nlp_size_t len, bool suffix);
+
+/*
+    Encode one pre-tokenized word.
+    At most `cap` ids are written to `ids`, the return value is the number of
+    ids the word encodes to, so a return value larger than `cap` means the
+    output was truncated. A word that can not be matched encodes to unk_id.
+*/
+nlp_size_t wordpiece_encode_word(const wordpiece_t *wp,
+  const nlp_uint8_t *word,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t cap);
+
+#endif
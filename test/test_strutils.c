@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 SUITE(libnlp_strutils_tests);
 
@@ -39,7 +40,188 @@ TEST test_utf8str_rstrip(void) {
     PASS();
 }
 
+TEST test_utf8str_classify(void) {
+    // a, 中, an invalid byte, ',', ' ', an em space, U+0301 and a cyrillic letter
+    const char *s = "a\xe4\xb8\xad\xff, \xe2\x80\x83\xcc\x81\xd0\x96";
+    nlp_uint8_t flags[16];
+    nlp_size_t n = utf8str_classify((const nlp_uint8_t *)s, strlen(s), flags, 16);
+    ASSERT_EQ(8, n);
+    ASSERT_EQ(UTF8_CLASS_LETTER, flags[0]);
+    ASSERT_EQ(UTF8_CLASS_LETTER | UTF8_CLASS_CHINESE, flags[1]);
+    ASSERT_EQ(UTF8_CLASS_INVALID, flags[2]);
+    ASSERT_EQ(UTF8_CLASS_PUNCTUATION, flags[3]);
+    ASSERT_EQ(UTF8_CLASS_WHITESPACE, flags[4]);
+    ASSERT_EQ(UTF8_CLASS_WHITESPACE, flags[5]);
+    ASSERT_EQ(UTF8_CLASS_NONSPACING_MARK, flags[6]);
+    ASSERT_EQ(UTF8_CLASS_LETTER, flags[7]);
+    // the count does not depend on the room for flags
+    ASSERT_EQ(8, utf8str_classify((const nlp_uint8_t *)s, strlen(s), flags, 2));
+
+    // the table agrees with the category based definitions
+    for (nlp_int32_t cp = 0; cp <= 0x10FFFF; cp++) {
+        utf8proc_category_t cat = utf8proc_category(cp);
+        bool space = cp == ' ' || cp == '\t' || cp == '\n' || cp == '\r';
+        bool control = !space && (cat == UTF8PROC_CATEGORY_CN || cat >= UTF8PROC_CATEGORY_CC);
+        nlp_uint8_t f = utf8str_char_class(cp);
+        ASSERT_EQ(space || cat == UTF8PROC_CATEGORY_ZS, (f & UTF8_CLASS_WHITESPACE) != 0);
+        ASSERT_EQ(control, (f & UTF8_CLASS_CONTROL) != 0);
+        ASSERT_EQ(cat == UTF8PROC_CATEGORY_MN, (f & UTF8_CLASS_NONSPACING_MARK) != 0);
+        ASSERT_EQ(cat >= UTF8PROC_CATEGORY_LU && cat <= UTF8PROC_CATEGORY_LO, (f & UTF8_CLASS_LETTER) != 0);
+        ASSERT_EQ(cat >= UTF8PROC_CATEGORY_ND && cat <= UTF8PROC_CATEGORY_NO, (f & UTF8_CLASS_NUMBER) != 0);
+    }
+    ASSERT(utf8str_is_control_char(0x110000));
+    ASSERT(utf8str_is_control_char(-1));
+    PASS();
+}
+
+TEST test_utf8str_repair(void) {
+    const nlp_uint8_t *valid = (const nlp_uint8_t *)"h\xc3\xa9llo \xe4\xb8\xad\xf0\x9f\x98\x80";
+    ASSERT(utf8str_is_valid(valid, strlen((const char *)valid)));
+    // a surrogate, an overlong '/', a stray continuation and a cut short character
+    const nlp_uint8_t *s = (const nlp_uint8_t *)"a\xed\xa0\x80"
+                                                 "b\xc0\xaf"
+                                                 "c\x80"
+                                                 "d\xe4\xb8";
+    nlp_size_t len = strlen((const char *)s);
+    ASSERT_EQ(1, utf8str_valid_prefix(s, len));
+    ASSERT_FALSE(utf8str_is_valid(s, len));
+
+    nlp_uint8_t out[64];
+    nlp_size_t n = utf8str_repair(s, len, out, sizeof(out), UTF8_REPAIR_REPLACE);
+    const char *replaced = "a\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"
+                           "b\xef\xbf\xbd\xef\xbf\xbd"
+                           "c\xef\xbf\xbd"
+                           "d\xef\xbf\xbd";
+    ASSERT_EQ(strlen(replaced), n);
+    ASSERT_STR_EQ(replaced, (const char *)out);
+    // a short buffer gets a prefix, the length is the full one
+    ASSERT_EQ(n, utf8str_repair(s, len, out, 4, UTF8_REPAIR_REPLACE));
+
+    nlp_uint8_t in_place[16];
+    memcpy(in_place, s, len);
+    n = utf8str_repair(in_place, len, in_place, len, UTF8_REPAIR_DROP);
+    ASSERT_EQ(4, n);
+    ASSERT_MEM_EQ("abcd", in_place, 4);
+
+    // errors past the vector blocks and at their edges
+    nlp_uint8_t long_text[200];
+    for (nlp_size_t at = 0; at + 3 <= sizeof(long_text); at++) {
+        memset(long_text, 'x', sizeof(long_text));
+        memcpy(long_text + at, "\xe4\xb8\xad", 3);
+        ASSERT(utf8str_is_valid(long_text, sizeof(long_text)));
+        long_text[at + 2] = 'x';
+        ASSERT_EQ(at, utf8str_valid_prefix(long_text, sizeof(long_text)));
+    }
+    PASS();
+}
+
+TEST test_utf8str_nlen(void) {
+    const nlp_uint8_t *s = (const nlp_uint8_t *)"h\xc3\xa9llo \xe4\xb8\xad\xf0\x9f\x98\x80";
+    ASSERT_EQ(8, utf8str_len(s));
+    ASSERT_EQ(8, utf8str_nlen(s, strlen((const char *)s)));
+    // the length stops the count, not a NUL
+    ASSERT_EQ(2, utf8str_nlen(s, 3));
+    ASSERT_EQ(3, utf8str_nlen((const nlp_uint8_t *)"a\0b", 3));
+    // invalid bytes never make the count negative
+    ASSERT_EQ(2, utf8str_nlen((const nlp_uint8_t *)"\xff\x80\x80\xc3", 4));
+
+    // long enough for the vector path, with a tail
+    nlp_uint8_t text[3 * 300 + 5];
+    for (nlp_size_t i = 0; i < 300; i++) memcpy(text + 3 * i, "\xe4\xb8\xad", 3);
+    memcpy(text + 900, "abcde", 5);
+    ASSERT_EQ(305, utf8str_nlen(text, sizeof(text)));
+    PASS();
+}
+
+TEST test_utf8str_transcode(void) {
+    // runs of ascii, of 2-byte and of 3-byte characters long enough for the vector kernels
+    nlp_uint8_t text[512];
+    nlp_size_t len = 0;
+    const char *words[] = { "hello world, ", "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 ",
+        "\xe4\xb8\xad\xe6\x96\x87\xe5\xad\x97", "\xf0\x9f\x98\x80" };
+    for (nlp_size_t k = 0; len + 16 < sizeof(text); k = (k * 7 + 3) % 4) {
+        memcpy(text + len, words[k], strlen(words[k]));
+        len += strlen(words[k]);
+    }
+    nlp_int32_t cps[512];
+    nlp_size_t n = utf8str_decode(text, len, cps, 512);
+    ASSERT_EQ(utf8str_nlen(text, len), n);
+    nlp_size_t i = 0;
+    for (nlp_size_t k = 0; k < n; k++) {
+        nlp_int32_t cp;
+        i += utf8str_iterate(text + i, len - i, &cp);
+        ASSERT_EQ(cp, cps[k]);
+    }
+    nlp_uint8_t encoded[513];
+    ASSERT_EQ(len, utf8str_encode(cps, n, encoded, sizeof(encoded)));
+    ASSERT_MEM_EQ(text, encoded, len);
+    // short buffers get a prefix, the count is the full one
+    ASSERT_EQ(n, utf8str_decode(text, len, cps, 3));
+    ASSERT_EQ(len, utf8str_encode(cps, n, encoded, 5));
+
+    // ill-formed sequences and values that are not codepoints become U+FFFD
+    const nlp_uint8_t *bad = (const nlp_uint8_t *)"a\xe4\xb8"
+                                                   "b\xff";
+    nlp_int32_t expected[] = { 'a', 0xFFFD, 'b', 0xFFFD };
+    ASSERT_EQ(4, utf8str_decode(bad, strlen((const char *)bad), cps, 512));
+    ASSERT_MEM_EQ(expected, cps, sizeof(expected));
+    nlp_int32_t invalid[] = { 0xD800, -1, 0x110000 };
+    ASSERT_EQ(9, utf8str_encode(invalid, 3, encoded, sizeof(encoded)));
+    ASSERT_STR_EQ("\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd", (const char *)encoded);
+    PASS();
+}
+
+TEST test_utf8str_case(void) {
+    // a run of ascii long enough for a vector, "Привет", 'İ', an invalid byte and 'Ⱥ'
+    const nlp_uint8_t *s = (const nlp_uint8_t *)"Hello World, HELLO World! "
+                                                 "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 \xc4\xb0\xff"
+                                                 "X\xc8\xba";
+    nlp_size_t len = strlen((const char *)s);
+    nlp_uint8_t out[64];
+    const char *lower = "hello world, hello world! "
+                        "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 i\xff"
+                        "x\xe2\xb1\xa5";
+    ASSERT_EQ(strlen(lower), utf8str_lower_into(s, len, out, sizeof(out)));
+    ASSERT_STR_EQ(lower, (const char *)out);
+    const char *upper = "HELLO WORLD, HELLO WORLD! "
+                        "\xd0\x9f\xd0\xa0\xd0\x98\xd0\x92\xd0\x95\xd0\xa2 \xc4\xb0\xff"
+                        "X\xc8\xba";
+    ASSERT_EQ(strlen(upper), utf8str_upper_into(s, len, out, sizeof(out)));
+    ASSERT_STR_EQ(upper, (const char *)out);
+    // a short buffer gets a prefix, the length is the full one
+    ASSERT_EQ(strlen(lower), utf8str_lower_into(s, len, out, 4));
+    ASSERT_MEM_EQ("hell", out, 4);
+
+    // in place only when nothing grows, 'Ⱥ' does
+    nlp_uint8_t text[64];
+    memcpy(text, s, len);
+    ASSERT_EQ(-1, utf8str_lower_inplace(text, len));
+    ASSERT_MEM_EQ(s, text, len);
+    ASSERT_EQ(strlen(lower) - 3, utf8str_lower_inplace(text, len - 2));
+    ASSERT_MEM_EQ(lower, text, strlen(lower) - 3);
+
+    // the tables agree with utf8proc on every codepoint
+    for (nlp_int32_t cp = 0; cp <= 0x10FFFF; cp++) {
+        if (cp >= 0xD800 && cp <= 0xDFFF) continue;
+        nlp_uint8_t bytes[4];
+        nlp_size_t n = utf8proc_encode_char(cp, bytes);
+        nlp_int32_t mapped;
+        utf8str_lower_into(bytes, n, out, sizeof(out));
+        utf8proc_iterate(out, -1, &mapped);
+        ASSERT_EQ(utf8proc_tolower(cp), mapped);
+        utf8str_upper_into(bytes, n, out, sizeof(out));
+        utf8proc_iterate(out, -1, &mapped);
+        ASSERT_EQ(utf8proc_toupper(cp), mapped);
+    }
+    PASS();
+}
+
 SUITE(libnlp_strutils_tests) {
     RUN_TEST(test_utf8str_split);
     RUN_TEST(test_utf8str_rstrip);
+    RUN_TEST(test_utf8str_classify);
+    RUN_TEST(test_utf8str_repair);
+    RUN_TEST(test_utf8str_nlen);
+    RUN_TEST(test_utf8str_transcode);
+    RUN_TEST(test_utf8str_case);
 }
\ No newline at end of file
@@ -1,15 +1,1092 @@
 
 
 #include "greatest.h"
+#include "pipeline.h"
+#include "readutils.h"
 #include "tokenizer.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 SUITE(libnlp_tokenizer_tests);
 
+// fixture files live in a directory made for the suite and are removed after every test
+static char test_dir[256];
+static char test_paths[7][320];
+#define TEST_VOCAB_PATH test_paths[0]
+#define TEST_VOCAB_BINARY_PATH test_paths[1]
+#define TEST_BPE_VOCAB_PATH test_paths[2]
+#define TEST_BPE_MERGES_PATH test_paths[3]
+#define TEST_UNIGRAM_MODEL_PATH test_paths[4]
+#define TEST_CORPUS_PATH test_paths[5]
+#define TEST_SHARD_PREFIX test_paths[6]
+
+static void create_test_dir(void) {
+    static const char *names[] = { "vocab.txt", "vocab.bin", "bpe_vocab.json", "bpe_merges.txt", "unigram.model",
+        "corpus.txt", "shard" };
+    const char *tmp = getenv("TMPDIR");
+    snprintf(test_dir, sizeof(test_dir), "%s/libnlp_test_XXXXXX", tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    if (mkdtemp(test_dir) == NULL) snprintf(test_dir, sizeof(test_dir), ".");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        snprintf(test_paths[i], sizeof(test_paths[i]), "%s/%s", test_dir, names[i]);
+}
+
+static void remove_test_files(void *udata) {
+    (void)udata;
+    for (size_t i = 0; i < sizeof(test_paths) / sizeof(test_paths[0]); i++) remove(test_paths[i]);
+    char path[352];
+    for (int shard = 0;; shard++) {
+        snprintf(path, sizeof(path), "%s-%05d.bin", TEST_SHARD_PREFIX, shard);
+        if (remove(path) != 0) break;
+    }
+}
+
+static const char *test_vocab[] = { "[PAD]", "[UNK]", "[CLS]", "[SEP]", "[MASK]", "hello", "world", ",", "!", "中", "国",
+    "un", "##aff", "##able" };
+// "hello , world ! 中 国 un ##aff ##able [UNK]"
+static const char *test_text = "Hello, wörld! 中国 unaffable xyz";
+static const nlp_int32_t test_ids[] = { 5, 7, 6, 8, 9, 10, 11, 12, 13, 1 };
+
+static bool write_test_vocab(void) {
+    FILE *fp = fopen(TEST_VOCAB_PATH, "w");
+    if (fp == NULL) return false;
+    for (size_t i = 0; i < sizeof(test_vocab) / sizeof(test_vocab[0]); i++) fprintf(fp, "%s\n", test_vocab[i]);
+    fclose(fp);
+    return true;
+}
+
+static bert_tokenizer_t *create_test_tokenizer(void) {
+    if (!write_test_vocab()) return NULL;
+    return nlp_bert_tokenizer_create(TEST_VOCAB_PATH, true);
+}
+
 TEST test_tokenizer_create(void) {
-    char *vocab_path = "E:\\Resources\\bert_model\\vocab.txt";
-    bert_tokenizer_t *tokenier = nlp_bert_tokenizer_create(vocab_path, true);
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    ASSERT_EQ(sizeof(test_vocab) / sizeof(test_vocab[0]), nlp_bert_tokenizer_vocab_size(tokenizer));
+    ASSERT_EQ(12, nlp_bert_tokenizer_token_to_id(tokenizer, "##aff", 5));
+    ASSERT_EQ(-1, nlp_bert_tokenizer_token_to_id(tokenizer, "aff", 3));
+    ASSERT_STR_EQ("国", nlp_bert_tokenizer_id_to_token(tokenizer, 10));
+    nlp_bert_tokenizer_destory(tokenizer);
+    ASSERT_EQ(NULL, nlp_bert_tokenizer_create("libnlp_test_missing.txt", true));
+    PASS();
+}
+
+TEST test_tokenizer_encode(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    nlp_int32_t ids[16];
+    nlp_ssize_t n = nlp_bert_tokenizer_encode(tokenizer, test_text, strlen(test_text), ids, 16);
+    ASSERT_EQ(10, n);
+    ASSERT_MEM_EQ(test_ids, ids, sizeof(test_ids));
+    // too small an output still reports the full count
+    ASSERT_EQ(10, nlp_bert_tokenizer_encode(tokenizer, test_text, strlen(test_text), ids, 3));
+    ASSERT_EQ(10, nlp_bert_tokenizer_count(tokenizer, test_text, strlen(test_text), 0));
+    ASSERT_EQ(4, nlp_bert_tokenizer_count(tokenizer, test_text, strlen(test_text), 4));
+    // single CJK characters, in and out of the vocab and outside the BMP
+    const char *cjk_text = "中𠀀国丁";
+    nlp_int32_t cjk_ids[] = { 9, 1, 10, 1 };
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, cjk_text, strlen(cjk_text), ids, 16));
+    ASSERT_MEM_EQ(cjk_ids, ids, sizeof(cjk_ids));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_count(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    // every word goes through the cache, its lookups tell how much of the text was encoded
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 64, NLP_CACHE_LRU));
+    // words separated by spaces, and CJK characters with none, which are words of their own
+    const char *words[] = { "hello ", "丁" };
+    for (int k = 0; k < 2; k++) {
+        nlp_size_t word_len = strlen(words[k]);
+        nlp_size_t num_words = 32768 / word_len;
+        char *text = (char *)malloc(num_words * word_len);
+        ASSERT(text != NULL);
+        for (nlp_size_t i = 0; i < num_words; i++) memcpy(text + i * word_len, words[k], word_len);
+        nlp_cache_stats_t before, after;
+        nlp_bert_tokenizer_cache_stats(tokenizer, &before);
+        nlp_ssize_t n = nlp_bert_tokenizer_count(tokenizer, text, num_words * word_len, 10);
+        nlp_bert_tokenizer_cache_stats(tokenizer, &after);
+        ASSERT_EQ(10, n);
+        // the count stops after the first chunk of the eight
+        nlp_size_t lookups = (after.hits + after.misses) - (before.hits + before.misses);
+        ASSERT(lookups >= 10 && lookups < num_words / 4);
+        ASSERT_EQ(num_words, nlp_bert_tokenizer_count(tokenizer, text, num_words * word_len, 0));
+        free(text);
+    }
+
+    // special tokens are searched a chunk at a time too, one starting with another byte than '[' as well
+    ASSERT_EQ(0, nlp_bert_tokenizer_add_special_tokens(tokenizer, (const char *[]){ "<eos>" }, 1));
+    const char *word = "hello<eos>";
+    nlp_size_t word_len = strlen(word);
+    nlp_size_t num_words = 32768 / word_len;
+    char *text = (char *)malloc(num_words * word_len);
+    ASSERT(text != NULL);
+    for (nlp_size_t i = 0; i < num_words; i++) memcpy(text + i * word_len, word, word_len);
+    nlp_cache_stats_t before, after;
+    nlp_bert_tokenizer_cache_stats(tokenizer, &before);
+    ASSERT_EQ(10, nlp_bert_tokenizer_count(tokenizer, text, num_words * word_len, 10));
+    nlp_bert_tokenizer_cache_stats(tokenizer, &after);
+    ASSERT((after.hits + after.misses) - (before.hits + before.misses) < num_words / 4);
+    // the chunks end on both sides of a special token, which is counted once
+    ASSERT_EQ(2 * num_words, nlp_bert_tokenizer_count(tokenizer, text, num_words * word_len, 0));
+    // and a cut one is text, "<", "eos"
+    ASSERT_EQ(2 * num_words + 1, nlp_bert_tokenizer_count(tokenizer, text, num_words * word_len - 1, 0));
+    free(text);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_encode_spans(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    nlp_token_span_t spans[16];
+    nlp_size_t expected[][2] = { { 0, 5 }, { 5, 6 }, { 7, 13 }, { 13, 14 }, { 15, 18 }, { 18, 21 }, { 22, 24 },
+        { 24, 27 }, { 27, 31 }, { 32, 35 } };
+    ASSERT_EQ(10, nlp_bert_tokenizer_encode_spans(tokenizer, test_text, strlen(test_text), spans, 16));
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(expected[i][0], spans[i].start);
+        ASSERT_EQ(expected[i][1], spans[i].end);
+        ASSERT_EQ(test_ids[i], spans[i].id);
+    }
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_binary_vocab(void) {
+    ASSERT(write_test_vocab());
+    ASSERT_EQ(0, nlp_bert_vocab_compile(TEST_VOCAB_PATH, TEST_VOCAB_BINARY_PATH));
+    bert_tokenizer_t *tokenizer = nlp_bert_tokenizer_create_from_binary(TEST_VOCAB_BINARY_PATH, true);
+    ASSERT(tokenizer != NULL);
+    nlp_int32_t ids[16];
+    ASSERT_EQ(10, nlp_bert_tokenizer_encode(tokenizer, test_text, strlen(test_text), ids, 16));
+    ASSERT_MEM_EQ(test_ids, ids, sizeof(test_ids));
+    ASSERT_STR_EQ("##able", nlp_bert_tokenizer_id_to_token(tokenizer, 13));
+    // the CJK table is mapped from the file
+    const char *cjk_text = "中𠀀国丁";
+    nlp_int32_t cjk_ids[] = { 9, 1, 10, 1 };
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, cjk_text, strlen(cjk_text), ids, 16));
+    ASSERT_MEM_EQ(cjk_ids, ids, sizeof(cjk_ids));
+    nlp_bert_tokenizer_destory(tokenizer);
+
+    // a duplicated CJK token has the id of its last line, the same as the trie gives
+    FILE *fp = fopen(TEST_VOCAB_PATH, "a");
+    ASSERT(fp != NULL);
+    fputs("中\n", fp);
+    fclose(fp);
+    ASSERT_EQ(0, nlp_bert_vocab_compile(TEST_VOCAB_PATH, TEST_VOCAB_BINARY_PATH));
+    bert_tokenizer_t *tokenizers[2] = { nlp_bert_tokenizer_create(TEST_VOCAB_PATH, true),
+        nlp_bert_tokenizer_create_from_binary(TEST_VOCAB_BINARY_PATH, true) };
+    for (int i = 0; i < 2; i++) {
+        ASSERT(tokenizers[i] != NULL);
+        ASSERT_EQ(14, nlp_bert_tokenizer_token_to_id(tokenizers[i], "中", strlen("中")));
+        ASSERT_EQ(1, nlp_bert_tokenizer_encode(tokenizers[i], "中", strlen("中"), ids, 16));
+        ASSERT_EQ(14, ids[0]);
+        nlp_bert_tokenizer_destory(tokenizers[i]);
+    }
+    // a text vocab is not a compiled one
+    ASSERT_EQ(NULL, nlp_bert_tokenizer_create_from_binary(TEST_VOCAB_PATH, true));
+    PASS();
+}
+
+static enum greatest_test_res check_spans(const nlp_token_span_t *expected,
+  const nlp_token_span_t *spans,
+  nlp_size_t n) {
+    for (nlp_size_t i = 0; i < n; i++) {
+        ASSERT_EQ(expected[i].start, spans[i].start);
+        ASSERT_EQ(expected[i].end, spans[i].end);
+        ASSERT_EQ(expected[i].id, spans[i].id);
+    }
+    PASS();
+}
+
+TEST test_tokenizer_reencode_spans(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    const char *old_text = "hello world, un [SEP] world!";
+    const char *new_text = "hello world, unaffable [SEP] world!";
+    nlp_token_span_t old_spans[16], spans[16], expected[16];
+    nlp_ssize_t n = nlp_bert_tokenizer_encode_spans(tokenizer, old_text, strlen(old_text), old_spans, 16);
+    ASSERT_EQ(7, n);
+    // "un" becomes "unaffable", the tokens around it are reused
+    ASSERT_EQ(9, nlp_bert_tokenizer_encode_spans(tokenizer, new_text, strlen(new_text), expected, 16));
+    ASSERT_EQ(9, nlp_bert_tokenizer_reencode_spans(tokenizer, old_spans, (nlp_size_t)n, 15, 15, 7, new_text,
+                    strlen(new_text), spans, 16));
+    CHECK_CALL(check_spans(expected, spans, 9));
+    // and back, replacing the whole word
+    ASSERT_EQ(7, nlp_bert_tokenizer_reencode_spans(tokenizer, expected, 9, 13, 22, 2, old_text, strlen(old_text),
+                   spans, 16));
+    CHECK_CALL(check_spans(old_spans, spans, 7));
+    ASSERT_EQ(-1, nlp_bert_tokenizer_reencode_spans(tokenizer, old_spans, (nlp_size_t)n, 5, 4, 0, old_text,
+                    strlen(old_text), spans, 16));
+
+    // CJK text has no whitespace, every character is a word boundary
+    char cjk_old[128] = "", cjk_new[128] = "";
+    for (int i = 0; i < 16; i++) strcat(cjk_old, "中国");
+    memcpy(cjk_new, cjk_old, 48);
+    strcat(cjk_new, "国丁");
+    strcat(cjk_new, cjk_old + 51);
+    nlp_token_span_t cjk_old_spans[64], cjk_spans[64], cjk_expected[64];
+    ASSERT_EQ(32, nlp_bert_tokenizer_encode_spans(tokenizer, cjk_old, strlen(cjk_old), cjk_old_spans, 64));
+    ASSERT_EQ(33, nlp_bert_tokenizer_encode_spans(tokenizer, cjk_new, strlen(cjk_new), cjk_expected, 64));
+    // tokens that are reused keep the id they are given here
+    for (int i = 0; i < 32; i++) cjk_old_spans[i].id = 99;
+    ASSERT_EQ(33, nlp_bert_tokenizer_reencode_spans(tokenizer, cjk_old_spans, 32, 48, 51, 6, cjk_new,
+                    strlen(cjk_new), cjk_spans, 64));
+    int reencoded = 0;
+    for (int i = 0; i < 33; i++) {
+        ASSERT_EQ(cjk_expected[i].start, cjk_spans[i].start);
+        ASSERT_EQ(cjk_expected[i].end, cjk_spans[i].end);
+        if (cjk_spans[i].id != 99) {
+            ASSERT_EQ(cjk_expected[i].id, cjk_spans[i].id);
+            reencoded++;
+        }
+    }
+    // the two new characters and the few around them within the special token context
+    ASSERT(reencoded >= 2 && reencoded <= 8);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+typedef struct collected_spans
+{
+    nlp_token_span_t spans[64];
+    nlp_size_t n;
+} collected_spans_t;
+
+static int collect_spans(void *context, const nlp_token_span_t *spans, nlp_size_t num_spans) {
+    collected_spans_t *collected = (collected_spans_t *)context;
+    if (collected->n + num_spans > 64) return -1;
+    memcpy(collected->spans + collected->n, spans, sizeof(nlp_token_span_t) * num_spans);
+    collected->n += num_spans;
+    return 0;
+}
+
+TEST test_tokenizer_stream(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    const char *text = "Hello, wörld! 中国 un[SEP]affable xyz";
+    nlp_size_t len = strlen(text);
+    nlp_token_span_t expected[16];
+    nlp_ssize_t n = nlp_bert_tokenizer_encode_spans(tokenizer, text, len, expected, 16);
+    ASSERT_EQ(10, n);
+
+    // one byte at a time splits the utf-8 sequences, the words and the special token
+    collected_spans_t collected = { .n = 0 };
+    bert_stream_t *stream = nlp_bert_stream_create(tokenizer, collect_spans, &collected);
+    ASSERT(stream != NULL);
+    for (nlp_size_t i = 0; i < len; i++) ASSERT_EQ(0, nlp_bert_stream_write(stream, text + i, 1));
+    // the last word may still continue
+    ASSERT(collected.n < (nlp_size_t)n);
+    ASSERT_EQ(0, nlp_bert_stream_finish(stream));
+    nlp_bert_stream_destory(stream);
+    ASSERT_EQ(n, collected.n);
+    CHECK_CALL(check_spans(expected, collected.spans, (nlp_size_t)n));
+
+    FILE *fp = tmpfile();
+    ASSERT(fp != NULL);
+    fputs(text, fp);
+    rewind(fp);
+    collected.n = 0;
+    ASSERT_EQ(0, nlp_bert_tokenizer_encode_file(tokenizer, fp, collect_spans, &collected));
+    fclose(fp);
+    ASSERT_EQ(n, collected.n);
+    CHECK_CALL(check_spans(expected, collected.spans, (nlp_size_t)n));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_special_tokens(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    nlp_int32_t ids[16];
+    // the special tokens of the vocab are not lowercased or split, even inside a word
+    const char *text = "[CLS] Hello[MASK]world [SEP]";
+    nlp_int32_t expected[] = { 2, 5, 4, 6, 3 };
+    ASSERT_EQ(5, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 16));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+    nlp_token_span_t spans[16];
+    ASSERT_EQ(5, nlp_bert_tokenizer_encode_spans(tokenizer, text, strlen(text), spans, 16));
+    ASSERT_EQ(11, spans[2].start);
+    ASSERT_EQ(17, spans[2].end);
+    ASSERT_EQ(17, spans[3].start);
+
+    // added tokens get ids after the vocab, the longest one wins
+    const char *added[] = { "xyz", "xyzzy", "[MASK]" };
+    ASSERT_EQ(0, nlp_bert_tokenizer_add_special_tokens(tokenizer, added, 3));
+    ASSERT_EQ(16, nlp_bert_tokenizer_vocab_size(tokenizer));
+    ASSERT_EQ(15, nlp_bert_tokenizer_token_to_id(tokenizer, "xyzzy", 5));
+    ASSERT_STR_EQ("xyz", nlp_bert_tokenizer_id_to_token(tokenizer, 14));
+    text = "xyzzyhello XYZ xyz,";
+    nlp_int32_t expected_added[] = { 15, 5, 1, 14, 7 };
+    ASSERT_EQ(5, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 16));
+    ASSERT_MEM_EQ(expected_added, ids, sizeof(expected_added));
+    ASSERT_EQ(-1, nlp_bert_tokenizer_add_special_tokens(tokenizer, (const char *[]){ "" }, 1));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_swap_vocab(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    ASSERT_EQ(0, nlp_bert_tokenizer_add_special_tokens(tokenizer, (const char *[]){ "xyz" }, 1));
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 16, NLP_CACHE_LRU));
+    const char *text = "hello world xyz [CLS]";
+    nlp_int32_t ids[8];
+    nlp_int32_t expected[] = { 5, 6, 14, 2 };
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 8));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+    ASSERT_EQ(-1, nlp_bert_tokenizer_swap_vocab(tokenizer, "libnlp_test_missing_vocab.txt"));
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 8));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+
+    // the added token and the cache settings carry over, the ids come from the new vocab
+    FILE *fp = fopen(TEST_VOCAB_PATH, "w");
+    ASSERT(fp != NULL);
+    fputs("[UNK]\nworld\nhello\n[CLS]\n", fp);
+    fclose(fp);
+    ASSERT_EQ(0, nlp_bert_tokenizer_swap_vocab(tokenizer, TEST_VOCAB_PATH));
+    nlp_int32_t expected_swapped[] = { 2, 1, 4, 3 };
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 8));
+    ASSERT_MEM_EQ(expected_swapped, ids, sizeof(expected_swapped));
+    ASSERT_EQ(5, nlp_bert_tokenizer_vocab_size(tokenizer));
+    ASSERT_STR_EQ("xyz", nlp_bert_tokenizer_id_to_token(tokenizer, 4));
+    nlp_cache_stats_t stats;
+    nlp_bert_tokenizer_cache_stats(tokenizer, &stats);
+    ASSERT_EQ(16, stats.capacity);
+    ASSERT_EQ(2, stats.misses);
+
+    ASSERT(write_test_vocab());
+    ASSERT_EQ(0, nlp_bert_tokenizer_swap_vocab(tokenizer, TEST_VOCAB_PATH));
+    ASSERT_EQ(4, nlp_bert_tokenizer_encode(tokenizer, text, strlen(text), ids, 8));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+/* tasks of a batch call still queued when a pool is destroyed release their job once run */
+static void run_pending_task(const struct thrdpool_task *task) {
+    task->routine(task->context);
+}
+
+TEST test_tokenizer_encode_batch(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    const char *texts[] = { "hello world", "un" };
+    const char *pairs[] = { "!", "world" };
+    nlp_int32_t input_ids[16], attention_mask[16], token_type_ids[16];
+    nlp_bert_encode_options_t options;
+    nlp_bert_encode_options_init(&options);
+    options.max_length = 8;
+    options.padding = NLP_PADDING_LONGEST;
+
+    nlp_ssize_t seq_len =
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, 2, &options, input_ids, attention_mask, NULL);
+    ASSERT_EQ(4, seq_len);
+    nlp_int32_t expected_ids[] = { 2, 5, 6, 3, 2, 11, 3, 0 };
+    nlp_int32_t expected_mask[] = { 1, 1, 1, 1, 1, 1, 1, 0 };
+    ASSERT_MEM_EQ(expected_ids, input_ids, sizeof(expected_ids));
+    ASSERT_MEM_EQ(expected_mask, attention_mask, sizeof(expected_mask));
+
+    // pairs truncated to max_length, the longer sequence loses tokens first
+    options.max_length = 6;
+    options.padding = NLP_PADDING_MAX_LENGTH;
+    seq_len = nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, pairs, NULL, 2, &options, input_ids, NULL,
+      token_type_ids);
+    ASSERT_EQ(6, seq_len);
+    nlp_int32_t expected_pair_ids[] = { 2, 5, 6, 3, 8, 3, 2, 11, 3, 6, 3, 0 };
+    nlp_int32_t expected_types[] = { 0, 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 0 };
+    ASSERT_MEM_EQ(expected_pair_ids, input_ids, sizeof(expected_pair_ids));
+    ASSERT_MEM_EQ(expected_types, token_type_ids, sizeof(expected_types));
+
+    options.truncation = NLP_TRUNCATION_NONE;
+    options.max_length = 4;
+    ASSERT_EQ(-1, nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, pairs, NULL, 2, &options, input_ids, NULL,
+                    NULL));
+
+    // a long document is only encoded about as far as the tokens it keeps, special tokens included
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 64, NLP_CACHE_LRU));
+    const char *words[] = { "hello world ", "hello[SEP]" };
+    for (int k = 0; k < 2; k++) {
+        nlp_size_t word_len = strlen(words[k]);
+        nlp_size_t num_words = 32768 / word_len;
+        char *text = (char *)malloc(num_words * word_len + 1);
+        ASSERT(text != NULL);
+        for (nlp_size_t i = 0; i < num_words; i++) memcpy(text + i * word_len, words[k], word_len);
+        text[num_words * word_len] = '\0';
+        nlp_int32_t prefix[16];
+        ASSERT(nlp_bert_tokenizer_encode(tokenizer, text, 16 * word_len, prefix, 16) >= 12);
+        options.truncation = NLP_TRUNCATION_LONGEST_FIRST;
+        options.max_length = 16;
+        nlp_cache_stats_t before, after;
+        nlp_bert_tokenizer_cache_stats(tokenizer, &before);
+        const char *pair = "un";
+        ASSERT_EQ(16, nlp_bert_tokenizer_encode_batch(tokenizer, (const char **)&text, NULL, &pair, NULL, 1, &options,
+                        input_ids, NULL, NULL));
+        nlp_bert_tokenizer_cache_stats(tokenizer, &after);
+        ASSERT_EQ(2, input_ids[0]);
+        ASSERT_MEM_EQ(prefix, &input_ids[1], sizeof(nlp_int32_t) * 12);
+        nlp_int32_t tail[] = { 3, 11, 3 };
+        ASSERT_MEM_EQ(tail, &input_ids[13], sizeof(tail));
+        nlp_size_t lookups = (after.hits + after.misses) - (before.hits + before.misses);
+        ASSERT_EQ(num_words * 2, nlp_bert_tokenizer_encode(tokenizer, text, num_words * word_len, NULL, 0));
+        nlp_bert_tokenizer_cache_stats(tokenizer, &before);
+        ASSERT(lookups * 4 < (before.hits + before.misses) - (after.hits + after.misses));
+        options.truncation = NLP_TRUNCATION_NONE;
+        ASSERT_EQ(-1, nlp_bert_tokenizer_encode_batch(tokenizer, (const char **)&text, NULL, NULL, NULL, 1, &options,
+                        input_ids, NULL, NULL));
+        free(text);
+    }
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_tokenizer_encode_into(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    nlp_encoding_t *encoding = nlp_encoding_create();
+    ASSERT(encoding != NULL);
+    nlp_bert_encode_options_t options;
+    nlp_bert_encode_options_init(&options);
+    options.max_length = 6;
+    ASSERT_EQ(6, nlp_bert_tokenizer_encode_into(tokenizer, "hello world", 11, "!", 1, &options, encoding));
+    nlp_int32_t expected_ids[] = { 2, 5, 6, 3, 8, 3 };
+    nlp_int32_t expected_types[] = { 0, 0, 0, 0, 1, 1 };
+    ASSERT_MEM_EQ(expected_ids, encoding->input_ids, sizeof(expected_ids));
+    ASSERT_MEM_EQ(expected_types, encoding->token_type_ids, sizeof(expected_types));
+    nlp_token_span_t expected_spans[] = { { 0, 0, 2 }, { 0, 5, 5 }, { 6, 11, 6 }, { 0, 0, 3 }, { 0, 1, 8 },
+        { 0, 0, 3 } };
+    CHECK_CALL(check_spans(expected_spans, encoding->spans, 6));
+
+    // truncated and not padded, the arrays are reused
+    const nlp_int32_t *input_ids = encoding->input_ids;
+    options.max_length = 5;
+    options.padding = NLP_PADDING_LONGEST;
+    const char *text = "hello world unaffable";
+    ASSERT_EQ(5, nlp_bert_tokenizer_encode_into(tokenizer, text, strlen(text), NULL, 0, &options, encoding));
+    ASSERT_EQ(input_ids, encoding->input_ids);
+    nlp_int32_t expected_truncated[] = { 2, 5, 6, 11, 3 };
+    ASSERT_MEM_EQ(expected_truncated, encoding->input_ids, sizeof(expected_truncated));
+    ASSERT_EQ(12, encoding->spans[3].start);
+    ASSERT_EQ(14, encoding->spans[3].end);
+
+    options.max_length = 8;
+    options.padding = NLP_PADDING_MAX_LENGTH;
+    ASSERT_EQ(8, nlp_bert_tokenizer_encode_into(tokenizer, "un", 2, NULL, 0, &options, encoding));
+    nlp_int32_t expected_padded[] = { 2, 11, 3, 0, 0, 0, 0, 0 };
+    nlp_int32_t expected_mask[] = { 1, 1, 1, 0, 0, 0, 0, 0 };
+    ASSERT_MEM_EQ(expected_padded, encoding->input_ids, sizeof(expected_padded));
+    ASSERT_MEM_EQ(expected_mask, encoding->attention_mask, sizeof(expected_mask));
+
+    options.truncation = NLP_TRUNCATION_NONE;
+    options.max_length = 4;
+    ASSERT_EQ(-1, nlp_bert_tokenizer_encode_into(tokenizer, text, strlen(text), NULL, 0, &options, encoding));
+    ASSERT_EQ(0, encoding->len);
+
+    // of a long document only the beginning is encoded, the cache lookups tell how much
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 64, NLP_CACHE_LRU));
+    const char *word = "hello world ";
+    nlp_size_t num_words = 32768 / 12;
+    char *long_text = (char *)malloc(num_words * 12);
+    ASSERT(long_text != NULL);
+    for (nlp_size_t i = 0; i < num_words; i++) memcpy(long_text + i * 12, word, 12);
+    options.truncation = NLP_TRUNCATION_LONGEST_FIRST;
+    options.max_length = 16;
+    nlp_cache_stats_t before, after;
+    nlp_bert_tokenizer_cache_stats(tokenizer, &before);
+    ASSERT_EQ(16, nlp_bert_tokenizer_encode_into(tokenizer, "un", 2, long_text, num_words * 12, &options, encoding));
+    nlp_bert_tokenizer_cache_stats(tokenizer, &after);
+    // two lookups per repeat for the whole text
+    ASSERT(((after.hits + after.misses) - (before.hits + before.misses)) * 4 < 2 * num_words);
+    ASSERT_EQ(11, encoding->input_ids[1]);
+    for (nlp_size_t i = 0; i < 12; i++) {
+        nlp_token_span_t *span = &encoding->spans[3 + i];
+        ASSERT_EQ(i % 2 ? 6 : 5, span->id);
+        ASSERT_EQ((i / 2) * 12 + (i % 2 ? 6 : 0), span->start);
+        ASSERT_EQ(span->start + 5, span->end);
+        ASSERT_EQ(1, encoding->token_type_ids[3 + i]);
+    }
+    ASSERT_EQ(3, encoding->input_ids[15]);
+    free(long_text);
+    nlp_encoding_destory(encoding);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
 }
 
-SUITE(libnlp_tokenizer_tests) { RUN_TEST(test_tokenizer_create); }
\ No newline at end of file
+TEST test_tokenizer_encode_batch_pool(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    thrdpool_t *pool = thrdpool_create(3, 0);
+    ASSERT(pool != NULL);
+    enum { BATCH = 64, MAX_LENGTH = 16 };
+    const char *texts[BATCH];
+    for (int i = 0; i < BATCH; i++) texts[i] = i % 2 ? test_text : "hello world!";
+    static nlp_int32_t sequential[BATCH * MAX_LENGTH], parallel[BATCH * MAX_LENGTH];
+    nlp_bert_encode_options_t options;
+    nlp_bert_encode_options_init(&options);
+    options.max_length = MAX_LENGTH;
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, sequential, NULL, NULL));
+    options.pool = pool;
+    options.num_workers = 4;
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, parallel, NULL, NULL));
+    ASSERT_MEM_EQ(sequential, parallel, sizeof(sequential));
+    thrdpool_destroy(run_pending_task, pool);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+/* keeps the only thread of a pool busy until the mutex is unlocked */
+typedef struct hold_pool
+{
+    pthread_mutex_t mutex;
+    // destroyed from the pool thread if not NULL, which runs the tasks queued behind as pending
+    thrdpool_t *pool;
+    atomic_bool done;
+} hold_pool_t;
+
+static void hold_pool_routine(void *context) {
+    hold_pool_t *hold = (hold_pool_t *)context;
+    pthread_mutex_lock(&hold->mutex);
+    pthread_mutex_unlock(&hold->mutex);
+    if (hold->pool != NULL) thrdpool_destroy(run_pending_task, hold->pool);
+    atomic_store(&hold->done, true);
+}
+
+TEST test_tokenizer_encode_batch_pending(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    thrdpool_t *pool = thrdpool_create(1, 0);
+    ASSERT(pool != NULL);
+    enum { BATCH = 8, MAX_LENGTH = 16 };
+    const char *texts[BATCH];
+    for (int i = 0; i < BATCH; i++) texts[i] = i % 2 ? test_text : "hello world!";
+    nlp_int32_t sequential[BATCH * MAX_LENGTH], parallel[BATCH * MAX_LENGTH];
+    nlp_bert_encode_options_t options;
+    nlp_bert_encode_options_init(&options);
+    options.max_length = MAX_LENGTH;
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, sequential, NULL, NULL));
+    options.pool = pool;
+    options.num_workers = 4;
+
+    // the tasks of the batch wait behind the held thread and only run after the call returned
+    hold_pool_t hold = { .pool = NULL };
+    pthread_mutex_init(&hold.mutex, NULL);
+    atomic_init(&hold.done, false);
+    pthread_mutex_lock(&hold.mutex);
+    struct thrdpool_task task = { hold_pool_routine, &hold };
+    ASSERT_EQ(0, thrdpool_schedule(&task, pool));
+    for (int k = 0; k < 2; k++) {
+        ASSERT_EQ(MAX_LENGTH,
+          nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, parallel, NULL, NULL));
+        ASSERT_MEM_EQ(sequential, parallel, sizeof(sequential));
+    }
+    pthread_mutex_unlock(&hold.mutex);
+    // late tasks find their batch gone and leave the next one alone
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, parallel, NULL, NULL));
+    ASSERT_MEM_EQ(sequential, parallel, sizeof(sequential));
+    while (!atomic_load(&hold.done)) sched_yield();
+
+    // tasks run as pending when the pool is destroyed release the job
+    hold.pool = pool;
+    atomic_store(&hold.done, false);
+    pthread_mutex_lock(&hold.mutex);
+    ASSERT_EQ(0, thrdpool_schedule(&task, pool));
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, parallel, NULL, NULL));
+    ASSERT_MEM_EQ(sequential, parallel, sizeof(sequential));
+    pthread_mutex_unlock(&hold.mutex);
+    while (!atomic_load(&hold.done)) sched_yield();
+    pthread_mutex_destroy(&hold.mutex);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+/* drain `batcher` and check every batch against encoding its rows one at a time */
+static enum greatest_test_res check_batcher(bert_tokenizer_t *tokenizer,
+  bert_batcher_t *batcher,
+  const nlp_bert_batcher_options_t *options,
+  const char *const *texts,
+  nlp_size_t num_texts,
+  nlp_size_t num_rows) {
+    bool seen[64] = { false };
+    nlp_size_t rows = 0;
+    nlp_int32_t expected[16];
+    nlp_bert_encode_options_t encode = options->encode;
+    encode.padding = NLP_PADDING_LONGEST;
+    nlp_batch_t *batch;
+    while ((batch = nlp_bert_batcher_next(batcher, true)) != NULL) {
+        ASSERT(batch->batch_size * batch->seq_len <= options->max_tokens);
+        for (nlp_size_t i = 0; i < batch->batch_size; i++) {
+            nlp_uint64_t id = batch->request_ids[i];
+            ASSERT(id < num_texts && !seen[id]);
+            seen[id] = true;
+            nlp_ssize_t len = nlp_bert_tokenizer_encode_batch(tokenizer, &texts[id], NULL, NULL, NULL, 1, &encode,
+              expected, NULL, NULL);
+            ASSERT(len > 0 && (nlp_size_t)len <= batch->seq_len);
+            const nlp_int32_t *row_ids = batch->input_ids + i * batch->seq_len;
+            const nlp_int32_t *row_mask = batch->attention_mask + i * batch->seq_len;
+            ASSERT_MEM_EQ(expected, row_ids, sizeof(nlp_int32_t) * len);
+            // padded to the longest row, which is in the same bucket
+            ASSERT(batch->seq_len - len < options->bucket_width);
+            ASSERT_EQ(1, row_mask[len - 1]);
+            if ((nlp_size_t)len < batch->seq_len) ASSERT_EQ(0, row_mask[len]);
+        }
+        rows += batch->batch_size;
+        nlp_batch_free(batch);
+    }
+    ASSERT_EQ(num_rows, rows);
+    PASS();
+}
+
+TEST test_tokenizer_batcher(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    enum { NUM_TEXTS = 48 };
+    static char buffers[NUM_TEXTS][96];
+    const char *texts[NUM_TEXTS];
+    for (int i = 0; i < NUM_TEXTS; i++) {
+        // 2 to 15 tokens with [CLS] and [SEP], in no order
+        buffers[i][0] = '\0';
+        for (int k = 0; k < (i * 5) % 14; k++) strcat(buffers[i], "hello ");
+        texts[i] = buffers[i];
+    }
+    nlp_bert_batcher_options_t options;
+    nlp_bert_batcher_options_init(&options);
+    options.encode.max_length = 16;
+    options.max_tokens = 32;
+    options.bucket_width = 4;
+
+    bert_batcher_t *batcher = nlp_bert_batcher_create(tokenizer, &options);
+    ASSERT(batcher != NULL);
+    for (int i = 0; i < NUM_TEXTS; i++) {
+        ASSERT_EQ(i, nlp_bert_batcher_add(batcher, texts[i], strlen(texts[i]), NULL, 0));
+    }
+    // the bucket of 9 to 12 tokens is the first to fill up, with 2 rows
+    nlp_batch_t *batch = nlp_bert_batcher_next(batcher, false);
+    ASSERT(batch != NULL);
+    ASSERT_EQ(2, batch->batch_size);
+    ASSERT_EQ(12, batch->seq_len);
+    nlp_batch_free(batch);
+    CHECK_CALL(check_batcher(tokenizer, batcher, &options, texts, NUM_TEXTS, NUM_TEXTS - 2));
+    nlp_bert_batcher_stats_t stats;
+    nlp_bert_batcher_stats(batcher, &stats);
+    ASSERT_EQ(NUM_TEXTS, stats.requests);
+    ASSERT_EQ(0, stats.failed);
+    ASSERT(stats.padding * 4 < stats.tokens);
+    nlp_bert_batcher_stats(NULL, &stats);
+    nlp_bert_batcher_destory(batcher);
+
+    // the same rows come out when the requests are encoded on a pool
+    thrdpool_t *pool = thrdpool_create(3, 0);
+    ASSERT(pool != NULL);
+    options.encode.pool = pool;
+    batcher = nlp_bert_batcher_create(tokenizer, &options);
+    ASSERT(batcher != NULL);
+    for (int i = 0; i < NUM_TEXTS; i++) {
+        ASSERT_EQ(i, nlp_bert_batcher_add(batcher, texts[i], strlen(texts[i]), NULL, 0));
+    }
+    CHECK_CALL(check_batcher(tokenizer, batcher, &options, texts, NUM_TEXTS, NUM_TEXTS));
+    nlp_bert_batcher_destory(batcher);
+
+    // a request that fails on the pool after add returned its id is reported with a batch
+    options.encode.truncation = NLP_TRUNCATION_NONE;
+    batcher = nlp_bert_batcher_create(tokenizer, &options);
+    ASSERT(batcher != NULL);
+    const char *too_long = "hello hello hello hello hello hello hello hello hello hello hello hello hello hello hello";
+    ASSERT_EQ(0, nlp_bert_batcher_add(batcher, too_long, strlen(too_long), NULL, 0));
+    ASSERT_EQ(1, nlp_bert_batcher_add(batcher, "hello", 5, NULL, 0));
+    nlp_size_t rows = 0, num_failed = 0;
+    while ((batch = nlp_bert_batcher_next(batcher, true)) != NULL) {
+        for (nlp_size_t i = 0; i < batch->batch_size; i++) ASSERT_EQ(1, batch->request_ids[i]);
+        for (nlp_size_t i = 0; i < batch->num_failed; i++) ASSERT_EQ(0, batch->failed_ids[i]);
+        rows += batch->batch_size;
+        num_failed += batch->num_failed;
+        nlp_batch_free(batch);
+    }
+    ASSERT_EQ(1, rows);
+    ASSERT_EQ(1, num_failed);
+    nlp_bert_batcher_stats(batcher, &stats);
+    ASSERT_EQ(1, stats.failed);
+    nlp_bert_batcher_destory(batcher);
+    options.encode.truncation = NLP_TRUNCATION_LONGEST_FIRST;
+    thrdpool_destroy(run_pending_task, pool);
+
+    // a row is padded with the [PAD] of the vocab it was encoded with, even after a swap
+    options.encode.pool = NULL;
+    batcher = nlp_bert_batcher_create(tokenizer, &options);
+    ASSERT(batcher != NULL);
+    ASSERT_EQ(0, nlp_bert_batcher_add(batcher, "hello", 5, NULL, 0));
+    ASSERT_EQ(1, nlp_bert_batcher_add(batcher, "hello hello", 11, NULL, 0));
+    FILE *fp = fopen(TEST_VOCAB_PATH, "w");
+    ASSERT(fp != NULL);
+    fputs("[UNK]\n[CLS]\n[SEP]\nhello\n[PAD]\n", fp);
+    fclose(fp);
+    ASSERT_EQ(0, nlp_bert_tokenizer_swap_vocab(tokenizer, TEST_VOCAB_PATH));
+    ASSERT_EQ(2, nlp_bert_batcher_add(batcher, "hello", 5, NULL, 0));
+    batch = nlp_bert_batcher_next(batcher, true);
+    ASSERT(batch != NULL);
+    ASSERT_EQ(3, batch->batch_size);
+    ASSERT_EQ(4, batch->seq_len);
+    nlp_int32_t padded[][4] = { { 2, 5, 3, 0 }, { 2, 5, 5, 3 }, { 1, 3, 2, 4 } };
+    for (nlp_size_t i = 0; i < batch->batch_size; i++)
+        ASSERT_MEM_EQ(padded[batch->request_ids[i]], &batch->input_ids[i * 4], sizeof(padded[0]));
+    nlp_batch_free(batch);
+    nlp_bert_batcher_destory(batcher);
+
+    options.max_tokens = 8;
+    ASSERT_EQ(NULL, nlp_bert_batcher_create(tokenizer, &options));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_basic_tokenizer_normalize(void) {
+    basic_tokenizer_t *tokenizer = nlp_basic_tokenizer_create(true);
+    ASSERT(tokenizer != NULL);
+    const char *text = "  Héllo,\tWORLD\x01! 中国 Ünïcode ";
+    char out[64];
+    nlp_ssize_t n = nlp_basic_tokenizer_normalize(tokenizer, text, strlen(text), out, sizeof(out));
+    ASSERT_STR_EQ("hello , world ! 中 国 unicode", out);
+    ASSERT_EQ((nlp_ssize_t)strlen(out), n);
+    ASSERT_EQ(n, nlp_basic_tokenizer_normalize(tokenizer, text, strlen(text), out, 4));
+    nlp_basic_tokenizer_destory(tokenizer);
+
+    tokenizer = nlp_basic_tokenizer_create_ex(false, false, false);
+    ASSERT(tokenizer != NULL);
+    nlp_basic_tokenizer_normalize(tokenizer, text, strlen(text), out, sizeof(out));
+    ASSERT_STR_EQ("Héllo , WORLD ! 中国 Ünïcode", out);
+    nlp_basic_tokenizer_destory(tokenizer);
+
+    // every flag combination has a kernel of its own
+    tokenizer = nlp_basic_tokenizer_create_ex(false, true, true);
+    ASSERT(tokenizer != NULL);
+    nlp_basic_tokenizer_normalize(tokenizer, text, strlen(text), out, sizeof(out));
+    ASSERT_STR_EQ("Hello , WORLD ! 中 国 Unicode", out);
+    nlp_basic_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+TEST test_basic_tokenizer_normalize_long(void) {
+    basic_tokenizer_t *tokenizer = nlp_basic_tokenizer_create(true);
+    ASSERT(tokenizer != NULL);
+    // long enough for whole vector blocks of ascii, with letters to lower and punctuation to split in them
+    char text[1024], expected[1024], out[1024];
+    int len = 0, expected_len = 0;
+    for (int i = 0; i < 8; i++) {
+        len += sprintf(text + len, "The QUICK brown fox jumps over 12 lazy dogs, Ünïcode\t%d times. ", i);
+        expected_len += sprintf(expected + expected_len,
+          "%sthe quick brown fox jumps over 12 lazy dogs , unicode %d times .",
+          i ? " " : "",
+          i);
+    }
+    ASSERT_EQ(expected_len, nlp_basic_tokenizer_normalize(tokenizer, text, len, out, sizeof(out)));
+    ASSERT_STR_EQ(expected, out);
+    nlp_basic_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+/* encodes a batch on the pool over and over until stopped, checking every result */
+typedef struct encode_loop
+{
+    const bert_tokenizer_t *tokenizer;
+    const char *const *texts;
+    nlp_size_t batch_size;
+    const nlp_bert_encode_options_t *options;
+    const nlp_int32_t *expected;
+    nlp_int32_t *out;
+    atomic_bool stop;
+    atomic_bool failed;
+    atomic_int rounds;
+} encode_loop_t;
+
+static void *encode_loop_routine(void *arg) {
+    encode_loop_t *loop = (encode_loop_t *)arg;
+    nlp_size_t max_length = loop->options->max_length;
+    while (!atomic_load(&loop->stop)) {
+        nlp_ssize_t n = nlp_bert_tokenizer_encode_batch(loop->tokenizer, loop->texts, NULL, NULL, NULL,
+          loop->batch_size, loop->options, loop->out, NULL, NULL);
+        if (n != (nlp_ssize_t)max_length
+            || memcmp(loop->expected, loop->out, sizeof(nlp_int32_t) * loop->batch_size * max_length) != 0)
+            atomic_store(&loop->failed, true);
+        atomic_fetch_add(&loop->rounds, 1);
+    }
+    return NULL;
+}
+
+TEST test_tokenizer_cache(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 4, NLP_CACHE_LRU));
+    nlp_int32_t ids[16];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(10, nlp_bert_tokenizer_encode(tokenizer, test_text, strlen(test_text), ids, 16));
+        ASSERT_MEM_EQ(test_ids, ids, sizeof(test_ids));
+    }
+    nlp_cache_stats_t stats;
+    nlp_bert_tokenizer_cache_stats(tokenizer, &stats);
+    ASSERT_EQ(4, stats.capacity);
+    ASSERT_EQ(4, stats.size);
+    // 6 lookups per text, the CJK characters skip the cache
+    ASSERT_EQ(18, stats.hits + stats.misses);
+    ASSERT(stats.evictions > 0);
+
+    // threads filling and reading the cache at once get what encoding without it gives
+    enum { BATCH = 64, MAX_LENGTH = 16 };
+    static const char *words[] = { "hello", "world", "unaffable", "un", "xyz", "able", "aff", "!" };
+    static char buffers[BATCH][64];
+    const char *texts[BATCH];
+    for (int i = 0; i < BATCH; i++) {
+        snprintf(buffers[i], sizeof(buffers[i]), "%s %s, %s %s", words[i % 8], words[(i / 8) % 8],
+          words[(i * 3) % 8], words[(i * 5 + 1) % 8]);
+        texts[i] = buffers[i];
+    }
+    static nlp_int32_t expected[BATCH * MAX_LENGTH], cached[BATCH * MAX_LENGTH];
+    nlp_bert_encode_options_t options;
+    nlp_bert_encode_options_init(&options);
+    options.max_length = MAX_LENGTH;
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 0, NLP_CACHE_LRU));
+    ASSERT_EQ(MAX_LENGTH,
+      nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, expected, NULL, NULL));
+    thrdpool_t *pool = thrdpool_create(3, 0);
+    ASSERT(pool != NULL);
+    options.pool = pool;
+    options.num_workers = 4;
+    nlp_cache_policy_t policies[] = { NLP_CACHE_LRU, NLP_CACHE_FIFO };
+    for (int k = 0; k < 2; k++) {
+        // fewer slots than words so that the workers evict each other's words
+        ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 6, policies[k]));
+        for (int round = 0; round < 4; round++) {
+            ASSERT_EQ(MAX_LENGTH,
+              nlp_bert_tokenizer_encode_batch(tokenizer, texts, NULL, NULL, NULL, BATCH, &options, cached, NULL, NULL));
+            ASSERT_MEM_EQ(expected, cached, sizeof(expected));
+        }
+    }
+
+    // the cache and the special tokens can be changed while other threads encode
+    encode_loop_t loop = { tokenizer, texts, BATCH, &options, expected, cached };
+    atomic_init(&loop.stop, false);
+    atomic_init(&loop.failed, false);
+    atomic_init(&loop.rounds, 0);
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, encode_loop_routine, &loop));
+    for (int i = 0; i < 16; i++) {
+        while (atomic_load(&loop.rounds) <= i) sched_yield();
+        ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, i % 4 ? 6 : 0, policies[i % 2]));
+        char token[16];
+        snprintf(token, sizeof(token), "<s%d>", i);
+        ASSERT_EQ(0, nlp_bert_tokenizer_add_special_tokens(tokenizer, (const char *[]){ token }, 1));
+    }
+    atomic_store(&loop.stop, true);
+    pthread_join(thread, NULL);
+    ASSERT(!atomic_load(&loop.failed));
+    ASSERT_EQ(14 + 16, nlp_bert_tokenizer_vocab_size(tokenizer));
+    thrdpool_destroy(run_pending_task, pool);
+    ASSERT_EQ(0, nlp_bert_tokenizer_set_cache(tokenizer, 0, NLP_CACHE_LRU));
+    nlp_bert_tokenizer_cache_stats(tokenizer, &stats);
+    ASSERT_EQ(0, stats.capacity);
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+static bpe_tokenizer_t *create_test_bpe_tokenizer(void) {
+    // "Ġ" is the byte-level spelling of ' ', "Ã©" (escaped here) the one of "é"
+    static const char *vocab = "{\"h\": 0, \"e\": 1, \"l\": 2, \"o\": 3, \"Ġ\": 4, \"w\": 5, \"r\": 6, \"d\": 7, "
+                               "\"'\": 8, \"s\": 9, \"he\": 10, \"ll\": 11, \"hell\": 12, \"hello\": 13, \"Ġw\": 14, "
+                               "\"or\": 15, \"Ġwor\": 16, \"ld\": 17, \"Ġworld\": 18, \"\\u00c3\": 19, \"©\": 20, "
+                               "\"\\u00c3\\u00a9\": 21}";
+    static const char *merges = "#version: 0.2\nh e\nl l\nhe ll\nhell o\nĠ w\no r\nĠw or\nl d\nĠwor ld\nÃ ©\n";
+    FILE *fp = fopen(TEST_BPE_VOCAB_PATH, "w");
+    if (fp == NULL) return NULL;
+    fputs(vocab, fp);
+    fclose(fp);
+    fp = fopen(TEST_BPE_MERGES_PATH, "w");
+    if (fp == NULL) return NULL;
+    fputs(merges, fp);
+    fclose(fp);
+    return nlp_bpe_tokenizer_create(TEST_BPE_VOCAB_PATH, TEST_BPE_MERGES_PATH);
+}
+
+TEST test_bpe_tokenizer(void) {
+    bpe_tokenizer_t *tokenizer = create_test_bpe_tokenizer();
+    ASSERT(tokenizer != NULL);
+    ASSERT_EQ(22, nlp_bpe_tokenizer_vocab_size(tokenizer));
+    ASSERT_EQ(18, nlp_bpe_tokenizer_token_to_id(tokenizer, "Ġworld", strlen("Ġworld")));
+    ASSERT_STR_EQ("Ã©", nlp_bpe_tokenizer_id_to_token(tokenizer, 21));
+
+    // "hello" "Ġworld" "'s" "Ġé", '!' is not in the vocab
+    const char *text = "hello world's é!";
+    nlp_int32_t expected[] = { 13, 18, 8, 9, 4, 21 };
+    nlp_int32_t ids[16];
+    ASSERT_EQ(6, nlp_bpe_tokenizer_encode(tokenizer, text, strlen(text), ids, 16));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+    ASSERT_EQ(6, nlp_bpe_tokenizer_encode(tokenizer, text, strlen(text), ids, 2));
+    // two adjacent bytes missing from the vocab must not look up the empty pair of the merge table
+    ASSERT_EQ(0, nlp_bpe_tokenizer_encode(tokenizer, "!!", 2, ids, 16));
+    ASSERT_EQ(2, nlp_bpe_tokenizer_encode(tokenizer, "he !!", 5, ids, 16));
+    ASSERT_EQ(10, ids[0]);
+    ASSERT_EQ(4, ids[1]);
+
+    char out[32];
+    ASSERT_EQ(16, nlp_bpe_tokenizer_decode(tokenizer, expected, 6, out, sizeof(out)));
+    ASSERT_STR_EQ("hello world's é", out);
+    ids[0] = 22;
+    ASSERT_EQ(-1, nlp_bpe_tokenizer_decode(tokenizer, ids, 1, out, sizeof(out)));
+    nlp_bpe_tokenizer_destory(tokenizer);
+    ASSERT_EQ(NULL, nlp_bpe_tokenizer_create("libnlp_test_missing.json", TEST_BPE_MERGES_PATH));
+    PASS();
+}
+
+/* a SentencePiece ModelProto.SentencePiece message: piece (1), score (2), type (3) */
+static void write_test_piece(FILE *fp, const char *piece, float score, int type) {
+    unsigned char bits[4];
+    memcpy(bits, &score, sizeof(bits));
+    size_t len = strlen(piece);
+    fprintf(fp, "%c%c%c%c", 0x0A, (int)len + 9, 0x0A, (int)len);
+    fputs(piece, fp);
+    fprintf(fp, "%c%c%c%c%c%c%c", 0x15, bits[0], bits[1], bits[2], bits[3], 0x18, type);
+}
+
+static unigram_tokenizer_t *create_test_unigram_tokenizer(void) {
+    FILE *fp = fopen(TEST_UNIGRAM_MODEL_PATH, "wb");
+    if (fp == NULL) return NULL;
+    write_test_piece(fp, "<unk>", 0.0f, 2);
+    write_test_piece(fp, "<s>", 0.0f, 3);
+    write_test_piece(fp, "</s>", 0.0f, 3);
+    const char *pieces[] = { "▁", "▁hello", "▁world", "▁wor", "ld", "h", "e", "l", "o" };
+    const float scores[] = { -3.0f, -1.0f, -1.0f, -2.0f, -2.0f, -4.0f, -4.0f, -4.0f, -4.0f };
+    for (int i = 0; i < 9; i++) write_test_piece(fp, pieces[i], scores[i], 1);
+    // normalizer_spec { name: "identity" }
+    fprintf(fp, "%c%c%c%c%s", 0x1A, 10, 0x0A, 8, "identity");
+    fclose(fp);
+    return nlp_unigram_tokenizer_create(TEST_UNIGRAM_MODEL_PATH);
+}
+
+TEST test_unigram_tokenizer(void) {
+    unigram_tokenizer_t *tokenizer = create_test_unigram_tokenizer();
+    ASSERT(tokenizer != NULL);
+    ASSERT_EQ(12, nlp_unigram_tokenizer_vocab_size(tokenizer));
+    ASSERT_EQ(5, nlp_unigram_tokenizer_token_to_id(tokenizer, "▁world", strlen("▁world")));
+    ASSERT_STR_EQ("ld", nlp_unigram_tokenizer_id_to_token(tokenizer, 7));
+
+    // "▁hello" "▁world" beats "▁wor" "ld", '!' is unknown
+    const char *text = "  hello  world!";
+    nlp_int32_t expected[] = { 4, 5, 0 };
+    nlp_int32_t ids[16];
+    ASSERT_EQ(3, nlp_unigram_tokenizer_encode(tokenizer, text, strlen(text), ids, 16));
+    ASSERT_MEM_EQ(expected, ids, sizeof(expected));
+    nlp_int32_t expected_chars[] = { 3, 8, 8, 0 };
+    ASSERT_EQ(4, nlp_unigram_tokenizer_encode(tokenizer, "hh!?", 4, ids, 16));
+    ASSERT_MEM_EQ(expected_chars, ids, sizeof(expected_chars));
+    ASSERT_EQ(0, nlp_unigram_tokenizer_encode(tokenizer, " ", 1, ids, 16));
+
+    char out[32];
+    nlp_int32_t decode_ids[] = { 1, 4, 6, 7, 0, 2 };
+    ASSERT_EQ(16, nlp_unigram_tokenizer_decode(tokenizer, decode_ids, 6, out, sizeof(out)));
+    ASSERT_STR_EQ("hello world \xE2\x81\x87 ", out);
+    nlp_unigram_tokenizer_destory(tokenizer);
+    ASSERT_EQ(NULL, nlp_unigram_tokenizer_create(TEST_VOCAB_PATH));
+    PASS();
+}
+
+static nlp_ssize_t pipeline_test_encode(const void *tokenizer,
+  const char *text,
+  nlp_size_t len,
+  nlp_int32_t *ids,
+  nlp_size_t max_ids) {
+    return nlp_bert_tokenizer_encode((const bert_tokenizer_t *)tokenizer, text, len, ids, max_ids);
+}
+
+TEST test_pipeline(void) {
+    bert_tokenizer_t *tokenizer = create_test_tokenizer();
+    ASSERT(tokenizer != NULL);
+    enum { NUM_LINES = 300 };
+    FILE *fp = fopen(TEST_CORPUS_PATH, "w");
+    ASSERT(fp != NULL);
+    for (int i = 0; i < NUM_LINES; i++) fprintf(fp, "%s\n%s", i % 2 ? test_text : "hello world", i % 3 ? "" : "\n");
+    fclose(fp);
+
+    nlp_pipeline_options_t options;
+    nlp_pipeline_options_init(&options);
+    options.num_workers = 3;
+    options.batch_bytes = 100;
+    options.max_in_flight = 4;
+    options.shard_ids = 1000;
+    options.eos_id = 3;
+    nlp_pipeline_stats_t stats;
+    ASSERT_EQ(0,
+      nlp_pipeline_run(TEST_CORPUS_PATH, TEST_SHARD_PREFIX, pipeline_test_encode, tokenizer, &options, &stats));
+    // "hello world" is 2 ids, test_text 10, plus the eos id
+    ASSERT_EQ(NUM_LINES, stats.documents);
+    ASSERT_EQ(NUM_LINES / 2 * (3 + 11), stats.ids);
+    ASSERT_EQ(3, stats.shards);
+
+    // the shards hold the documents in corpus order
+    nlp_int32_t expected[2][11] = { { 5, 6, 3 }, { 0 } };
+    memcpy(expected[1], test_ids, sizeof(test_ids));
+    expected[1][10] = 3;
+    nlp_size_t doc = 0, pos = 0;
+    for (int shard = 0; shard < 3; shard++) {
+        char path[352];
+        snprintf(path, sizeof(path), "%s-%05d.bin", TEST_SHARD_PREFIX, shard);
+        size_t size;
+        nlp_int32_t *ids = (nlp_int32_t *)readfile(path, &size);
+        ASSERT(ids != NULL);
+        for (size_t i = 0; i < size / sizeof(nlp_int32_t); i++) {
+            ASSERT_EQ(expected[doc % 2][pos], ids[i]);
+            if (++pos == (doc % 2 ? 11 : 3)) {
+                pos = 0;
+                doc++;
+            }
+        }
+        free(ids);
+    }
+    ASSERT_EQ(NUM_LINES, doc);
+
+    // empty lines separate paragraphs
+    options.document_mode = NLP_DOCUMENT_PARAGRAPH;
+    ASSERT_EQ(0,
+      nlp_pipeline_run(TEST_CORPUS_PATH, TEST_SHARD_PREFIX, pipeline_test_encode, tokenizer, &options, &stats));
+    // a paragraph ends at every third line, and the last two lines make one more
+    ASSERT_EQ(NUM_LINES / 3 + 1, stats.documents);
+    ASSERT_EQ(NUM_LINES / 2 * 12 + NUM_LINES / 3 + 1, stats.ids);
+    ASSERT_EQ(-1, nlp_pipeline_run("libnlp_test_missing.txt", TEST_SHARD_PREFIX, pipeline_test_encode, tokenizer,
+                    &options, NULL));
+    nlp_bert_tokenizer_destory(tokenizer);
+    PASS();
+}
+
+SUITE(libnlp_tokenizer_tests) {
+    create_test_dir();
+    SET_TEARDOWN(remove_test_files, NULL);
+    RUN_TEST(test_tokenizer_create);
+    RUN_TEST(test_tokenizer_encode);
+    RUN_TEST(test_tokenizer_count);
+    RUN_TEST(test_tokenizer_encode_spans);
+    RUN_TEST(test_tokenizer_binary_vocab);
+    RUN_TEST(test_tokenizer_reencode_spans);
+    RUN_TEST(test_tokenizer_stream);
+    RUN_TEST(test_tokenizer_special_tokens);
+    RUN_TEST(test_tokenizer_swap_vocab);
+    RUN_TEST(test_tokenizer_encode_batch);
+    RUN_TEST(test_tokenizer_encode_into);
+    RUN_TEST(test_tokenizer_encode_batch_pool);
+    RUN_TEST(test_tokenizer_encode_batch_pending);
+    RUN_TEST(test_tokenizer_batcher);
+    RUN_TEST(test_basic_tokenizer_normalize);
+    RUN_TEST(test_basic_tokenizer_normalize_long);
+    RUN_TEST(test_tokenizer_cache);
+    RUN_TEST(test_bpe_tokenizer);
+    RUN_TEST(test_unigram_tokenizer);
+    RUN_TEST(test_pipeline);
+    SET_TEARDOWN(NULL, NULL);
+    if (strcmp(test_dir, ".") != 0) rmdir(test_dir);
+}
@@ -0,0 +1,177 @@
+/*
+    Generate src/char_class_data.c, the two-stage tables of character classes
+    and of case mappings behind utf8_char_class, utf8_char_lower and
+    utf8_char_upper, from the utf8proc in 3rdparty:
+
+        cc -Iinclude -I3rdparty/utf8proc -DUTF8PROC_STATIC tools/gen_char_class.c \
+           3rdparty/utf8proc/utf8proc.c -o gen_char_class
+        ./gen_char_class > src/char_class_data.c
+
+    The class definitions here are the reference ones, run it again when
+    utf8proc is updated or a class changes.
+*/
+#include "../src/char_class.h"
+
+#include "utf8proc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_BLOCKS (CHAR_CLASS_MAX_CODEPOINT / CHAR_CLASS_BLOCK_SIZE + 1)
+#define NUM_CASE_BLOCKS (CHAR_CASE_MAX_CODEPOINT / CHAR_CLASS_BLOCK_SIZE + 1)
+#define MAX_CASE_DELTAS 256
+
+static bool is_chinese(nlp_int32_t cp) {
+    // the CJK Unicode blocks, not Hangul, Hiragana or Katakana
+    return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) || (cp >= 0x20000 && cp <= 0x2A6DF)
+           || (cp >= 0x2A700 && cp <= 0x2B73F) || (cp >= 0x2B740 && cp <= 0x2B81F) || (cp >= 0x2B820 && cp <= 0x2CEAF)
+           || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x2F800 && cp <= 0x2FA1F);
+}
+
+static nlp_uint8_t classify(nlp_int32_t cp) {
+    utf8proc_category_t cat = utf8proc_category(cp);
+    bool ascii_space = cp == ' ' || cp == '\t' || cp == '\n' || cp == '\r';
+    bool ascii_punct = (cp >= 33 && cp <= 47) || (cp >= 58 && cp <= 64) || (cp >= 91 && cp <= 96)
+                       || (cp >= 123 && cp <= 126);
+    nlp_uint8_t flags = 0;
+    if (ascii_space || cat == UTF8PROC_CATEGORY_ZS) flags |= UTF8_CLASS_WHITESPACE;
+    // Cn, Cc, Cf, Cs, Co except the whitespace controls
+    if (!ascii_space && (cat == UTF8PROC_CATEGORY_CN || cat >= UTF8PROC_CATEGORY_CC)) flags |= UTF8_CLASS_CONTROL;
+    if (ascii_punct || (cat >= UTF8PROC_CATEGORY_PC && cat <= UTF8PROC_CATEGORY_PO)) flags |= UTF8_CLASS_PUNCTUATION;
+    if (is_chinese(cp)) flags |= UTF8_CLASS_CHINESE;
+    if (cat == UTF8PROC_CATEGORY_MN) flags |= UTF8_CLASS_NONSPACING_MARK;
+    if (cat >= UTF8PROC_CATEGORY_LU && cat <= UTF8PROC_CATEGORY_LO) flags |= UTF8_CLASS_LETTER;
+    if (cat >= UTF8PROC_CATEGORY_ND && cat <= UTF8PROC_CATEGORY_NO) flags |= UTF8_CLASS_NUMBER;
+    return flags;
+}
+
+static nlp_uint8_t blocks[NUM_BLOCKS][CHAR_CLASS_BLOCK_SIZE];
+static nlp_uint8_t stage1[NUM_BLOCKS];
+
+typedef struct case_table {
+    const char *name;
+    nlp_uint8_t stage1[NUM_CASE_BLOCKS];
+    nlp_uint8_t blocks[NUM_CASE_BLOCKS][CHAR_CLASS_BLOCK_SIZE];
+    size_t num_blocks;
+    nlp_int32_t deltas[MAX_CASE_DELTAS];
+    size_t num_deltas;
+} case_table_t;
+
+static case_table_t lower_table = {.name = "lower"};
+static case_table_t upper_table = {.name = "upper"};
+
+static void print_bytes(const nlp_uint8_t *bytes, size_t n, const char *indent) {
+    for (size_t i = 0; i < n; i++) {
+        if (i % 16 == 0) printf("%s", indent);
+        printf("0x%02X,%s", bytes[i], i % 16 == 15 || i + 1 == n ? "\n" : " ");
+    }
+}
+
+static size_t add_block(nlp_uint8_t (*pool)[CHAR_CLASS_BLOCK_SIZE], size_t *num_blocks, const nlp_uint8_t *block) {
+    size_t k = 0;
+    while (k < *num_blocks && memcmp(pool[k], block, CHAR_CLASS_BLOCK_SIZE) != 0) k++;
+    if (k == *num_blocks) memcpy(pool[(*num_blocks)++], block, CHAR_CLASS_BLOCK_SIZE);
+    return k;
+}
+
+/* stage 2 of a case table holds the index of cp's mapping - cp among the distinct ones, 0 for no mapping */
+static int build_case_table(case_table_t *table, utf8proc_int32_t (*mapping)(utf8proc_int32_t)) {
+    table->deltas[table->num_deltas++] = 0;
+    for (nlp_int32_t cp = CHAR_CASE_MAX_CODEPOINT + 1; cp <= CHAR_CLASS_MAX_CODEPOINT; cp++) {
+        if (mapping(cp) != cp) {
+            fprintf(stderr, "U+%04X has a case, raise CHAR_CASE_MAX_CODEPOINT\n", (unsigned)cp);
+            return 1;
+        }
+    }
+    for (size_t b = 0; b < NUM_CASE_BLOCKS; b++) {
+        nlp_uint8_t block[CHAR_CLASS_BLOCK_SIZE];
+        for (size_t i = 0; i < CHAR_CLASS_BLOCK_SIZE; i++) {
+            nlp_int32_t cp = (nlp_int32_t)(b * CHAR_CLASS_BLOCK_SIZE + i);
+            nlp_int32_t delta = mapping(cp) - cp;
+            size_t k = 0;
+            while (k < table->num_deltas && table->deltas[k] != delta) k++;
+            if (k == table->num_deltas) {
+                if (k == MAX_CASE_DELTAS) {
+                    fprintf(stderr, "more than %d distinct %s deltas\n", MAX_CASE_DELTAS, table->name);
+                    return 1;
+                }
+                table->deltas[table->num_deltas++] = delta;
+            }
+            block[i] = (nlp_uint8_t)k;
+        }
+        size_t k = add_block(table->blocks, &table->num_blocks, block);
+        if (k > UINT8_MAX) {
+            fprintf(stderr, "more than 256 distinct %s blocks\n", table->name);
+            return 1;
+        }
+        table->stage1[b] = (nlp_uint8_t)k;
+    }
+    return 0;
+}
+
+static int check_lower_lengths(void) {
+    // utf8str_lower_inplace looks for these two, they are the only ones that grow
+    for (nlp_int32_t cp = 0; cp <= CHAR_CASE_MAX_CODEPOINT; cp++) {
+        nlp_uint8_t bytes[4];
+        nlp_int32_t lower = utf8proc_tolower(cp);
+        if (utf8proc_encode_char(lower, bytes) > utf8proc_encode_char(cp, bytes) && cp != 0x023A && cp != 0x023E) {
+            fprintf(stderr, "the lowercase of U+%04X is longer, update utf8str_lower_inplace\n", (unsigned)cp);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void print_case_table(const case_table_t *table) {
+    printf("\nconst nlp_uint8_t char_%s_stage1[%d] = {\n", table->name, NUM_CASE_BLOCKS);
+    print_bytes(table->stage1, NUM_CASE_BLOCKS, "    ");
+    printf("};\n\n");
+    printf("const nlp_uint8_t char_%s_stage2[%zu][CHAR_CLASS_BLOCK_SIZE] = {\n", table->name, table->num_blocks);
+    for (size_t k = 0; k < table->num_blocks; k++) {
+        printf("    {\n");
+        print_bytes(table->blocks[k], CHAR_CLASS_BLOCK_SIZE, "        ");
+        printf("    },\n");
+    }
+    printf("};\n\n");
+    printf("const nlp_int32_t char_%s_deltas[%zu] = {\n", table->name, table->num_deltas);
+    for (size_t i = 0; i < table->num_deltas; i++) {
+        if (i % 8 == 0) printf("    ");
+        printf("%d,%s", table->deltas[i], i % 8 == 7 || i + 1 == table->num_deltas ? "\n" : " ");
+    }
+    printf("};\n");
+}
+
+int main(void) {
+    size_t num_blocks = 0;
+    for (size_t b = 0; b < NUM_BLOCKS; b++) {
+        nlp_uint8_t block[CHAR_CLASS_BLOCK_SIZE];
+        for (size_t i = 0; i < CHAR_CLASS_BLOCK_SIZE; i++)
+            block[i] = classify((nlp_int32_t)(b * CHAR_CLASS_BLOCK_SIZE + i));
+        size_t k = add_block(blocks, &num_blocks, block);
+        if (k > UINT8_MAX) {
+            fprintf(stderr, "more than 256 distinct blocks, use a larger CHAR_CLASS_BLOCK_SIZE\n");
+            return 1;
+        }
+        stage1[b] = (nlp_uint8_t)k;
+    }
+    // lowercase rather than case folding, which also maps U+00B5 and U+03C2: uncased BERT uses str.lower()
+    if (build_case_table(&lower_table, utf8proc_tolower) || build_case_table(&upper_table, utf8proc_toupper)
+        || check_lower_lengths())
+        return 1;
+
+    printf("/* Generated by tools/gen_char_class.c from utf8proc %s, do not edit */\n", utf8proc_version());
+    printf("#include \"char_class.h\"\n\n");
+    printf("const nlp_uint8_t char_class_stage1[%d] = {\n", NUM_BLOCKS);
+    print_bytes(stage1, NUM_BLOCKS, "    ");
+    printf("};\n\n");
+    printf("const nlp_uint8_t char_class_stage2[%zu][CHAR_CLASS_BLOCK_SIZE] = {\n", num_blocks);
+    for (size_t k = 0; k < num_blocks; k++) {
+        printf("    {\n");
+        print_bytes(blocks[k], CHAR_CLASS_BLOCK_SIZE, "        ");
+        printf("    },\n");
+    }
+    printf("};\n");
+    print_case_table(&lower_table);
+    print_case_table(&upper_table);
+    return 0;
+}